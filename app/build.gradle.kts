@@ -153,6 +153,12 @@ android {
         }
     }
 
+    androidResources {
+        // Upscaling models are mapped straight from the APK, which needs them
+        // stored uncompressed
+        noCompress += listOf("bin", "param")
+    }
+
     dependenciesInfo {
         includeInApk = Config.includeDependencyInfo
         includeInBundle = Config.includeDependencyInfo
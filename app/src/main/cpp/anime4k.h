@@ -1,15 +1,14 @@
 #pragma once
 #include <EGL/egl.h>
 #include <GLES3/gl3.h>
-#include <android/log.h>
 #include <map>
 #include <string>
 #include <vector>
 
-#define ANIME4K_LOGD(...)                                                      \
-  __android_log_print(ANDROID_LOG_DEBUG, "Anime4K", __VA_ARGS__)
-#define ANIME4K_LOGE(...)                                                      \
-  __android_log_print(ANDROID_LOG_ERROR, "Anime4K", __VA_ARGS__)
+#include "native_log.h"
+
+#define ANIME4K_LOGD(...) NATIVE_LOGD("Anime4K", __VA_ARGS__)
+#define ANIME4K_LOGE(...) NATIVE_LOGE("Anime4K", __VA_ARGS__)
 
 class Anime4K {
 public:
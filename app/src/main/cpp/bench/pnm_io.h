@@ -0,0 +1,88 @@
+// Tiny binary PNM (P5/P6/P7) reader producing packed RGBA8 pixels, so real
+// pages can be benchmarked without an image codec dependency. Convert with
+// e.g. `convert page.png page.ppm`.
+
+#ifndef UPSCALE_PNM_IO_H
+#define UPSCALE_PNM_IO_H
+
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static inline int pnm_read_int(FILE *fp) {
+  int c = fgetc(fp);
+  while (c != EOF && (isspace(c) || c == '#')) {
+    if (c == '#') {
+      while (c != EOF && c != '\n')
+        c = fgetc(fp);
+    }
+    c = fgetc(fp);
+  }
+  int v = 0;
+  while (c != EOF && isdigit(c)) {
+    v = v * 10 + (c - '0');
+    c = fgetc(fp);
+  }
+  return v;
+}
+
+// Returns 0 on success. P7 is only accepted with DEPTH 4 (RGB_ALPHA).
+static inline int pnm_load_rgba(const std::string &path,
+                                std::vector<unsigned char> &rgba, int &w,
+                                int &h) {
+  FILE *fp = fopen(path.c_str(), "rb");
+  if (!fp)
+    return -1;
+
+  char magic[3] = {0};
+  if (fread(magic, 1, 2, fp) != 2 || magic[0] != 'P') {
+    fclose(fp);
+    return -1;
+  }
+
+  int channels = 0;
+  int maxval = 0;
+  if (magic[1] == '5' || magic[1] == '6') {
+    channels = magic[1] == '5' ? 1 : 3;
+    w = pnm_read_int(fp);
+    h = pnm_read_int(fp);
+    maxval = pnm_read_int(fp);
+  } else if (magic[1] == '7') {
+    char line[128];
+    while (fgets(line, sizeof(line), fp)) {
+      if (strncmp(line, "ENDHDR", 6) == 0)
+        break;
+      sscanf(line, "WIDTH %d", &w);
+      sscanf(line, "HEIGHT %d", &h);
+      sscanf(line, "DEPTH %d", &channels);
+      sscanf(line, "MAXVAL %d", &maxval);
+    }
+  }
+
+  if (w <= 0 || h <= 0 || maxval != 255 || (channels != 1 && channels != 3 &&
+                                            channels != 4)) {
+    fclose(fp);
+    return -1;
+  }
+
+  std::vector<unsigned char> raw((size_t)w * h * channels);
+  size_t got = fread(raw.data(), 1, raw.size(), fp);
+  fclose(fp);
+  if (got != raw.size())
+    return -1;
+
+  rgba.resize((size_t)w * h * 4);
+  for (size_t i = 0; i < (size_t)w * h; i++) {
+    const unsigned char *s = &raw[i * channels];
+    unsigned char *d = &rgba[i * 4];
+    d[0] = s[0];
+    d[1] = channels >= 3 ? s[1] : s[0];
+    d[2] = channels >= 3 ? s[2] : s[0];
+    d[3] = channels == 4 ? s[3] : 255;
+  }
+  return 0;
+}
+
+#endif // UPSCALE_PNM_IO_H
@@ -0,0 +1,760 @@
+// Host benchmark for the upscaling core.
+//
+// Drives Waifu2x::process on the CPU over the bundled models and sweeps tile
+// size, prepadding and thread count. Results go to stdout as JSON: one entry
+// per (model, page, tilesize, prepadding, threads) with throughput in input
+// megapixels per second, per-stage latency, peak RSS and the share of flat
+// tiles that skipped inference (--flat-tolerance -1 disables skipping).
+// --tile-cache gives each model a tile cache of that size shared by all of
+// its cases, so pages listed later reuse tiles from earlier ones; the
+// reported hit rate is that of each case's first (cold) run.
+// --heights adds synthetic strips of the --size width at each height (e.g.
+// 2000,8000,20000 for webtoons); engine_peak_kb, the peak RSS above the
+// page buffers, should stay flat as the height grows.
+// --overlaps adds cases in blend seam mode, one per overlap, next to the
+// --paddings ones; compare their mp_per_s and, for quality, see
+// tests/seam_blend_test.cpp.
+// --workers runs each thread count with that many concurrent extractors
+// sharing it (inter-tile parallelism) next to the single extractor
+// (intra-tile). On 4-, 8- and 16-core hosts, e.g.
+// --threads 4,8,16 --workers 1,2,4,8 shows where splitting the cores
+// between tiles overtakes giving them all to one tile.
+//
+//   upscale-bench [--model-dir DIR] [--models a,b] [--tiles 64,128]
+//                 [--paddings 10,18] [--threads 1,2,4] [--workers 1,2]
+//                 [--size WxH] [--heights H1,H2] [--repeat N] [--warmup N]
+//                 [--flat-tolerance N] [--tile-cache MB] [--overlaps 4,8]
+//                 [page.ppm ...]
+//   upscale-bench --dispatch N
+//   upscale-bench --kernels
+//   upscale-bench --pipeline-cache DIR [--models a,b]
+//
+// --dispatch compares thread churn and tail latency of the old
+// std::async-per-tile write-back against the engine's persistent WorkerPool
+// on N synthetic write-back tasks, without running any model. --kernels
+// times the write-back conversion kernel against its scalar reference.
+// --pipeline-cache times loading each model on Vulkan device 0 without a
+// pipeline cache, with an empty one in DIR (cold) and with the one that run
+// saved (warm), each in a fresh GPU instance as on an app launch. Without a
+// GPU, Mesa's lavapipe serves; set MESA_SHADER_CACHE_DISABLE=true so its own
+// shader cache does not warm the cold runs.
+
+#include "pixel_kernels.h"
+#include "pnm_io.h"
+#include "tile_cache.h"
+#include "vk_pipeline_cache.h"
+#include "waifu2x.h"
+#include "worker_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <dirent.h>
+#include <future>
+#include <sys/resource.h>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct BenchModel {
+  const char *name;
+  const char *path; // relative to the model dir, without extension
+  int scale;
+};
+
+static const BenchModel kModels[] = {
+    {"realcugan-2x", "realcugan-models/up2x-no-denoise", 2},
+    {"realcugan-3x", "realcugan-models/up3x-no-denoise", 3},
+    {"realcugan-4x", "realcugan-models/up4x-no-denoise", 4},
+    {"realesrgan-2x", "realesrgan-models/v3-anime/x2", 2},
+    {"realesrgan-4x", "realesrgan-models/v3-anime/x4", 4},
+    {"waifu2x-2x", "waifu2x-models/noise1_scale2.0x_model", 2},
+    {"upconv7-2x", "waifu2x-models-upconv7/noise0_scale2.0x_model", 2},
+};
+
+struct BenchPage {
+  std::string name;
+  int w = 0;
+  int h = 0;
+  std::vector<unsigned char> rgba;
+};
+
+struct BenchOptions {
+  std::string model_dir = UPSCALE_MODEL_DIR;
+  std::vector<std::string> models = {"realcugan-2x", "realesrgan-2x",
+                                     "waifu2x-2x", "upconv7-2x"};
+  std::vector<int> tiles = {64, 128, 256};
+  std::vector<int> paddings; // empty: the halo derived from each model
+  std::vector<int> threads = {1, 2, 4};
+  std::vector<int> workers = {1}; // concurrent extractors per thread count
+  int synthetic_w = 512;
+  int synthetic_h = 768;
+  std::vector<int> strip_heights; // extra synthetic pages, synthetic_w wide
+  int repeat = 3;
+  int warmup = 1;
+  int flat_tolerance = 2;
+  int tile_cache_mb = 0;
+  std::vector<int> overlaps; // blend seam mode cases
+  std::vector<std::string> page_paths;
+};
+
+static std::vector<std::string> split(const std::string &s) {
+  std::vector<std::string> out;
+  std::stringstream ss(s);
+  std::string item;
+  while (std::getline(ss, item, ','))
+    if (!item.empty())
+      out.push_back(item);
+  return out;
+}
+
+static std::vector<int> split_ints(const std::string &s) {
+  std::vector<int> out;
+  for (const std::string &item : split(s))
+    out.push_back(atoi(item.c_str()));
+  return out;
+}
+
+// Synthetic B/W manga page: white paper, black panel frames and gutters,
+// screentone, speech bubbles and text-like strokes.
+static BenchPage make_synthetic_page(int w, int h) {
+  BenchPage page;
+  page.name = "synthetic-" + std::to_string(w) + "x" + std::to_string(h);
+  page.w = w;
+  page.h = h;
+  page.rgba.assign((size_t)w * h * 4, 255);
+
+  auto set = [&](int x, int y, unsigned char v) {
+    if (x < 0 || y < 0 || x >= w || y >= h)
+      return;
+    unsigned char *p = &page.rgba[((size_t)y * w + x) * 4];
+    p[0] = p[1] = p[2] = v;
+  };
+
+  const int margin = w / 16;
+  const int gutter = w / 40 + 2;
+  const int rows = 3;
+  const int cols = 2;
+  const int panel_w = (w - 2 * margin - (cols - 1) * gutter) / cols;
+  const int panel_h = (h - 2 * margin - (rows - 1) * gutter) / rows;
+
+  unsigned int seed = 12345;
+  auto rnd = [&]() {
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) & 0x7fff;
+  };
+
+  for (int r = 0; r < rows; r++) {
+    for (int c = 0; c < cols; c++) {
+      int x0 = margin + c * (panel_w + gutter);
+      int y0 = margin + r * (panel_h + gutter);
+      int x1 = x0 + panel_w;
+      int y1 = y0 + panel_h;
+
+      // Screentone over the lower half of every other panel
+      if ((r + c) % 2 == 0) {
+        for (int y = (y0 + y1) / 2; y < y1; y++)
+          for (int x = x0; x < x1; x++)
+            if ((x % 6 - 3) * (x % 6 - 3) + (y % 6 - 3) * (y % 6 - 3) < 3)
+              set(x, y, 40);
+      } else {
+        // Smooth shading
+        for (int y = y0; y < y1; y++)
+          for (int x = x0; x < x1; x++)
+            set(x, y, (unsigned char)(200 + 55 * (x - x0) / panel_w));
+      }
+
+      // Speech bubble with a few lines of "text"
+      int cx = x0 + panel_w / 3;
+      int cy = y0 + panel_h / 3;
+      int rx = panel_w / 5;
+      int ry = panel_h / 6;
+      for (int y = cy - ry - 2; y <= cy + ry + 2; y++) {
+        for (int x = cx - rx - 2; x <= cx + rx + 2; x++) {
+          float dx = (float)(x - cx) / rx;
+          float dy = (float)(y - cy) / ry;
+          float d = dx * dx + dy * dy;
+          if (d <= 1.0f)
+            set(x, y, 255);
+          else if (d <= 1.12f)
+            set(x, y, 0);
+        }
+      }
+      for (int line = -1; line <= 1; line++) {
+        int ty = cy + line * ry / 3;
+        for (int x = cx - rx / 2; x < cx + rx / 2; x++)
+          if (rnd() % 5 != 0)
+            for (int t = 0; t < 2; t++)
+              set(x, ty + t, 0);
+      }
+
+      // Panel frame
+      for (int t = 0; t < 3; t++) {
+        for (int x = x0; x < x1; x++) {
+          set(x, y0 + t, 0);
+          set(x, y1 - 1 - t, 0);
+        }
+        for (int y = y0; y < y1; y++) {
+          set(x0 + t, y, 0);
+          set(x1 - 1 - t, y, 0);
+        }
+      }
+    }
+  }
+  return page;
+}
+
+// Reads a kB field such as "VmHWM:" (peak RSS) from /proc/self/status.
+static long read_status_kb(const char *field) {
+  FILE *fp = fopen("/proc/self/status", "r");
+  if (!fp)
+    return -1;
+  const size_t len = strlen(field);
+  char line[256];
+  long kb = -1;
+  while (fgets(line, sizeof(line), fp)) {
+    if (strncmp(line, field, len) == 0) {
+      kb = atol(line + len);
+      break;
+    }
+  }
+  fclose(fp);
+  return kb;
+}
+
+// Reset the kernel's peak RSS watermark so each case reports its own peak.
+static void reset_peak_rss() {
+  FILE *fp = fopen("/proc/self/clear_refs", "w");
+  if (fp) {
+    fputs("5", fp);
+    fclose(fp);
+  }
+}
+
+static double median(std::vector<double> v) {
+  if (v.empty())
+    return 0.0;
+  std::sort(v.begin(), v.end());
+  return v[v.size() / 2];
+}
+
+static long context_switches() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_nvcsw + usage.ru_nivcsw;
+}
+
+struct BenchResult {
+  std::vector<double> total_ms;
+  std::vector<Waifu2xStats> stats;
+  long peak_rss_kb = -1;
+  long engine_peak_kb = -1; // peak above the resident model and page buffers
+  long context_switches = 0;
+  int first_run_cache_hits = 0;
+  int first_run_heap_allocs = 0;
+  size_t cache_bytes = 0;
+};
+
+static int run_case(Waifu2x &engine, const BenchPage &page, int repeat,
+                    int warmup, BenchResult &result) {
+  const int out_w = page.w * engine.scale;
+  const int out_h = page.h * engine.scale;
+  std::vector<unsigned char> out((size_t)out_w * out_h * 4);
+
+  // The output buffer is already touched, so the peak above this baseline
+  // is the engine's own working memory.
+  reset_peak_rss();
+  const long baseline_kb = read_status_kb("VmRSS:");
+  const long csw_start = context_switches();
+  for (int i = 0; i < warmup + repeat; i++) {
+    auto t0 = std::chrono::steady_clock::now();
+    Waifu2xStats stats;
+    ProcessContext ctx;
+    ctx.out_pixels = out.data();
+    ctx.out_stride = out_w * 4;
+    ctx.stats = &stats;
+    int ret = engine.process(page.rgba.data(), page.w, page.h, page.w * 4,
+                             ctx);
+    if (ret != 0)
+      return ret;
+    double ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - t0)
+                    .count();
+
+    if (i == 0) {
+      result.first_run_cache_hits = stats.cache_hits;
+      result.first_run_heap_allocs = stats.pool_heap_allocs;
+    }
+    if (i >= warmup) {
+      result.total_ms.push_back(ms);
+      result.stats.push_back(stats);
+    }
+  }
+  result.peak_rss_kb = read_status_kb("VmHWM:");
+  if (result.peak_rss_kb >= 0 && baseline_kb >= 0)
+    result.engine_peak_kb = result.peak_rss_kb - baseline_kb;
+  if (engine.tile_cache)
+    result.cache_bytes = engine.tile_cache->stats().bytes;
+  result.context_switches =
+      (context_switches() - csw_start) / (warmup + repeat);
+  return 0;
+}
+
+static void print_result(bool first, const BenchModel &model,
+                         const BenchPage &page, int tilesize, int threads,
+                         const BenchResult &r) {
+  std::vector<double> pre, alpha, infer, write, p50, p99;
+  for (const Waifu2xStats &s : r.stats) {
+    pre.push_back(s.preprocess_ms);
+    alpha.push_back(s.alpha_ms);
+    infer.push_back(s.inference_ms);
+    write.push_back(s.writeback_ms);
+    p50.push_back(s.tile_latency_p50_ms);
+    p99.push_back(s.tile_latency_p99_ms);
+  }
+  const double med = median(r.total_ms);
+  const double mp = (double)page.w * page.h / 1e6;
+  const int tiles = r.stats.empty() ? 0 : r.stats[0].tiles;
+  const int skipped = r.stats.empty() ? 0 : r.stats[0].skipped_tiles;
+  const int alpha_tiles = r.stats.empty() ? 0 : r.stats[0].alpha_tiles;
+  // Effective value: process() raises it to the model's own crop
+  const int prepadding = r.stats.empty() ? 0 : r.stats[0].prepadding;
+  const int tile_input = r.stats.empty() ? 0 : r.stats[0].tile_input_size;
+  const int overlap = r.stats.empty() ? 0 : r.stats[0].blend_overlap;
+  const int workers = r.stats.empty() ? 0 : r.stats[0].inference_workers;
+  const int worker_threads =
+      r.stats.empty() ? 0 : r.stats[0].inference_threads;
+
+  printf("%s\n    {\"model\": \"%s\", \"page\": \"%s\", \"width\": %d, "
+         "\"height\": %d, \"scale\": %d, \"tilesize\": %d, \"prepadding\": %d, "
+         "\"tile_input\": %d, \"blend_overlap\": %d, \"threads\": %d, "
+         "\"workers\": %d, \"threads_per_worker\": %d,\n"
+         "     \"tiles\": %d, \"skipped_tiles\": %d, \"skip_ratio\": %.3f,\n",
+         first ? "" : ",", model.name, page.name.c_str(), page.w, page.h,
+         model.scale, tilesize, prepadding, tile_input, overlap, threads,
+         workers, worker_threads, tiles, skipped,
+         tiles > 0 ? (double)skipped / tiles : 0.0);
+  printf("     \"mp_per_s\": %.4f, \"total_ms\": {\"min\": %.2f, \"median\": "
+         "%.2f, \"max\": %.2f},\n",
+         med > 0 ? mp / (med / 1000.0) : 0.0,
+         *std::min_element(r.total_ms.begin(), r.total_ms.end()), med,
+         *std::max_element(r.total_ms.begin(), r.total_ms.end()));
+  printf("     \"stages_ms\": {\"preprocess\": %.2f, \"alpha\": %.2f, "
+         "\"inference\": %.2f, \"writeback\": %.2f}, \"alpha_tiles\": %d,\n",
+         median(pre), median(alpha), median(infer), median(write),
+         alpha_tiles);
+  printf("     \"tile_latency_ms\": {\"p50\": %.2f, \"p99\": %.2f},\n",
+         median(p50), median(p99));
+  printf("     \"tile_cache\": {\"hit_rate\": %.3f, \"bytes\": %zu},\n",
+         tiles > 0 ? (double)r.first_run_cache_hits / tiles : 0.0,
+         r.cache_bytes);
+  // The first run warms the pools; later runs should not touch the heap
+  if (!r.stats.empty()) {
+    const Waifu2xStats &warm = r.stats.back();
+    printf("     \"pool\": {\"requests\": %d, \"first_heap_allocs\": %d, "
+           "\"last_heap_allocs\": %d, \"vk_requests\": %d, \"mb\": %.1f},\n",
+           warm.pool_requests, r.first_run_heap_allocs, warm.pool_heap_allocs,
+           warm.vk_pool_requests, warm.pool_mb);
+  }
+  printf("     \"context_switches\": %ld, \"peak_rss_kb\": %ld, "
+         "\"engine_peak_kb\": %ld}",
+         r.context_switches, r.peak_rss_kb, r.engine_peak_kb);
+}
+
+// Stand-in for one 2x write-back: 256x256 planar float to RGBA8. The old
+// engine opened a nested OpenMP region per tile; the pool path does not.
+static void fake_writeback(std::vector<unsigned char> &dst, int seed,
+                           bool nested_omp) {
+  const int n = 256 * 256;
+  std::vector<float> src(n * 3);
+  for (int i = 0; i < n * 3; i++)
+    src[i] = (float)((i + seed) % 255) / 255.0f;
+#pragma omp parallel for num_threads(2) if (nested_omp)
+  for (int i = 0; i < n; i++)
+    for (int c = 0; c < 3; c++)
+      dst[i * 4 + c] = (unsigned char)std::max(
+          0.0f, std::min(255.0f, src[c * n + i] * 255.0f));
+}
+
+static double percentile(std::vector<double> v, int pct) {
+  if (v.empty())
+    return 0.0;
+  std::sort(v.begin(), v.end());
+  return v[(v.size() - 1) * pct / 100];
+}
+
+static void print_dispatch(bool first, const char *name, int tasks,
+                           int threads_created, double wall_ms,
+                           const std::vector<double> &latency_ms, long csw) {
+  printf("%s\n    {\"dispatch\": \"%s\", \"tasks\": %d, \"threads_created\": "
+         "%d, \"wall_ms\": %.2f, \"latency_ms\": {\"p50\": %.3f, \"p99\": "
+         "%.3f, \"max\": %.3f}, \"context_switches\": %ld}",
+         first ? "" : ",", name, tasks, threads_created, wall_ms,
+         percentile(latency_ms, 50), percentile(latency_ms, 99),
+         percentile(latency_ms, 100), csw);
+}
+
+// Old engine behaviour: one std::async thread per tile, up to 32 in flight,
+// each opening its own OpenMP region, versus the persistent pool.
+static void run_dispatch_bench(int tasks) {
+  using clock = std::chrono::steady_clock;
+  std::vector<std::vector<unsigned char>> outputs(
+      64, std::vector<unsigned char>(256 * 256 * 4));
+
+  printf("{\"results\": [");
+  {
+    std::vector<double> latency(tasks);
+    const long csw = context_switches();
+    auto t0 = clock::now();
+    std::deque<std::future<void>> pipeline;
+    for (int i = 0; i < tasks; i++) {
+      while (pipeline.size() >= 32) {
+        pipeline.front().wait();
+        pipeline.pop_front();
+      }
+      auto t_submit = clock::now();
+      pipeline.push_back(std::async(std::launch::async, [&, i, t_submit]() {
+        fake_writeback(outputs[i % outputs.size()], i, true);
+        latency[i] = std::chrono::duration<double, std::milli>(clock::now() -
+                                                               t_submit)
+                         .count();
+      }));
+    }
+    while (!pipeline.empty()) {
+      pipeline.front().wait();
+      pipeline.pop_front();
+    }
+    double wall =
+        std::chrono::duration<double, std::milli>(clock::now() - t0).count();
+    print_dispatch(true, "std_async", tasks, tasks, wall, latency,
+                   context_switches() - csw);
+  }
+  {
+    WorkerPool pool(2, 4);
+    std::vector<double> latency;
+    const long csw = context_switches();
+    auto t0 = clock::now();
+    {
+      TileBatch batch(pool, tasks);
+      for (int i = 0; i < tasks; i++) {
+        batch.submit(i, [&, i]() {
+          fake_writeback(outputs[i % outputs.size()], i, false);
+        });
+        TileCompletion done;
+        while (batch.poll(done))
+          latency.push_back(done.latency_ms);
+      }
+      batch.wait();
+      TileCompletion done;
+      while (batch.poll(done))
+        latency.push_back(done.latency_ms);
+    }
+    double wall =
+        std::chrono::duration<double, std::milli>(clock::now() - t0).count();
+    print_dispatch(false, "worker_pool", tasks, pool.size(), wall, latency,
+                   context_switches() - csw);
+  }
+  printf("\n]}\n");
+}
+
+typedef void (*RowKernel)(const float *, const float *, const float *,
+                          const unsigned char *, unsigned char *, int, bool);
+
+// Planar float to RGBA8 throughput on a 1024x1024 tile, in MP/s.
+static void run_kernel_bench() {
+  const int w = 1024;
+  const int h = 1024;
+  std::vector<float> planes((size_t)w * h * 3);
+  for (size_t i = 0; i < planes.size(); i++)
+    planes[i] = (float)(i % 263) / 255.0f;
+  std::vector<unsigned char> alpha_plane((size_t)w * h);
+  for (size_t i = 0; i < alpha_plane.size(); i++)
+    alpha_plane[i] = (unsigned char)(i % 251);
+  std::vector<unsigned char> out((size_t)w * h * 4);
+
+  const struct {
+    const char *name;
+    RowKernel fn;
+  } kernels[] = {{"scalar", planar_bgr_to_rgba_row_scalar},
+                 {"simd", planar_bgr_to_rgba_row}};
+
+  printf("{\"results\": [");
+  bool first = true;
+  for (const auto &k : kernels) {
+    for (int variant = 0; variant < 3; variant++) {
+      const bool grayscale = variant == 1;
+      const bool alpha = variant == 2;
+      std::vector<double> ms;
+      for (int rep = 0; rep < 7; rep++) {
+        auto t0 = std::chrono::steady_clock::now();
+        for (int y = 0; y < h; y++) {
+          const float *row = planes.data() + (size_t)y * w;
+          k.fn(row, row + (size_t)w * h, row + (size_t)w * h * 2,
+               alpha ? alpha_plane.data() + (size_t)y * w : nullptr,
+               out.data() + (size_t)y * w * 4, w, grayscale);
+        }
+        ms.push_back(std::chrono::duration<double, std::milli>(
+                         std::chrono::steady_clock::now() - t0)
+                         .count());
+      }
+      const double med = median(ms);
+      printf("%s\n    {\"kernel\": \"%s\", \"variant\": \"%s\", \"median_ms\": "
+             "%.3f, \"mp_per_s\": %.1f}",
+             first ? "" : ",", k.name,
+             grayscale ? "grayscale" : (alpha ? "alpha" : "rgb"), med,
+             (double)w * h / 1e6 / (med / 1000.0));
+      first = false;
+    }
+  }
+  printf("\n]}\n");
+}
+
+#if NCNN_VULKAN
+// Removes the pipeline caches saved in dir.
+static void clear_pipeline_caches(const std::string &dir) {
+  DIR *d = opendir(dir.c_str());
+  if (!d)
+    return;
+  while (struct dirent *e = readdir(d))
+    if (strncmp(e->d_name, "pipelines-", 10) == 0)
+      remove((dir + "/" + e->d_name).c_str());
+  closedir(d);
+}
+
+static int run_pipeline_cache_bench(const BenchOptions &opt,
+                                    const std::string &dir) {
+  using clock = std::chrono::steady_clock;
+  printf("{\"results\": [");
+  bool first = true;
+  for (const std::string &name : opt.models) {
+    const BenchModel *model = nullptr;
+    for (const BenchModel &m : kModels)
+      if (name == m.name)
+        model = &m;
+    if (!model) {
+      fprintf(stderr, "Unknown model %s\n", name.c_str());
+      return 2;
+    }
+    const std::string base = opt.model_dir + "/" + model->path;
+    clear_pipeline_caches(dir);
+
+    const char *const runs[] = {"off", "cold", "warm"};
+    for (const char *run : runs) {
+      auto t0 = clock::now();
+      ncnn::create_gpu_instance();
+      install_pipeline_cache_hook();
+      if (ncnn::get_gpu_count() == 0) {
+        fprintf(stderr, "No Vulkan device (install lavapipe, e.g. "
+                        "mesa-vulkan-drivers)\n");
+        ncnn::destroy_gpu_instance();
+        return 1;
+      }
+      const double instance_ms =
+          std::chrono::duration<double, std::milli>(clock::now() - t0)
+              .count();
+      ModelLoadStats stats;
+      std::string device;
+      {
+        Waifu2x engine(0);
+        engine.scale = model->scale;
+        if (strcmp(run, "off") != 0)
+          engine.pipeline_cache_dir = dir;
+        if (engine.load(base + ".param", base + ".bin") != 0) {
+          fprintf(stderr, "Failed to load %s\n", base.c_str());
+          ncnn::destroy_gpu_instance();
+          return 1;
+        }
+        stats = engine.load_stats;
+        device = ncnn::get_gpu_info(0).device_name();
+      }
+      ncnn::destroy_gpu_instance();
+
+      printf("%s\n    {\"model\": \"%s\", \"device\": \"%s\", "
+             "\"pipeline_cache\": \"%s\", \"gpu_instance_ms\": %.2f, "
+             "\"load_ms\": %.2f, \"pipelines\": %d, \"restored\": %s}",
+             first ? "" : ",", model->name, device.c_str(), run, instance_ms,
+             stats.load_ms, stats.pipelines_created,
+             stats.pipelines_restored ? "true" : "false");
+      first = false;
+      fflush(stdout);
+    }
+  }
+  printf("\n]}\n");
+  return 0;
+}
+#endif
+
+static void usage() {
+  fprintf(stderr,
+          "usage: upscale-bench [--model-dir DIR] [--models a,b] "
+          "[--tiles 64,128] [--paddings 10,18] [--threads 1,2,4] "
+          "[--workers 1,2] [--size WxH] [--heights H1,H2] [--repeat N] "
+          "[--warmup N] [--flat-tolerance N] [--tile-cache MB] "
+          "[--overlaps 4,8] "
+          "[page.ppm ...]\n"
+          "       upscale-bench --dispatch N\n"
+          "       upscale-bench --kernels\n"
+          "       upscale-bench --pipeline-cache DIR [--models a,b]\n"
+          "models:");
+  for (const BenchModel &m : kModels)
+    fprintf(stderr, " %s", m.name);
+  fprintf(stderr, "\n");
+}
+
+int main(int argc, char **argv) {
+  BenchOptions opt;
+  std::string pipeline_cache_dir;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    auto next = [&]() -> std::string {
+      if (i + 1 >= argc) {
+        usage();
+        exit(2);
+      }
+      return argv[++i];
+    };
+    if (arg == "--model-dir")
+      opt.model_dir = next();
+    else if (arg == "--models")
+      opt.models = split(next());
+    else if (arg == "--tiles")
+      opt.tiles = split_ints(next());
+    else if (arg == "--paddings")
+      opt.paddings = split_ints(next());
+    else if (arg == "--threads")
+      opt.threads = split_ints(next());
+    else if (arg == "--workers")
+      opt.workers = split_ints(next());
+    else if (arg == "--size")
+      sscanf(next().c_str(), "%dx%d", &opt.synthetic_w, &opt.synthetic_h);
+    else if (arg == "--heights")
+      opt.strip_heights = split_ints(next());
+    else if (arg == "--repeat")
+      opt.repeat = std::max(1, atoi(next().c_str()));
+    else if (arg == "--warmup")
+      opt.warmup = std::max(0, atoi(next().c_str()));
+    else if (arg == "--flat-tolerance")
+      opt.flat_tolerance = atoi(next().c_str());
+    else if (arg == "--tile-cache")
+      opt.tile_cache_mb = std::max(0, atoi(next().c_str()));
+    else if (arg == "--overlaps")
+      opt.overlaps = split_ints(next());
+    else if (arg == "--dispatch") {
+      run_dispatch_bench(std::max(1, atoi(next().c_str())));
+      return 0;
+    } else if (arg == "--kernels") {
+      run_kernel_bench();
+      return 0;
+    } else if (arg == "--pipeline-cache")
+      pipeline_cache_dir = next();
+    else if (arg == "-h" || arg == "--help") {
+      usage();
+      return 0;
+    } else if (arg[0] == '-') {
+      usage();
+      return 2;
+    } else
+      opt.page_paths.push_back(arg);
+  }
+
+  if (!pipeline_cache_dir.empty()) {
+#if NCNN_VULKAN
+    return run_pipeline_cache_bench(opt, pipeline_cache_dir);
+#else
+    fprintf(stderr, "--pipeline-cache needs ncnn built with Vulkan\n");
+    return 2;
+#endif
+  }
+
+  std::vector<BenchPage> pages;
+  pages.push_back(make_synthetic_page(opt.synthetic_w, opt.synthetic_h));
+  for (int strip_h : opt.strip_heights)
+    pages.push_back(make_synthetic_page(opt.synthetic_w, strip_h));
+  for (const std::string &path : opt.page_paths) {
+    BenchPage page;
+    page.name = path.substr(path.find_last_of('/') + 1);
+    if (pnm_load_rgba(path, page.rgba, page.w, page.h) != 0) {
+      fprintf(stderr, "Cannot read %s (binary PPM/PGM/PAM expected)\n",
+              path.c_str());
+      return 1;
+    }
+    pages.push_back(std::move(page));
+  }
+
+  printf("{\"results\": [");
+  bool first = true;
+  for (const std::string &name : opt.models) {
+    const BenchModel *model = nullptr;
+    for (const BenchModel &m : kModels)
+      if (name == m.name)
+        model = &m;
+    if (!model) {
+      fprintf(stderr, "Unknown model %s\n", name.c_str());
+      usage();
+      return 2;
+    }
+
+    // Intra-tile (every thread in one extractor) against inter-tile
+    // (threads split between concurrent extractors) parallelism
+    std::vector<std::pair<int, int>> cpu_configs;
+    for (int threads : opt.threads)
+      for (int workers : opt.workers)
+        if (workers >= 1 && workers <= threads)
+          cpu_configs.push_back({threads, workers});
+
+    for (const auto &cpu : cpu_configs) {
+      const int threads = cpu.first;
+      Waifu2x engine(-1, false, threads);
+      engine.inference_workers = cpu.second;
+      engine.scale = model->scale;
+      engine.flat_tile_tolerance = opt.flat_tolerance;
+      TileCache cache((size_t)opt.tile_cache_mb << 20);
+      if (opt.tile_cache_mb > 0)
+        engine.tile_cache = &cache;
+      std::string base = opt.model_dir + "/" + model->path;
+      if (engine.load(base + ".param", base + ".bin") != 0) {
+        fprintf(stderr, "Failed to load %s\n", base.c_str());
+        return 1;
+      }
+
+      // Default to the halo load() derived from the model. Blend cases
+      // carry their overlap instead of a prepadding.
+      std::vector<std::pair<Waifu2x::SeamMode, int>> seams;
+      for (int prepadding : opt.paddings)
+        seams.push_back({Waifu2x::SEAM_PADDING, prepadding});
+      if (opt.paddings.empty())
+        seams.push_back({Waifu2x::SEAM_PADDING, engine.prepadding});
+      for (int overlap : opt.overlaps)
+        seams.push_back({Waifu2x::SEAM_BLEND, overlap});
+
+      for (const BenchPage &page : pages) {
+        for (int tilesize : opt.tiles) {
+          for (const auto &seam : seams) {
+            engine.tilesize = tilesize;
+            engine.seam_mode = seam.first;
+            if (seam.first == Waifu2x::SEAM_BLEND)
+              engine.blend_overlap = seam.second;
+            else
+              engine.prepadding = seam.second;
+
+            BenchResult result;
+            if (run_case(engine, page, opt.repeat, opt.warmup, result) != 0) {
+              fprintf(stderr, "Processing failed: %s on %s\n", model->name,
+                      page.name.c_str());
+              return 1;
+            }
+            print_result(first, *model, page, tilesize, threads, result);
+            first = false;
+            fflush(stdout);
+          }
+        }
+      }
+    }
+  }
+  printf("\n]}\n");
+  return 0;
+}
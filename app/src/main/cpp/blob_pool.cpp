@@ -0,0 +1,72 @@
+#include "blob_pool.h"
+
+BlobPool::~BlobPool() {
+  // Every Mat allocated from the pool must be gone by now
+  for (const Block &b : blocks)
+    ncnn::fastFree(b.ptr);
+}
+
+void *BlobPool::fastMalloc(size_t size) {
+  {
+    std::lock_guard<std::mutex> guard(mutex);
+    requests++;
+    // Best fit among idle blocks no more than 4/3 of the request
+    Block *best = nullptr;
+    for (Block &b : blocks) {
+      if (b.in_use || b.size < size || b.size / 4 * 3 > size)
+        continue;
+      if (!best || b.size < best->size)
+        best = &b;
+    }
+    if (best) {
+      best->in_use = true;
+      return best->ptr;
+    }
+    heap_allocs++;
+  }
+
+  void *ptr = ncnn::fastMalloc(size);
+  if (!ptr)
+    return nullptr;
+  std::lock_guard<std::mutex> guard(mutex);
+  blocks.push_back(Block{ptr, size, true});
+  return ptr;
+}
+
+void BlobPool::fastFree(void *ptr) {
+  if (!ptr)
+    return;
+  std::lock_guard<std::mutex> guard(mutex);
+  for (Block &b : blocks) {
+    if (b.ptr == ptr) {
+      b.in_use = false;
+      return;
+    }
+  }
+}
+
+void BlobPool::clear() {
+  std::lock_guard<std::mutex> guard(mutex);
+  size_t kept = 0;
+  for (const Block &b : blocks) {
+    if (b.in_use)
+      blocks[kept++] = b;
+    else
+      ncnn::fastFree(b.ptr);
+  }
+  blocks.resize(kept);
+}
+
+BlobPoolStats BlobPool::stats() const {
+  std::lock_guard<std::mutex> guard(mutex);
+  BlobPoolStats s;
+  s.requests = requests;
+  s.heap_allocs = heap_allocs;
+  s.blocks = blocks.size();
+  for (const Block &b : blocks) {
+    s.bytes += b.size;
+    if (!b.in_use)
+      s.idle_bytes += b.size;
+  }
+  return s;
+}
@@ -0,0 +1,79 @@
+// Long-lived allocators for tile blobs and network workspaces, owned by the
+// engine and reused across tiles and images.
+
+#ifndef BLOB_POOL_H
+#define BLOB_POOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// ncnn
+#include "allocator.h"
+
+struct BlobPoolStats {
+  uint64_t requests = 0;    // fastMalloc calls
+  uint64_t heap_allocs = 0; // of those, served by a fresh heap block
+  size_t bytes = 0;         // held by the pool, in use or idle
+  size_t idle_bytes = 0;
+  size_t blocks = 0;
+};
+
+// Thread-safe pool of heap blocks. A freed block stays with the pool and is
+// handed out again for any request between 3/4 of its size and its size, so
+// once every tile shape of a page has been seen, processing the next pages
+// of the same size performs no heap allocation. Block bookkeeping lives in
+// a vector that only grows with the number of distinct blocks.
+class BlobPool : public ncnn::Allocator {
+public:
+  BlobPool() = default;
+  ~BlobPool() override;
+
+  void *fastMalloc(size_t size) override;
+  void fastFree(void *ptr) override;
+
+  // Releases idle blocks; blocks in use are kept.
+  void clear();
+  BlobPoolStats stats() const;
+
+private:
+  struct Block {
+    void *ptr;
+    size_t size;
+    bool in_use;
+  };
+
+  BlobPool(const BlobPool &) = delete;
+  BlobPool &operator=(const BlobPool &) = delete;
+
+  mutable std::mutex mutex;
+  std::vector<Block> blocks;
+  uint64_t requests = 0;
+  uint64_t heap_allocs = 0;
+};
+
+#if NCNN_VULKAN
+// Adds a request counter to one of ncnn's Vulkan allocators (VkBlobAllocator
+// or VkStagingAllocator), which already sub-allocate from large device
+// memory blocks and keep them across frees.
+template <class Base> class CountingVkAllocator : public Base {
+public:
+  explicit CountingVkAllocator(const ncnn::VulkanDevice *vkdev) : Base(vkdev) {}
+
+  ncnn::VkBufferMemory *fastMalloc(size_t size) override {
+    requests++;
+    return Base::fastMalloc(size);
+  }
+  ncnn::VkImageMemory *fastMalloc(int w, int h, int c, size_t elemsize,
+                                  int elempack) override {
+    requests++;
+    return Base::fastMalloc(w, h, c, elemsize, elempack);
+  }
+
+  std::atomic<uint64_t> requests{0};
+};
+#endif // NCNN_VULKAN
+
+#endif // BLOB_POOL_H
@@ -0,0 +1,130 @@
+#include "job_scheduler.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace {
+
+// Runs before b: higher priority, then earlier arrival
+bool runs_before(const JobScheduler::Job &a, const JobScheduler::Job &b) {
+  if (a.priority != b.priority)
+    return a.priority > b.priority;
+  return a.seq < b.seq;
+}
+
+} // namespace
+
+JobScheduler::JobScheduler(int slots, int (*priority_of)(int id))
+    : slots(slots < 1 ? 1 : slots), priority_of(priority_of) {}
+
+bool JobScheduler::may_start(const Job &job) const {
+  if (running >= slots)
+    return false;
+  // Only the first waiting jobs in order get the free slots
+  int ahead = 0;
+  for (const Job *other : jobs) {
+    if (other != &job && !other->running && runs_before(*other, job))
+      ahead++;
+  }
+  return ahead < slots - running;
+}
+
+bool JobScheduler::should_yield(const Job &job) const {
+  // A waiting job with a free slot is about to start by itself
+  if (running < slots)
+    return false;
+  for (const Job *other : jobs) {
+    if (!other->running && other->priority > job.priority)
+      return true;
+  }
+  return false;
+}
+
+bool JobScheduler::wait_turn(std::unique_lock<std::mutex> &lock, Job &job,
+                             const std::atomic<bool> *cancel) {
+  using clock = std::chrono::steady_clock;
+  const clock::time_point t0 = clock::now();
+  // Cancellation is a plain flag nobody notifies, so poll it
+  while (!may_start(job)) {
+    if (cancel && cancel->load())
+      break;
+    cv.wait_for(lock, std::chrono::milliseconds(10));
+  }
+  job.waited_ms +=
+      std::chrono::duration<double, std::milli>(clock::now() - t0).count();
+  if (!may_start(job))
+    return false;
+  job.running = true;
+  running++;
+  return true;
+}
+
+bool JobScheduler::enter(Job &job, const std::atomic<bool> *cancel) {
+  std::unique_lock<std::mutex> lock(mutex);
+  job.seq = next_seq++;
+  job.running = false;
+  if (priority_of)
+    job.priority = priority_of(job.id);
+  jobs.push_back(&job);
+  entered++;
+  return wait_turn(lock, job, cancel);
+}
+
+bool JobScheduler::checkpoint(Job &job, const std::atomic<bool> *cancel) {
+  std::unique_lock<std::mutex> lock(mutex);
+  if (!job.running || !should_yield(job))
+    return true;
+  job.running = false;
+  running--;
+  job.preemptions++;
+  preemptions++;
+  cv.notify_all();
+  return wait_turn(lock, job, cancel);
+}
+
+void JobScheduler::leave(Job &job) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = std::find(jobs.begin(), jobs.end(), &job);
+  if (it == jobs.end())
+    return;
+  jobs.erase(it);
+  if (job.running) {
+    job.running = false;
+    running--;
+  }
+  cv.notify_all();
+}
+
+void JobScheduler::set_priority(int id, int priority) {
+  std::lock_guard<std::mutex> lock(mutex);
+  for (Job *job : jobs) {
+    if (job->id == id)
+      job->priority = priority;
+  }
+  cv.notify_all();
+}
+
+void JobScheduler::refresh_priorities() {
+  if (!priority_of)
+    return;
+  std::lock_guard<std::mutex> lock(mutex);
+  for (Job *job : jobs)
+    job->priority = priority_of(job->id);
+  cv.notify_all();
+}
+
+void JobScheduler::set_slots(int count) {
+  std::lock_guard<std::mutex> lock(mutex);
+  slots = count < 1 ? 1 : count;
+  cv.notify_all();
+}
+
+JobSchedulerStats JobScheduler::stats() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  JobSchedulerStats s;
+  s.jobs = entered;
+  s.preemptions = preemptions;
+  s.running = running;
+  s.waiting = (int)jobs.size() - running;
+  return s;
+}
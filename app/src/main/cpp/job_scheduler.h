@@ -0,0 +1,121 @@
+// Priority scheduling of upscale jobs with tile-granular preemption.
+
+#ifndef JOB_SCHEDULER_H
+#define JOB_SCHEDULER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+struct JobSchedulerStats {
+  uint64_t jobs = 0;        // jobs that entered
+  uint64_t preemptions = 0; // times a running job handed over its slot
+  int running = 0;
+  int waiting = 0;
+};
+
+// Orders the jobs competing for one engine. At most `slots` jobs run at a
+// time (one suits a GPU, which serializes inference anyway); the others wait
+// in priority order, then arrival order. A running job checks in at every
+// tile boundary and, while a waiting job has strictly higher priority, hands
+// over its slot and waits to be resumed. Its finished tiles are already
+// written and its loop state stays on its own thread, so it resumes exactly
+// where it stopped.
+class JobScheduler {
+public:
+  // One call's place in the schedule. Fields are owned by the scheduler
+  // between enter() and leave().
+  struct Job {
+    int id = -1;
+    // Higher runs first. Set before enter(), or read from the scheduler's
+    // priority source when it has one.
+    int priority = 0;
+    uint64_t seq = 0;
+    bool running = false;
+    int preemptions = 0;  // times this job yielded
+    double waited_ms = 0; // queued before starting and while preempted
+  };
+
+  // priority_of, when given, maps a job id to its current priority. enter()
+  // and refresh_priorities() read it under the scheduler's lock, so a
+  // priority change made before a job enters is never lost.
+  explicit JobScheduler(int slots = 1, int (*priority_of)(int id) = nullptr);
+
+  // Blocks until job may run. Returns false, without running, when cancel
+  // is set while waiting; leave() must still be called.
+  bool enter(Job &job, const std::atomic<bool> *cancel = nullptr);
+  // Tile boundary of a running job: yields to higher-priority waiting jobs
+  // and blocks until job runs again. Returns false when cancelled while
+  // preempted.
+  bool checkpoint(Job &job, const std::atomic<bool> *cancel = nullptr);
+  // Removes job, running or not, and hands its slot on.
+  void leave(Job &job);
+
+  // Changes the priority of every entered job with this id.
+  void set_priority(int id, int priority);
+  // Re-reads every entered job's priority from the priority source, after
+  // what it depends on has changed.
+  void refresh_priorities();
+
+  // Changes how many jobs may run at once, e.g. when the engine the jobs
+  // compete for is replaced by one with another backend.
+  void set_slots(int count);
+
+  JobSchedulerStats stats() const;
+
+private:
+  JobScheduler(const JobScheduler &) = delete;
+  JobScheduler &operator=(const JobScheduler &) = delete;
+
+  // Called with mutex held
+  bool may_start(const Job &job) const;
+  bool should_yield(const Job &job) const;
+  bool wait_turn(std::unique_lock<std::mutex> &lock, Job &job,
+                 const std::atomic<bool> *cancel);
+
+  int slots;
+  int (*const priority_of)(int id);
+  mutable std::mutex mutex;
+  std::condition_variable cv;
+  std::vector<Job *> jobs; // entered and not yet left
+  int running = 0;
+  uint64_t next_seq = 0;
+  uint64_t entered = 0;
+  uint64_t preemptions = 0;
+};
+
+// Runs one job through a scheduler, leaving on destruction so every early
+// return hands the slot on. Without a scheduler every call succeeds.
+class ScheduledJob {
+public:
+  ScheduledJob(JobScheduler *scheduler, JobScheduler::Job *job)
+      : scheduler(scheduler), job(job) {}
+  ~ScheduledJob() { leave(); }
+
+  bool enter(const std::atomic<bool> *cancel) {
+    if (!scheduler)
+      return true;
+    entered = true;
+    return scheduler->enter(*job, cancel);
+  }
+  bool checkpoint(const std::atomic<bool> *cancel) {
+    return !scheduler || scheduler->checkpoint(*job, cancel);
+  }
+  void leave() {
+    if (entered)
+      scheduler->leave(*job);
+    entered = false;
+  }
+
+private:
+  ScheduledJob(const ScheduledJob &) = delete;
+  ScheduledJob &operator=(const ScheduledJob &) = delete;
+
+  JobScheduler *scheduler;
+  JobScheduler::Job *job;
+  bool entered = false;
+};
+
+#endif // JOB_SCHEDULER_H
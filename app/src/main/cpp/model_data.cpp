@@ -0,0 +1,96 @@
+#include "model_data.h"
+
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+ModelData::ModelData(ModelData &&o) noexcept { *this = std::move(o); }
+
+ModelData &ModelData::operator=(ModelData &&o) noexcept {
+  if (this != &o) {
+    reset();
+    std::swap(bytes, o.bytes);
+    std::swap(length, o.length);
+    std::swap(mapped, o.mapped);
+    std::swap(mapping, o.mapping);
+#if __ANDROID__
+    std::swap(asset, o.asset);
+#endif
+  }
+  return *this;
+}
+
+ModelData::~ModelData() { reset(); }
+
+void ModelData::reset() {
+  if (mapping)
+    munmap(mapping, length);
+#if __ANDROID__
+  if (asset)
+    AAsset_close(asset);
+  asset = nullptr;
+#endif
+  mapping = nullptr;
+  bytes = nullptr;
+  length = 0;
+  mapped = false;
+}
+
+int ModelData::map_file(const std::string &path) {
+  reset();
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+    close(fd);
+    return -1;
+  }
+  void *p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd); // the mapping keeps the file
+  if (p == MAP_FAILED)
+    return -1;
+  // load() reads all of it right away
+  madvise(p, (size_t)st.st_size, MADV_WILLNEED);
+  mapping = p;
+  bytes = (const unsigned char *)p;
+  length = (size_t)st.st_size;
+  mapped = true;
+  return 0;
+}
+
+#if __ANDROID__
+int ModelData::open_asset(AAssetManager *mgr, const std::string &path) {
+  reset();
+  AAsset *a = AAssetManager_open(mgr, path.c_str(), AASSET_MODE_BUFFER);
+  if (!a)
+    return -1;
+  const void *buffer = AAsset_getBuffer(a);
+  const off_t size = AAsset_getLength(a);
+  if (!buffer || size <= 0) {
+    AAsset_close(a);
+    return -1;
+  }
+  asset = a;
+  bytes = (const unsigned char *)buffer;
+  length = (size_t)size;
+  mapped = !AAsset_isAllocated(a);
+  return 0;
+}
+#endif
+
+size_t process_rss_bytes() {
+  FILE *fp = fopen("/proc/self/statm", "r");
+  if (!fp)
+    return 0;
+  long pages = 0;
+  long resident = 0;
+  const int n = fscanf(fp, "%ld %ld", &pages, &resident);
+  fclose(fp);
+  if (n != 2 || resident < 0)
+    return 0;
+  return (size_t)resident * (size_t)sysconf(_SC_PAGESIZE);
+}
@@ -0,0 +1,61 @@
+// Read-only bytes of a model file, used where they already are instead of
+// being copied: a mapping of a file, or an asset inside the APK.
+
+#ifndef MODEL_DATA_H
+#define MODEL_DATA_H
+
+#include <cstddef>
+#include <string>
+
+#if __ANDROID__
+#include <android/asset_manager.h>
+#endif
+
+// Move-only. The bytes stay valid and unchanged for the object's lifetime,
+// so ncnn can reference weights in them rather than copy them.
+class ModelData {
+public:
+  ModelData() = default;
+  ModelData(ModelData &&o) noexcept;
+  ModelData &operator=(ModelData &&o) noexcept;
+  ~ModelData();
+
+  // Maps the file at path read-only. Returns 0, or -1 when it cannot be
+  // opened or mapped, or is empty.
+  int map_file(const std::string &path);
+
+#if __ANDROID__
+  // Opens the asset at path in buffer mode. Assets stored uncompressed in
+  // the APK (noCompress in build.gradle.kts) are mapped in place; compressed
+  // ones are inflated into memory once. Returns 0, or -1.
+  int open_asset(AAssetManager *mgr, const std::string &path);
+#endif
+
+  void reset();
+
+  const unsigned char *data() const { return bytes; }
+  size_t size() const { return length; }
+  // Backed by a file mapping rather than a heap buffer
+  bool in_place() const { return mapped; }
+  std::string text() const {
+    return std::string((const char *)bytes, length);
+  }
+
+private:
+  ModelData(const ModelData &) = delete;
+  ModelData &operator=(const ModelData &) = delete;
+
+  const unsigned char *bytes = nullptr;
+  size_t length = 0;
+  bool mapped = false;
+  void *mapping = nullptr; // from mmap(), length bytes
+#if __ANDROID__
+  AAsset *asset = nullptr;
+#endif
+};
+
+// Resident set size of this process in bytes, from /proc/self/statm; 0
+// where that is unavailable.
+size_t process_rss_bytes();
+
+#endif // MODEL_DATA_H
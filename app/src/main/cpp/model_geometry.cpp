@@ -0,0 +1,247 @@
+#include "model_geometry.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <vector>
+
+namespace {
+
+// Geometry of one blob, in input pixels. Blob pixel i has its center at
+// input position origin + i / scale. Global blobs (pooled to 1x1) have no
+// spatial extent.
+struct BlobGeometry {
+  bool global = false;
+  double scale = 1;
+  double origin = 0;
+  double radius = 0;
+};
+
+struct LayerParams {
+  std::map<int, std::string> values;
+
+  int get_int(int id, int def) const {
+    auto it = values.find(id);
+    return it == values.end() ? def : (int)atof(it->second.c_str());
+  }
+  float get_float(int id, float def) const {
+    auto it = values.find(id);
+    return it == values.end() ? def : (float)atof(it->second.c_str());
+  }
+  // Array params are stored as -23300-id=count,v0,v1,...
+  std::vector<int> get_array(int id) const {
+    std::vector<int> out;
+    auto it = values.find(-23300 - id);
+    if (it == values.end())
+      return out;
+    std::stringstream ss(it->second);
+    std::string item;
+    std::getline(ss, item, ','); // count
+    while (std::getline(ss, item, ','))
+      out.push_back(atoi(item.c_str()));
+    return out;
+  }
+};
+
+// Layers that act per pixel (or per channel) and keep the spatial layout
+const std::set<std::string> kPointwiseLayers = {
+    "AbsVal", "BatchNorm", "Bias", "BinaryOp", "BNLL", "Clip", "Concat",
+    "Dropout", "ELU", "Eltwise", "Exp", "GELU", "HardSigmoid", "HardSwish",
+    "LeakyReLU", "Log", "Mish", "Noop", "Power", "PReLU", "ReLU", "Scale",
+    "Sigmoid", "SELU", "Softplus", "Split", "Swish", "TanH", "Threshold",
+    "UnaryOp",
+};
+
+} // namespace
+
+int parse_model_geometry(const std::string &param_text, ModelGeometry &geo) {
+  std::istringstream in(param_text);
+  int magic = 0;
+  int layer_count = 0;
+  int blob_count = 0;
+  if (!(in >> magic >> layer_count >> blob_count) || magic != 7767517)
+    return -1;
+
+  std::map<std::string, BlobGeometry> blobs;
+  std::set<std::string> consumed;
+  std::vector<std::string> produced;
+  bool zero_padded = false;
+  double min_scale = 1;
+
+  std::string line;
+  std::getline(in, line);
+  while (std::getline(in, line)) {
+    std::istringstream ls(line);
+    std::string type, name;
+    int bottom_count = 0;
+    int top_count = 0;
+    if (!(ls >> type >> name >> bottom_count >> top_count))
+      continue;
+
+    std::vector<std::string> bottoms(bottom_count);
+    std::vector<std::string> tops(top_count);
+    for (std::string &b : bottoms)
+      ls >> b;
+    for (std::string &t : tops)
+      ls >> t;
+
+    LayerParams p;
+    std::string kv;
+    while (ls >> kv) {
+      size_t eq = kv.find('=');
+      if (eq != std::string::npos)
+        p.values[atoi(kv.substr(0, eq).c_str())] = kv.substr(eq + 1);
+    }
+
+    // Spatial inputs decide the output geometry; multi-input layers join
+    // branches that the network has already aligned.
+    const BlobGeometry *first = nullptr;
+    double radius = 0;
+    for (const std::string &b : bottoms) {
+      consumed.insert(b);
+      auto it = blobs.find(b);
+      if (it == blobs.end())
+        return -1;
+      if (it->second.global)
+        continue;
+      if (!first)
+        first = &it->second;
+      radius = std::max(radius, it->second.radius);
+    }
+
+    BlobGeometry g;
+    if (type == "Input") {
+      // Defaults: the input blob is the tile itself
+    } else if (!first) {
+      g.global = true;
+    } else {
+      g = *first;
+      g.radius = radius;
+      const double s = g.scale;
+
+      if (type == "Convolution" || type == "ConvolutionDepthWise" ||
+          (type == "Pooling" && !p.get_int(4, 0))) {
+        const bool pool = type == "Pooling";
+        const int kernel = p.get_int(1, 0);
+        const int dilation = pool ? 1 : p.get_int(2, 1);
+        const int stride = p.get_int(pool ? 2 : 3, 1);
+        const int pad = p.get_int(pool ? 3 : 4, 0);
+        const double extent = (kernel - 1) * dilation / 2.0;
+        // -233/-234: SAME padding, computed at runtime
+        const double pad_left = pad < 0 ? extent : pad;
+        if (pad_left > 0)
+          zero_padded = true;
+        g.origin += (extent - pad_left) / s;
+        g.radius += extent / s;
+        g.scale = s / stride;
+      } else if (type == "Pooling") {
+        g = BlobGeometry();
+        g.global = true;
+      } else if (type == "InnerProduct" || type == "Flatten" ||
+                 type == "Reduction") {
+        g = BlobGeometry();
+        g.global = true;
+      } else if (type == "Deconvolution" || type == "DeconvolutionDepthWise") {
+        const int kernel = p.get_int(1, 0);
+        const int dilation = p.get_int(2, 1);
+        const int stride = p.get_int(3, 1);
+        const int pad = p.get_int(4, 0); // trims the output, not padding
+        const double extent = (kernel - 1) * dilation / 2.0;
+        g.origin += (pad - extent) / stride / s;
+        g.radius += extent / stride / s;
+        g.scale = s * stride;
+      } else if (type == "Crop") {
+        int woffset = p.get_int(0, 0);
+        std::vector<int> starts = p.get_array(9);
+        if (!starts.empty()) {
+          // Axes are counted over (c, h, w); -1 is the width axis
+          std::vector<int> axes = p.get_array(11);
+          woffset = 0;
+          for (size_t i = 0; i < starts.size(); i++) {
+            int axis = axes.empty() ? (int)i - (int)starts.size()
+                                    : (i < axes.size() ? axes[i] : 0);
+            if (axis == -1 || axis == 2)
+              woffset = starts[i];
+          }
+        }
+        g.origin += woffset / s;
+      } else if (type == "Padding") {
+        const int left = p.get_int(2, 0);
+        if (left > 0)
+          zero_padded = true;
+        g.origin -= left / s;
+      } else if (type == "Interp") {
+        if (p.get_int(4, 0) > 0 || p.get_int(6, 0))
+          return -1; // fixed output size or align_corners
+        const double factor = p.get_float(2, 1.f);
+        const int resize_type = p.get_int(0, 1);
+        // Taps on each side: nearest, bilinear, bicubic
+        const double taps =
+            resize_type == 1 ? 0.5 : (resize_type == 2 ? 1.0 : 2.0);
+        zero_padded = true; // clamps at the tile edge
+        g.origin += (0.5 / factor - 0.5) / s;
+        g.radius += taps / s;
+        g.scale = s * factor;
+      } else if (type == "PixelShuffle") {
+        const int factor = p.get_int(0, 1);
+        g.origin += (0.5 / factor - 0.5) / s;
+        g.scale = s * factor;
+      } else if (!kPointwiseLayers.count(type)) {
+        return -1;
+      }
+    }
+
+    if (!g.global)
+      min_scale = std::min(min_scale, g.scale);
+    for (const std::string &t : tops) {
+      blobs[t] = g;
+      produced.push_back(t);
+    }
+  }
+
+  // The engine extracts the last output blob: the last one nobody consumes
+  std::string output;
+  for (auto it = produced.rbegin(); it != produced.rend() && output.empty();
+       ++it) {
+    if (!consumed.count(*it))
+      output = *it;
+  }
+  if (output.empty())
+    return -1;
+  const BlobGeometry &out = blobs[output];
+  if (out.global || out.scale < 1)
+    return -1;
+
+  const int scale = (int)std::lround(out.scale);
+  if (std::fabs(out.scale - scale) > 1e-6)
+    return -1;
+
+  // Output pixel 0 of an exact scale-x upscale of input pixel k is centered
+  // at k + 0.5 / scale - 0.5
+  const double offset = out.origin - (0.5 / scale - 0.5);
+  const int offset_px = (int)std::lround(offset);
+  if (offset_px < 0 || std::fabs(offset - offset_px) > 1e-3)
+    return -1;
+
+  geo.scale = scale;
+  geo.offset = offset_px;
+  geo.receptive_radius = out.radius;
+  geo.zero_padded = zero_padded;
+  geo.alignment = std::max(1, (int)std::lround(1.0 / min_scale));
+  geo.halo = offset_px;
+  if (zero_padded)
+    geo.halo = std::max(offset_px, (int)std::ceil(out.radius - 1e-3));
+  return 0;
+}
+
+int load_model_geometry(const std::string &parampath, ModelGeometry &geo) {
+  std::ifstream file(parampath);
+  if (!file)
+    return -1;
+  std::stringstream text;
+  text << file.rdbuf();
+  return parse_model_geometry(text.str(), geo);
+}
@@ -0,0 +1,35 @@
+// Tile geometry of an upscaling network, derived from its ncnn .param graph.
+
+#ifndef MODEL_GEOMETRY_H
+#define MODEL_GEOMETRY_H
+
+#include <string>
+
+struct ModelGeometry {
+  int scale = 0;  // output pixels per input pixel
+  int offset = 0; // input pixels cropped from each side by the network itself
+  int halo = 0;   // minimum prepadding for seam-free tiles (>= offset)
+  double receptive_radius = 0; // input pixels an output pixel depends on
+  bool zero_padded = false;    // some layer pads its input at the tile edge
+  int alignment = 1; // input tile sizes should be a multiple of this (the
+                     // net's total downsampling)
+};
+
+// Walks the layers of a text .param (conv/deconv kernels, strides and pads,
+// pooling, crops, interp and pixel shuffle) and tracks, for every blob, its
+// scale relative to the input, the input position of its first pixel and
+// its receptive radius. The coarsest blob gives the alignment. Global
+// pooling branches (squeeze-excitation) are tile-wide statistics and do not
+// add to the halo. Only the horizontal axis is analyzed; all bundled models
+// are square.
+//
+// Networks without zero padding only ever read inside their input, so their
+// halo is exactly the crop they apply. Padded networks need their full
+// receptive radius so edge pixels of a tile see the same context as in the
+// untiled image. Returns -1 when the text cannot be parsed or contains a
+// layer that moves pixels in a way this analysis does not model.
+int parse_model_geometry(const std::string &param_text, ModelGeometry &geo);
+
+int load_model_geometry(const std::string &parampath, ModelGeometry &geo);
+
+#endif // MODEL_GEOMETRY_H
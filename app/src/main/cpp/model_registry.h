@@ -0,0 +1,125 @@
+// Loaded engines kept resident across model switches, so going back to a
+// model or noise level skips reloading its weights and pipelines.
+
+#ifndef MODEL_REGISTRY_H
+#define MODEL_REGISTRY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// Identifies a loaded engine.
+struct ModelKey {
+  std::string model; // weights file
+  int noise = 0;
+  int scale = 0;
+
+  bool operator==(const ModelKey &o) const {
+    return model == o.model && noise == o.noise && scale == o.scale;
+  }
+};
+
+struct ModelRegistryStats {
+  size_t entries = 0;
+  size_t bytes = 0;
+  size_t max_bytes = 0;
+  uint64_t hits = 0;   // switches served by a resident engine
+  uint64_t misses = 0; // switches that had to load
+  uint64_t evictions = 0;
+};
+
+// Thread-safe LRU of shared engines within a memory budget. Engine provides
+// size_t resident_bytes() const, which is measured on every insert since
+// an engine's pools grow while it processes. The most recently used engine
+// is never evicted, so the active model stays even over budget. An evicted
+// engine lives on until the calls still using it return.
+template <typename Engine> class ModelRegistry {
+public:
+  explicit ModelRegistry(size_t max_bytes) : max_bytes(max_bytes) {}
+
+  // The engine for key, which becomes the most recently used, or null.
+  std::shared_ptr<Engine> find(const ModelKey &key) {
+    std::lock_guard<std::mutex> guard(mutex);
+    for (auto it = lru.begin(); it != lru.end(); ++it) {
+      if (it->key == key) {
+        lru.splice(lru.begin(), lru, it);
+        hits++;
+        return it->engine;
+      }
+    }
+    misses++;
+    return nullptr;
+  }
+
+  // Adds a loaded engine as the most recently used, replacing any other for
+  // key, and evicts least recently used ones to stay within max_bytes.
+  void insert(const ModelKey &key, std::shared_ptr<Engine> engine) {
+    std::lock_guard<std::mutex> guard(mutex);
+    for (auto it = lru.begin(); it != lru.end(); ++it) {
+      if (it->key == key) {
+        lru.erase(it);
+        break;
+      }
+    }
+    lru.push_front(Entry{key, std::move(engine)});
+    evict_to(max_bytes);
+  }
+
+  void set_max_bytes(size_t limit) {
+    std::lock_guard<std::mutex> guard(mutex);
+    max_bytes = limit;
+    evict_to(max_bytes);
+  }
+
+  void clear() {
+    std::lock_guard<std::mutex> guard(mutex);
+    lru.clear();
+  }
+
+  ModelRegistryStats stats() const {
+    std::lock_guard<std::mutex> guard(mutex);
+    ModelRegistryStats s;
+    s.entries = lru.size();
+    s.bytes = resident_bytes();
+    s.max_bytes = max_bytes;
+    s.hits = hits;
+    s.misses = misses;
+    s.evictions = evictions;
+    return s;
+  }
+
+private:
+  struct Entry {
+    ModelKey key;
+    std::shared_ptr<Engine> engine;
+  };
+
+  size_t resident_bytes() const {
+    size_t bytes = 0;
+    for (const Entry &e : lru)
+      bytes += e.engine->resident_bytes();
+    return bytes;
+  }
+
+  void evict_to(size_t limit) {
+    size_t bytes = resident_bytes();
+    while (bytes > limit && lru.size() > 1) {
+      bytes -= lru.back().engine->resident_bytes();
+      lru.pop_back();
+      evictions++;
+    }
+  }
+
+  // A handful of models at most, so a list is the whole index
+  mutable std::mutex mutex;
+  std::list<Entry> lru; // front is most recently used
+  size_t max_bytes;
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  uint64_t evictions = 0;
+};
+
+#endif // MODEL_REGISTRY_H
@@ -0,0 +1,37 @@
+// Portable logging shim: logcat on Android, stderr on host builds.
+
+#ifndef NATIVE_LOG_H
+#define NATIVE_LOG_H
+
+#ifdef __ANDROID__
+#include <android/log.h>
+
+#define NATIVE_LOGD(tag, ...)                                                  \
+  __android_log_print(ANDROID_LOG_DEBUG, tag, __VA_ARGS__)
+#define NATIVE_LOGE(tag, ...)                                                  \
+  __android_log_print(ANDROID_LOG_ERROR, tag, __VA_ARGS__)
+#else
+#include <cstdio>
+
+#define NATIVE_LOG_PRINT(level, tag, ...)                                      \
+  do {                                                                         \
+    fprintf(stderr, "%s/%s: ", level, tag);                                    \
+    fprintf(stderr, __VA_ARGS__);                                              \
+    fputc('\n', stderr);                                                       \
+  } while (0)
+
+// Debug logs are noisy in benchmarks; host builds only emit them when
+// configured with -DUPSCALE_VERBOSE_LOG=ON.
+#ifdef UPSCALE_VERBOSE_LOG
+#define NATIVE_LOGD(tag, ...) NATIVE_LOG_PRINT("D", tag, __VA_ARGS__)
+#else
+#define NATIVE_LOGD(tag, ...)                                                  \
+  do {                                                                         \
+    if (0)                                                                     \
+      NATIVE_LOG_PRINT("D", tag, __VA_ARGS__);                                 \
+  } while (0)
+#endif
+#define NATIVE_LOGE(tag, ...) NATIVE_LOG_PRINT("E", tag, __VA_ARGS__)
+#endif
+
+#endif // NATIVE_LOG_H
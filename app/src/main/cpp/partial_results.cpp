@@ -0,0 +1,78 @@
+#include "partial_results.h"
+
+#include <algorithm>
+
+int PartialResult::done_tiles() const {
+  return (int)std::count(done.begin(), done.end(), (unsigned char)1);
+}
+
+PartialResults::PartialResults(size_t _max_bytes) : max_bytes(_max_bytes) {}
+
+std::list<PartialResults::Entry>::iterator
+PartialResults::find(const PartialResultKey &key) {
+  return std::find_if(lru.begin(), lru.end(),
+                      [&key](const Entry &e) { return e.key == key; });
+}
+
+bool PartialResults::take(const PartialResultKey &key, PartialResult &out) {
+  std::lock_guard<std::mutex> guard(mutex);
+  auto it = find(key);
+  if (it == lru.end())
+    return false;
+  bytes -= it->result.bytes();
+  out = std::move(it->result);
+  lru.erase(it);
+  resumed++;
+  return true;
+}
+
+void PartialResults::store(const PartialResultKey &key,
+                           PartialResult &&result) {
+  if (result.done_tiles() == 0)
+    return;
+  const size_t entry_bytes = result.bytes();
+
+  std::lock_guard<std::mutex> guard(mutex);
+  auto it = find(key);
+  if (it != lru.end()) {
+    bytes -= it->result.bytes();
+    lru.erase(it);
+  }
+  if (entry_bytes > max_bytes)
+    return;
+  evict_to(max_bytes - entry_bytes);
+  lru.push_front(Entry{key, std::move(result)});
+  bytes += entry_bytes;
+  stored++;
+}
+
+void PartialResults::set_max_bytes(size_t _max_bytes) {
+  std::lock_guard<std::mutex> guard(mutex);
+  max_bytes = _max_bytes;
+  evict_to(max_bytes);
+}
+
+void PartialResults::clear() {
+  std::lock_guard<std::mutex> guard(mutex);
+  evict_to(0);
+  stored = 0;
+  resumed = 0;
+}
+
+PartialResultsStats PartialResults::stats() const {
+  std::lock_guard<std::mutex> guard(mutex);
+  PartialResultsStats s;
+  s.entries = lru.size();
+  s.bytes = bytes;
+  s.max_bytes = max_bytes;
+  s.stored = stored;
+  s.resumed = resumed;
+  return s;
+}
+
+void PartialResults::evict_to(size_t limit) {
+  while (bytes > limit && !lru.empty()) {
+    bytes -= lru.back().result.bytes();
+    lru.pop_back();
+  }
+}
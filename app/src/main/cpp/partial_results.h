@@ -0,0 +1,91 @@
+// Bounded store of the output of upscale calls that stopped part way, so the
+// same page resumes from its missing tiles instead of starting over.
+
+#ifndef PARTIAL_RESULTS_H
+#define PARTIAL_RESULTS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <vector>
+
+// Identifies a page and every setting that changes its tile grid or output.
+struct PartialResultKey {
+  uint64_t content[2] = {0, 0}; // hash of the input pixels
+  uint64_t model = 0;           // Waifu2x model identity
+  int w = 0;                    // input size
+  int h = 0;
+  int scale = 0;
+  int tile_input_size = 0;
+  int prepadding = 0;
+  int blend_overlap = 0;
+  int flat_tile_tolerance = 0;
+  bool grayscale_check = false;
+
+  bool operator==(const PartialResultKey &o) const {
+    return content[0] == o.content[0] && content[1] == o.content[1] &&
+           model == o.model && w == o.w && h == o.h && scale == o.scale &&
+           tile_input_size == o.tile_input_size &&
+           prepadding == o.prepadding && blend_overlap == o.blend_overlap &&
+           flat_tile_tolerance == o.flat_tile_tolerance &&
+           grayscale_check == o.grayscale_check;
+  }
+};
+
+// Output of a stopped call: which tiles (in raster order) were fully written,
+// and the output pixels of just those tiles, one after another in raster
+// order, each with packed rows. Tiles still missing cost nothing.
+struct PartialResult {
+  std::vector<unsigned char> done; // one flag per tile
+  std::vector<unsigned char> pixels;
+
+  size_t bytes() const { return done.size() + pixels.size(); }
+  int done_tiles() const;
+};
+
+struct PartialResultsStats {
+  size_t entries = 0;
+  size_t bytes = 0;
+  size_t max_bytes = 0;
+  uint64_t stored = 0;  // results kept by stopped calls
+  uint64_t resumed = 0; // results taken back by a later call
+};
+
+// Thread-safe LRU. A call takes its page's result out of the store while it
+// runs, so two calls never resume from the same copy.
+class PartialResults {
+public:
+  explicit PartialResults(size_t max_bytes);
+
+  // Moves the result stored for key into out and removes it.
+  bool take(const PartialResultKey &key, PartialResult &out);
+
+  // Keeps result, replacing any older one for key and evicting least
+  // recently stored entries to stay within max_bytes. Results without a
+  // finished tile, or larger than the whole budget, are dropped.
+  void store(const PartialResultKey &key, PartialResult &&result);
+
+  void set_max_bytes(size_t max_bytes);
+  void clear();
+  PartialResultsStats stats() const;
+
+private:
+  struct Entry {
+    PartialResultKey key;
+    PartialResult result;
+  };
+
+  void evict_to(size_t limit);
+  std::list<Entry>::iterator find(const PartialResultKey &key);
+
+  // A handful of pages at most, so a list is the whole index
+  mutable std::mutex mutex;
+  std::list<Entry> lru; // front is most recently stored
+  size_t max_bytes;
+  size_t bytes = 0;
+  uint64_t stored = 0;
+  uint64_t resumed = 0;
+};
+
+#endif // PARTIAL_RESULTS_H
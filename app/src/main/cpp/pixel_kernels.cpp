@@ -0,0 +1,380 @@
+#include "pixel_kernels.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// This file is built with -ffp-contract=off: the scalar reference and the
+// SIMD paths must perform the same separately rounded multiply and add.
+
+unsigned char gather_rgba_tile_bgr(const unsigned char *pixels, int w, int h,
+                                   int stride, int x0, int y0,
+                                   ncnn::Mat &tile) {
+  const int tw = tile.w;
+  const int th = tile.h;
+  const float norm = 1.0f / 255.0f;
+  unsigned char min_alpha = 255;
+
+  // Columns [0, left) replicate image column 0, columns [right, tw) replicate
+  // column w - 1, everything in between maps 1:1.
+  const int left = std::min(std::max(-x0, 0), tw);
+  const int right = std::max(left, std::min(w - x0, tw));
+
+  for (int i = 0; i < th; i++) {
+    const int sy = std::min(std::max(y0 + i, 0), h - 1);
+    const unsigned char *row = pixels + (size_t)sy * stride;
+
+    float *out_b = tile.channel(0).row(i);
+    float *out_g = tile.channel(1).row(i);
+    float *out_r = tile.channel(2).row(i);
+
+    const unsigned char *first = row;
+    if (left > 0)
+      min_alpha = std::min(min_alpha, first[3]);
+    for (int j = 0; j < left; j++) {
+      out_b[j] = first[2] * norm;
+      out_g[j] = first[1] * norm;
+      out_r[j] = first[0] * norm;
+    }
+
+    const unsigned char *src = row + (size_t)(x0 + left) * 4;
+    for (int j = left; j < right; j++) {
+      out_b[j] = src[2] * norm;
+      out_g[j] = src[1] * norm;
+      out_r[j] = src[0] * norm;
+      min_alpha = std::min(min_alpha, src[3]);
+      src += 4;
+    }
+
+    const unsigned char *last = row + (size_t)(w - 1) * 4;
+    if (right < tw)
+      min_alpha = std::min(min_alpha, last[3]);
+    for (int j = right; j < tw; j++) {
+      out_b[j] = last[2] * norm;
+      out_g[j] = last[1] * norm;
+      out_r[j] = last[0] * norm;
+    }
+  }
+  return min_alpha;
+}
+
+bool rgba_window_is_opaque(const unsigned char *pixels, int stride, int x0,
+                           int y0, int win_w, int win_h) {
+  for (int y = y0; y < y0 + win_h; y++) {
+    const unsigned char *p = pixels + (size_t)y * stride + (size_t)x0 * 4 + 3;
+    for (int x = 0; x < win_w; x++) {
+      if (p[x * 4] != 255)
+        return false;
+    }
+  }
+  return true;
+}
+
+bool rgba_is_grayscale(const unsigned char *pixels, int w, int h, int stride,
+                       int max_color_pixels) {
+  int color_pixel_count = 0;
+  for (int y = 0; y < h; y++) {
+    const unsigned char *p = pixels + (size_t)y * stride;
+    for (int x = 0; x < w; x++, p += 4) {
+      if (std::abs(p[0] - p[1]) > 5 || std::abs(p[0] - p[2]) > 5) {
+        if (++color_pixel_count > max_color_pixels)
+          return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool rgba_window_is_flat(const unsigned char *pixels, int w, int h,
+                         int stride, int x0, int y0, int win_w, int win_h,
+                         int tolerance, unsigned char rgb[3]) {
+  // Replicated border pixels copy the edge, so only the part of the window
+  // inside the image needs scanning.
+  const int xa = std::max(x0, 0);
+  const int xb = std::min(x0 + win_w, w);
+  const int ya = std::max(y0, 0);
+  const int yb = std::min(y0 + win_h, h);
+  if (xa >= xb || ya >= yb)
+    return false;
+
+  const unsigned char *first = pixels + (size_t)ya * stride + xa * 4;
+  int lo[3] = {first[0], first[1], first[2]};
+  int hi[3] = {first[0], first[1], first[2]};
+  for (int y = ya; y < yb; y++) {
+    const unsigned char *p = pixels + (size_t)y * stride + xa * 4;
+    for (int x = xa; x < xb; x++, p += 4) {
+      for (int c = 0; c < 3; c++) {
+        lo[c] = std::min(lo[c], (int)p[c]);
+        hi[c] = std::max(hi[c], (int)p[c]);
+      }
+    }
+    // Per row is often enough to bail out on the first line of ink
+    for (int c = 0; c < 3; c++) {
+      if (hi[c] - lo[c] > tolerance)
+        return false;
+    }
+  }
+
+  for (int c = 0; c < 3; c++)
+    rgb[c] = (unsigned char)((lo[c] + hi[c] + 1) / 2);
+  return true;
+}
+
+// Gray weight shared by every path so they agree bit for bit
+static const float kThird = 0.333333f;
+
+static inline unsigned char unit_to_u8(float v) {
+  v = v * 255.0f;
+  v = v + 0.5f;
+  v = std::max(v, 0.0f);
+  v = std::min(v, 255.0f);
+  return (unsigned char)(int)v;
+}
+
+void unit_to_u8_row(const float *src, unsigned char *dst, int n) {
+  for (int j = 0; j < n; j++)
+    dst[j] = unit_to_u8(src[j]);
+}
+
+void planar_bgr_to_rgba_row_scalar(const float *b, const float *g,
+                                   const float *r, const unsigned char *a,
+                                   unsigned char *dst, int n, bool grayscale) {
+  for (int j = 0; j < n; j++) {
+    float vr = r[j];
+    float vg = g[j];
+    float vb = b[j];
+    if (grayscale) {
+      float sum = vr + vg;
+      sum = sum + vb;
+      vr = vg = vb = sum * kThird;
+    }
+    dst[j * 4 + 0] = unit_to_u8(vr);
+    dst[j * 4 + 1] = unit_to_u8(vg);
+    dst[j * 4 + 2] = unit_to_u8(vb);
+    dst[j * 4 + 3] = a ? a[j] : 255;
+  }
+}
+
+void fill_rgba_row(const unsigned char rgb[3], const unsigned char *a,
+                   unsigned char *dst, int n) {
+  for (int j = 0; j < n; j++) {
+    dst[j * 4 + 0] = rgb[0];
+    dst[j * 4 + 1] = rgb[1];
+    dst[j * 4 + 2] = rgb[2];
+    dst[j * 4 + 3] = a ? a[j] : 255;
+  }
+}
+
+// Source position of output pixel i in 1/256 pixels: (i + 0.5) / scale - 0.5,
+// split into the left/top neighbour and the weight of the next one
+static inline void bilinear_tap(int i, int scale, int n, int &i0,
+                                int &weight) {
+  const int p = (2 * i + 1) * 128 / scale - 128;
+  i0 = p < 0 ? 0 : p >> 8;
+  weight = p < 0 ? 0 : p & 255;
+  if (i0 >= n - 1) {
+    i0 = n - 1;
+    weight = 0;
+  }
+}
+
+void upscale_rgba_bilinear_rows(const unsigned char *pixels, int w, int h,
+                                int stride, int scale, unsigned char *out,
+                                int out_stride, int y0, int y1) {
+  const int out_w = w * scale;
+  std::vector<int> xs(out_w * 2); // left byte offset and weight per column
+  for (int x = 0; x < out_w; x++) {
+    int x0, wx;
+    bilinear_tap(x, scale, w, x0, wx);
+    xs[x * 2] = x0 * 4;
+    xs[x * 2 + 1] = wx;
+  }
+  for (int y = y0; y < y1; y++) {
+    int sy, wy;
+    bilinear_tap(y, scale, h, sy, wy);
+    const unsigned char *top = pixels + (size_t)sy * stride;
+    const unsigned char *bottom =
+        pixels + (size_t)std::min(sy + 1, h - 1) * stride;
+    unsigned char *dst = out + (size_t)y * out_stride;
+    for (int x = 0; x < out_w; x++) {
+      const int i0 = xs[x * 2];
+      const int wx = xs[x * 2 + 1];
+      const int i1 = wx ? i0 + 4 : i0;
+      for (int c = 0; c < 4; c++) {
+        const int t = top[i0 + c] * (256 - wx) + top[i1 + c] * wx;
+        const int b = bottom[i0 + c] * (256 - wx) + bottom[i1 + c] * wx;
+        dst[x * 4 + c] =
+            (unsigned char)((t * (256 - wy) + b * wy + 32768) >> 16);
+      }
+    }
+  }
+}
+
+#if defined(__ARM_NEON)
+static inline uint32x4_t unit_to_u32_neon(float32x4_t v) {
+  v = vmulq_f32(v, vdupq_n_f32(255.0f));
+  v = vaddq_f32(v, vdupq_n_f32(0.5f));
+  v = vmaxq_f32(v, vdupq_n_f32(0.0f));
+  v = vminq_f32(v, vdupq_n_f32(255.0f));
+  return vcvtq_u32_f32(v); // truncates, like the scalar cast
+}
+
+static inline uint8x8_t unit_to_u8x8_neon(const float *p) {
+  uint16x4_t lo = vmovn_u32(unit_to_u32_neon(vld1q_f32(p)));
+  uint16x4_t hi = vmovn_u32(unit_to_u32_neon(vld1q_f32(p + 4)));
+  return vmovn_u16(vcombine_u16(lo, hi));
+}
+
+static inline uint8x8_t gray_to_u8x8_neon(const float *b, const float *g,
+                                          const float *r) {
+  const float32x4_t third = vdupq_n_f32(kThird);
+  uint16x4_t half[2];
+  for (int k = 0; k < 2; k++) {
+    float32x4_t sum = vaddq_f32(vld1q_f32(r + 4 * k), vld1q_f32(g + 4 * k));
+    sum = vaddq_f32(sum, vld1q_f32(b + 4 * k));
+    half[k] = vmovn_u32(unit_to_u32_neon(vmulq_f32(sum, third)));
+  }
+  return vmovn_u16(vcombine_u16(half[0], half[1]));
+}
+
+void planar_bgr_to_rgba_row(const float *b, const float *g, const float *r,
+                            const unsigned char *a, unsigned char *dst, int n,
+                            bool grayscale) {
+  int j = 0;
+  for (; j + 8 <= n; j += 8) {
+    uint8x8x4_t px;
+    if (grayscale) {
+      px.val[0] = gray_to_u8x8_neon(b + j, g + j, r + j);
+      px.val[1] = px.val[0];
+      px.val[2] = px.val[0];
+    } else {
+      px.val[0] = unit_to_u8x8_neon(r + j);
+      px.val[1] = unit_to_u8x8_neon(g + j);
+      px.val[2] = unit_to_u8x8_neon(b + j);
+    }
+    px.val[3] = a ? vld1_u8(a + j) : vdup_n_u8(255);
+    vst4_u8(dst + j * 4, px); // interleaves into RGBA
+  }
+  planar_bgr_to_rgba_row_scalar(b + j, g + j, r + j, a ? a + j : nullptr,
+                                dst + j * 4, n - j, grayscale);
+}
+#elif defined(__SSE2__)
+// Channel values end up in the low byte of each 32-bit lane, so packing is
+// r | g << 8 | b << 16 | a << 24 per pixel, already in RGBA memory order.
+static inline __m128i unit_to_i32_sse(__m128 v) {
+  v = _mm_mul_ps(v, _mm_set1_ps(255.0f));
+  v = _mm_add_ps(v, _mm_set1_ps(0.5f));
+  v = _mm_max_ps(v, _mm_setzero_ps());
+  v = _mm_min_ps(v, _mm_set1_ps(255.0f));
+  return _mm_cvttps_epi32(v);
+}
+
+static void planar_bgr_to_rgba_row_sse2(const float *b, const float *g,
+                                        const float *r, const unsigned char *a,
+                                        unsigned char *dst, int n,
+                                        bool grayscale) {
+  const __m128i opaque = _mm_set1_epi32((int)0xff000000u);
+  int j = 0;
+  for (; j + 4 <= n; j += 4) {
+    __m128i vr, vg, vb;
+    if (grayscale) {
+      __m128 sum = _mm_add_ps(_mm_loadu_ps(r + j), _mm_loadu_ps(g + j));
+      sum = _mm_add_ps(sum, _mm_loadu_ps(b + j));
+      vr = vg = vb = unit_to_i32_sse(_mm_mul_ps(sum, _mm_set1_ps(kThird)));
+    } else {
+      vr = unit_to_i32_sse(_mm_loadu_ps(r + j));
+      vg = unit_to_i32_sse(_mm_loadu_ps(g + j));
+      vb = unit_to_i32_sse(_mm_loadu_ps(b + j));
+    }
+    __m128i px = _mm_or_si128(vr, _mm_slli_epi32(vg, 8));
+    px = _mm_or_si128(px, _mm_slli_epi32(vb, 16));
+    if (a) {
+      int a4;
+      memcpy(&a4, a + j, 4);
+      // Bytes 0-3 to the top byte of lanes 0-3
+      const __m128i zero = _mm_setzero_si128();
+      __m128i va = _mm_unpacklo_epi8(zero, _mm_cvtsi32_si128(a4));
+      va = _mm_unpacklo_epi16(zero, va);
+      px = _mm_or_si128(px, va);
+    } else {
+      px = _mm_or_si128(px, opaque);
+    }
+    _mm_storeu_si128((__m128i *)(dst + j * 4), px);
+  }
+  planar_bgr_to_rgba_row_scalar(b + j, g + j, r + j, a ? a + j : nullptr,
+                                dst + j * 4, n - j, grayscale);
+}
+
+// Runtime-dispatched AVX2 on desktop x86-64 (the host build). Android x86
+// ABIs are emulator-only and keep the SSE2 path.
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(__ANDROID__)
+#define PIXEL_KERNELS_AVX2 1
+
+__attribute__((target("avx2"))) static inline __m256i
+unit_to_i32_avx2(__m256 v) {
+  v = _mm256_mul_ps(v, _mm256_set1_ps(255.0f));
+  v = _mm256_add_ps(v, _mm256_set1_ps(0.5f));
+  v = _mm256_max_ps(v, _mm256_setzero_ps());
+  v = _mm256_min_ps(v, _mm256_set1_ps(255.0f));
+  return _mm256_cvttps_epi32(v);
+}
+
+__attribute__((target("avx2"))) static void
+planar_bgr_to_rgba_row_avx2(const float *b, const float *g, const float *r,
+                            const unsigned char *a, unsigned char *dst, int n,
+                            bool grayscale) {
+  const __m256i opaque = _mm256_set1_epi32((int)0xff000000u);
+  int j = 0;
+  for (; j + 8 <= n; j += 8) {
+    __m256i vr, vg, vb;
+    if (grayscale) {
+      __m256 sum = _mm256_add_ps(_mm256_loadu_ps(r + j), _mm256_loadu_ps(g + j));
+      sum = _mm256_add_ps(sum, _mm256_loadu_ps(b + j));
+      vr = vg = vb =
+          unit_to_i32_avx2(_mm256_mul_ps(sum, _mm256_set1_ps(kThird)));
+    } else {
+      vr = unit_to_i32_avx2(_mm256_loadu_ps(r + j));
+      vg = unit_to_i32_avx2(_mm256_loadu_ps(g + j));
+      vb = unit_to_i32_avx2(_mm256_loadu_ps(b + j));
+    }
+    __m256i px = _mm256_or_si256(vr, _mm256_slli_epi32(vg, 8));
+    px = _mm256_or_si256(px, _mm256_slli_epi32(vb, 16));
+    if (a) {
+      __m256i va =
+          _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(a + j)));
+      px = _mm256_or_si256(px, _mm256_slli_epi32(va, 24));
+    } else {
+      px = _mm256_or_si256(px, opaque);
+    }
+    _mm256_storeu_si256((__m256i *)(dst + j * 4), px);
+  }
+  planar_bgr_to_rgba_row_sse2(b + j, g + j, r + j, a ? a + j : nullptr,
+                              dst + j * 4, n - j, grayscale);
+}
+#endif
+
+void planar_bgr_to_rgba_row(const float *b, const float *g, const float *r,
+                            const unsigned char *a, unsigned char *dst, int n,
+                            bool grayscale) {
+#if PIXEL_KERNELS_AVX2
+  static const bool has_avx2 = __builtin_cpu_supports("avx2");
+  if (has_avx2) {
+    planar_bgr_to_rgba_row_avx2(b, g, r, a, dst, n, grayscale);
+    return;
+  }
+#endif
+  planar_bgr_to_rgba_row_sse2(b, g, r, a, dst, n, grayscale);
+}
+#else
+void planar_bgr_to_rgba_row(const float *b, const float *g, const float *r,
+                            const unsigned char *a, unsigned char *dst, int n,
+                            bool grayscale) {
+  planar_bgr_to_rgba_row_scalar(b, g, r, a, dst, n, grayscale);
+}
+#endif
@@ -0,0 +1,66 @@
+// Pixel conversion kernels between Android RGBA8 bitmaps and ncnn tiles.
+
+#ifndef PIXEL_KERNELS_H
+#define PIXEL_KERNELS_H
+
+// ncnn
+#include "mat.h"
+
+// Gathers the tile.w x tile.h window whose top-left corner is (x0, y0) from a
+// packed RGBA8 image into a planar BGR float tile normalized to 0-1. The
+// window may extend past the image; out-of-range pixels replicate the nearest
+// edge (same as copy_make_border with BORDER_REPLICATE). tile must already be
+// allocated with 3 channels. Returns the smallest alpha value in the window,
+// so opaque tiles are detected without a second pass.
+unsigned char gather_rgba_tile_bgr(const unsigned char *pixels, int w, int h,
+                                   int stride, int x0, int y0,
+                                   ncnn::Mat &tile);
+
+// Returns true when every pixel of the win_w x win_h window at (x0, y0) has
+// alpha 255. The window must lie inside the image.
+bool rgba_window_is_opaque(const unsigned char *pixels, int stride, int x0,
+                           int y0, int win_w, int win_h);
+
+// Returns true when at most max_color_pixels pixels have an R-G or R-B
+// difference above 5, i.e. the page is effectively grayscale.
+bool rgba_is_grayscale(const unsigned char *pixels, int w, int h, int stride,
+                       int max_color_pixels);
+
+// Returns true when no R, G or B value in the win_w x win_h window at
+// (x0, y0) spreads by more than tolerance, treating out-of-range pixels as
+// replicated edges like gather_rgba_tile_bgr. On success rgb receives the
+// midpoint color of the window.
+bool rgba_window_is_flat(const unsigned char *pixels, int w, int h,
+                         int stride, int x0, int y0, int win_w, int win_h,
+                         int tolerance, unsigned char rgb[3]);
+
+// Converts n floats (0-1) to 0-255, rounding to nearest and clamping.
+void unit_to_u8_row(const float *src, unsigned char *dst, int n);
+
+// Converts n pixels of planar B, G, R floats (0-1) into packed RGBA8 at dst,
+// rounding to nearest and clamping to 0-255. a is an optional 8-bit alpha
+// row; when null, alpha is written as 255. grayscale replaces R, G and B with
+// their mean. Uses NEON on ARM and SSE2/AVX2 on x86, bit-exact with
+// planar_bgr_to_rgba_row_scalar.
+void planar_bgr_to_rgba_row(const float *b, const float *g, const float *r,
+                            const unsigned char *a, unsigned char *dst, int n,
+                            bool grayscale);
+
+// Portable reference for planar_bgr_to_rgba_row.
+void planar_bgr_to_rgba_row_scalar(const float *b, const float *g,
+                                   const float *r, const unsigned char *a,
+                                   unsigned char *dst, int n, bool grayscale);
+
+// Writes n RGBA8 pixels of a solid rgb color at dst. a is an optional 8-bit
+// alpha row; when null, alpha is 255.
+void fill_rgba_row(const unsigned char rgb[3], const unsigned char *a,
+                   unsigned char *dst, int n);
+
+// Writes output rows [y0, y1) of a bilinear scale x upscale of a packed RGBA8
+// image, all four channels, with pixel centers aligned and edges clamped.
+// out_stride is in bytes. Cheap enough to show while the network runs.
+void upscale_rgba_bilinear_rows(const unsigned char *pixels, int w, int h,
+                                int stride, int scale, unsigned char *out,
+                                int out_stride, int y0, int y1);
+
+#endif // PIXEL_KERNELS_H
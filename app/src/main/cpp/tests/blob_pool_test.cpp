@@ -0,0 +1,82 @@
+// Checks block reuse and the allocation counters of the engine's blob pool.
+
+#include "blob_pool.h"
+#include "test_util.h"
+
+#include <thread>
+
+// ncnn
+#include "mat.h"
+
+static void test_reuse_across_tiles() {
+  BlobPool pool;
+  for (int tile = 0; tile < 10; tile++) {
+    ncnn::Mat in(40, 40, 3, (size_t)4u, &pool);
+    ncnn::Mat out(80, 80, 3, (size_t)4u, &pool);
+    CHECK(!in.empty() && !out.empty());
+    in.fill(1.f);
+    out.fill(2.f);
+  }
+  BlobPoolStats s = pool.stats();
+  CHECK(s.requests == 20);
+  CHECK(s.heap_allocs == 2);
+  CHECK(s.blocks == 2);
+  CHECK(s.idle_bytes == s.bytes);
+
+  // A slightly smaller edge tile fits an idle block; a much smaller one
+  // gets its own block rather than pinning a large one
+  { ncnn::Mat edge(38, 40, 3, (size_t)4u, &pool); }
+  CHECK(pool.stats().heap_allocs == 2);
+  { ncnn::Mat edge(8, 40, 3, (size_t)4u, &pool); }
+  CHECK(pool.stats().heap_allocs == 3);
+
+  pool.clear();
+  s = pool.stats();
+  CHECK(s.blocks == 0 && s.bytes == 0);
+}
+
+static void test_in_use_blocks_are_not_shared() {
+  BlobPool pool;
+  ncnn::Mat a(64, 64, 1, (size_t)4u, &pool);
+  ncnn::Mat b(64, 64, 1, (size_t)4u, &pool);
+  CHECK(a.data != b.data);
+  CHECK(pool.stats().heap_allocs == 2);
+
+  // clear() keeps blocks still referenced by a Mat
+  void *kept = a.data;
+  b.release();
+  pool.clear();
+  CHECK(pool.stats().blocks == 1);
+  a.release();
+  ncnn::Mat c(64, 64, 1, (size_t)4u, &pool);
+  CHECK(c.data == kept);
+}
+
+static void test_concurrent_free() {
+  // Output tiles are freed by write-back workers while the inference thread
+  // allocates the next one
+  BlobPool pool;
+  std::thread workers[4];
+  for (std::thread &t : workers) {
+    t = std::thread([&pool]() {
+      for (int i = 0; i < 500; i++) {
+        ncnn::Mat m(32 + i % 3, 32, 4, (size_t)4u, &pool);
+        CHECK(!m.empty());
+        m.fill(0.5f);
+      }
+    });
+  }
+  for (std::thread &t : workers)
+    t.join();
+  BlobPoolStats s = pool.stats();
+  CHECK(s.requests == 2000);
+  CHECK(s.heap_allocs <= 4 * 3);
+  CHECK(s.idle_bytes == s.bytes);
+}
+
+int main() {
+  test_reuse_across_tiles();
+  test_in_use_blocks_are_not_shared();
+  test_concurrent_free();
+  return 0;
+}
@@ -0,0 +1,265 @@
+// Checks priority order, preemption at tile boundaries and cancellation of
+// the job scheduler.
+
+#include "job_scheduler.h"
+#include "test_util.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Log of "<job><tile>" steps in the order the jobs ran them
+struct Trace {
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::string steps;
+
+  void add(char job, int tile) {
+    std::lock_guard<std::mutex> guard(mutex);
+    steps += job;
+    steps += (char)('0' + tile);
+    cv.notify_all();
+  }
+  void wait_for(const char *step) {
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [&]() { return steps.find(step) != std::string::npos; });
+  }
+};
+
+// Holds a tile until the test opens it, so the other threads' steps happen
+// while that tile is in progress
+struct Gate {
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool opened = false;
+
+  void open() {
+    std::lock_guard<std::mutex> guard(mutex);
+    opened = true;
+    cv.notify_all();
+  }
+  void pass() {
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [&]() { return opened; });
+  }
+};
+
+// A job of `tiles` tiles with a checkpoint before every tile like
+// Waifu2x::process(). With a gate, the first tile waits for it.
+static void run_job(JobScheduler &scheduler, JobScheduler::Job &job,
+                    char name, int tiles, Trace &trace,
+                    Gate *first_tile = nullptr) {
+  ScheduledJob turn(&scheduler, &job);
+  CHECK(turn.enter(nullptr));
+  for (int t = 0; t < tiles; t++) {
+    CHECK(turn.checkpoint(nullptr));
+    trace.add(name, t);
+    if (t == 0 && first_tile)
+      first_tile->pass();
+  }
+}
+
+static void wait_until_waiting(JobScheduler &scheduler, int waiting) {
+  while (scheduler.stats().waiting != waiting)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+static void test_preemption_at_tile_boundary() {
+  JobScheduler scheduler(1);
+  Trace trace;
+  JobScheduler::Job prefetch;
+  prefetch.id = 7;
+  JobScheduler::Job visible;
+  visible.id = 3;
+  visible.priority = 1;
+
+  Gate gate;
+  std::thread low(run_job, std::ref(scheduler), std::ref(prefetch), 'p', 4,
+                  std::ref(trace), &gate);
+  trace.wait_for("p0");
+  std::thread high(run_job, std::ref(scheduler), std::ref(visible), 'v', 2,
+                   std::ref(trace), nullptr);
+  wait_until_waiting(scheduler, 1);
+  gate.open();
+  high.join();
+  low.join();
+
+  // The visible page runs as soon as the prefetch page finishes its
+  // current tile, and the prefetch page then resumes at its next tile
+  CHECK(trace.steps == "p0v0v1p1p2p3");
+  CHECK(prefetch.preemptions == 1);
+  CHECK(prefetch.waited_ms > 0);
+  CHECK(visible.preemptions == 0);
+  CHECK(scheduler.stats().preemptions == 1);
+  CHECK(scheduler.stats().running == 0 && scheduler.stats().waiting == 0);
+}
+
+static void test_equal_priority_is_fifo() {
+  JobScheduler scheduler(1);
+  Trace trace;
+  JobScheduler::Job a, b;
+  Gate gate;
+  std::thread first(run_job, std::ref(scheduler), std::ref(a), 'a', 3,
+                    std::ref(trace), &gate);
+  trace.wait_for("a0");
+  std::thread second(run_job, std::ref(scheduler), std::ref(b), 'b', 2,
+                     std::ref(trace), nullptr);
+  wait_until_waiting(scheduler, 1);
+  gate.open();
+  first.join();
+  second.join();
+  CHECK(trace.steps == "a0a1a2b0b1");
+  CHECK(a.preemptions == 0);
+}
+
+static void test_raised_priority_preempts() {
+  // A queued page becomes the visible one while another page runs
+  JobScheduler scheduler(1);
+  Trace trace;
+  JobScheduler::Job running, queued;
+  running.id = 1;
+  queued.id = 2;
+  Gate gate;
+  std::thread first(run_job, std::ref(scheduler), std::ref(running), 'r', 5,
+                    std::ref(trace), &gate);
+  trace.wait_for("r0");
+  std::thread second(run_job, std::ref(scheduler), std::ref(queued), 'q', 1,
+                     std::ref(trace), nullptr);
+  wait_until_waiting(scheduler, 1);
+  scheduler.set_priority(2, 5);
+  gate.open();
+  first.join();
+  second.join();
+  CHECK(running.preemptions == 1);
+  CHECK(trace.steps == "r0q0r1r2r3r4");
+}
+
+static void test_cancel_while_waiting() {
+  JobScheduler scheduler(1);
+  JobScheduler::Job holder, waiter;
+  ScheduledJob hold(&scheduler, &holder);
+  CHECK(hold.enter(nullptr));
+
+  std::atomic<bool> cancel{false};
+  bool entered = true;
+  std::thread t([&]() {
+    ScheduledJob turn(&scheduler, &waiter);
+    entered = turn.enter(&cancel);
+  });
+  wait_until_waiting(scheduler, 1);
+  cancel = true;
+  t.join();
+  CHECK(!entered);
+  CHECK(scheduler.stats().waiting == 0);
+  hold.leave();
+  CHECK(scheduler.stats().running == 0);
+}
+
+static void test_cancel_while_preempted() {
+  // A prefetch page cancelled while it waits for the visible one to finish
+  // gives up without running another tile
+  JobScheduler scheduler(1);
+  JobScheduler::Job prefetch, visible;
+  visible.priority = 1;
+  ScheduledJob low(&scheduler, &prefetch);
+  CHECK(low.enter(nullptr));
+  std::atomic<bool> cancel{false};
+  bool resumed = true;
+  std::thread preempted([&]() {
+    wait_until_waiting(scheduler, 1);
+    resumed = low.checkpoint(&cancel);
+    low.leave();
+  });
+  ScheduledJob high(&scheduler, &visible);
+  CHECK(high.enter(nullptr));
+  while (scheduler.stats().preemptions != 1)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  cancel = true;
+  preempted.join();
+  CHECK(!resumed);
+  CHECK(prefetch.preemptions == 1);
+  high.leave();
+  CHECK(scheduler.stats().running == 0 && scheduler.stats().waiting == 0);
+}
+
+static void test_slots() {
+  JobScheduler scheduler(2);
+  JobScheduler::Job a, b, c;
+  ScheduledJob ta(&scheduler, &a), tb(&scheduler, &b);
+  CHECK(ta.enter(nullptr) && tb.enter(nullptr));
+  CHECK(scheduler.stats().running == 2);
+
+  // A third job waits for a slot; a lower-priority one never preempts
+  c.priority = -1;
+  std::thread t([&]() {
+    ScheduledJob tc(&scheduler, &c);
+    CHECK(tc.enter(nullptr));
+  });
+  wait_until_waiting(scheduler, 1);
+  CHECK(ta.checkpoint(nullptr));
+  CHECK(a.preemptions == 0);
+  ta.leave();
+  t.join();
+  CHECK(scheduler.stats().jobs == 3);
+}
+
+static void test_set_slots() {
+  // Switching to an engine that runs calls in parallel starts queued jobs
+  JobScheduler scheduler(1);
+  JobScheduler::Job a, b;
+  ScheduledJob ta(&scheduler, &a);
+  CHECK(ta.enter(nullptr));
+  std::thread t([&]() {
+    ScheduledJob tb(&scheduler, &b);
+    CHECK(tb.enter(nullptr));
+  });
+  wait_until_waiting(scheduler, 1);
+  scheduler.set_slots(2);
+  t.join();
+  CHECK(scheduler.stats().running == 1);
+}
+
+static std::atomic<int> g_focus{1};
+
+static int focus_priority(int id) { return -std::abs(id - g_focus.load()); }
+
+static void test_priority_source() {
+  // The focus moves to a page before it enters, as during its progressive
+  // preview; it still gets its new priority when it does
+  JobScheduler scheduler(1, focus_priority);
+  JobScheduler::Job holder, late;
+  holder.id = 1;
+  late.id = 2;
+  ScheduledJob hold(&scheduler, &holder);
+  CHECK(hold.enter(nullptr));
+  CHECK(holder.priority == 0);
+  g_focus = 2;
+  scheduler.refresh_priorities();
+
+  Trace trace;
+  std::thread t(run_job, std::ref(scheduler), std::ref(late), 'l', 1,
+                std::ref(trace), nullptr);
+  wait_until_waiting(scheduler, 1);
+  // The holder yields at its next tile boundary and resumes after
+  CHECK(hold.checkpoint(nullptr));
+  t.join();
+  CHECK(trace.steps == "l0");
+  CHECK(holder.preemptions == 1 && holder.priority == -1);
+  hold.leave();
+}
+
+int main() {
+  test_preemption_at_tile_boundary();
+  test_equal_priority_is_fifo();
+  test_raised_priority_preempts();
+  test_cancel_while_waiting();
+  test_cancel_while_preempted();
+  test_slots();
+  test_set_slots();
+  test_priority_source();
+  return 0;
+}
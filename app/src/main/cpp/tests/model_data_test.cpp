@@ -0,0 +1,49 @@
+// Checks that model files are mapped in place with the same bytes a plain
+// read gives.
+
+#include "model_data.h"
+#include "test_util.h"
+
+#include <fstream>
+#include <sstream>
+#include <utility>
+
+static std::string read_file(const std::string &path) {
+  std::ifstream file(path, std::ios::binary);
+  std::stringstream bytes;
+  bytes << file.rdbuf();
+  return bytes.str();
+}
+
+static void test_map_file() {
+  const std::string path = model_path("realcugan-models/up2x-no-denoise.bin");
+  const std::string expected = read_file(path);
+  CHECK(!expected.empty());
+
+  ModelData weights;
+  CHECK(weights.map_file(path) == 0);
+  CHECK(weights.in_place());
+  CHECK(weights.size() == expected.size());
+  CHECK(weights.text() == expected);
+
+  CHECK(process_rss_bytes() > 0);
+
+  // Moving hands the mapping over; the source is left empty
+  ModelData moved = std::move(weights);
+  CHECK(weights.data() == nullptr && weights.size() == 0);
+  CHECK(moved.size() == expected.size() && moved.in_place());
+  moved.reset();
+  CHECK(moved.data() == nullptr && !moved.in_place());
+}
+
+static void test_missing_file() {
+  ModelData data;
+  CHECK(data.map_file(model_path("does-not-exist.bin")) == -1);
+  CHECK(data.data() == nullptr && data.size() == 0);
+}
+
+int main() {
+  test_map_file();
+  test_missing_file();
+  return 0;
+}
@@ -0,0 +1,65 @@
+// Checks the tile halo and output crop derived from .param graphs against
+// the values the reference ncnn implementations hardcode.
+
+#include "model_geometry.h"
+#include "test_util.h"
+
+static ModelGeometry load(const char *relative) {
+  ModelGeometry geo;
+  CHECK(load_model_geometry(model_path(relative), geo) == 0);
+  return geo;
+}
+
+static void test_bundled_models() {
+  // Unpadded networks: the halo is the crop the network applies itself
+  ModelGeometry geo = load("realcugan-models/up2x-no-denoise.param");
+  CHECK(geo.scale == 2 && geo.offset == 18 && geo.halo == 18);
+  CHECK(!geo.zero_padded && geo.alignment == 2); // one stride-2 stage
+  geo = load("realcugan-models/up3x-no-denoise.param");
+  CHECK(geo.scale == 3 && geo.offset == 14 && geo.halo == 14);
+  geo = load("realcugan-models/up4x-no-denoise.param");
+  CHECK(geo.scale == 4 && geo.offset == 19 && geo.halo == 19);
+  geo = load("waifu2x-models-upconv7/noise0_scale2.0x_model.param");
+  CHECK(geo.scale == 2 && geo.offset == 7 && geo.halo == 7);
+  CHECK(geo.alignment == 1);
+  geo = load("waifu2x-models/noise1_model.param");
+  CHECK(geo.scale == 1 && geo.offset == 28 && geo.halo == 28);
+  CHECK(geo.alignment == 4);
+
+  // Same-padded network: full size output, halo is the receptive radius
+  geo = load("realesrgan-models/v3-anime/x2.param");
+  CHECK(geo.scale == 2 && geo.offset == 0 && geo.zero_padded);
+  CHECK(geo.halo == 19);
+}
+
+static void test_synthetic_graphs() {
+  ModelGeometry geo;
+  // Two valid 3x3 convs and a 2x pixel shuffle
+  CHECK(parse_model_geometry("7767517\n4 4\n"
+                             "Input in 0 1 in\n"
+                             "Convolution c0 1 1 in a 0=8 1=3\n"
+                             "Convolution c1 1 1 a b 0=12 1=3\n"
+                             "PixelShuffle ps 1 1 b out 0=2\n",
+                             geo) == 0);
+  CHECK(geo.scale == 2 && geo.offset == 2 && geo.halo == 2);
+
+  // Dilated same-padded conv
+  CHECK(parse_model_geometry("7767517\n2 2\n"
+                             "Input in 0 1 in\n"
+                             "Convolution c0 1 1 in out 0=3 1=3 2=4 4=-233\n",
+                             geo) == 0);
+  CHECK(geo.scale == 1 && geo.offset == 0 && geo.halo == 4);
+
+  // Unknown spatial layer and a bad header are rejected
+  CHECK(parse_model_geometry("7767517\n2 2\n"
+                             "Input in 0 1 in\n"
+                             "Reshape r 1 1 in out 0=-1\n",
+                             geo) != 0);
+  CHECK(parse_model_geometry("not a param file", geo) != 0);
+}
+
+int main() {
+  test_bundled_models();
+  test_synthetic_graphs();
+  return 0;
+}
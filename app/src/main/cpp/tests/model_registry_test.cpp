@@ -0,0 +1,80 @@
+// Checks the memory-budgeted LRU of resident engines.
+
+#include "model_registry.h"
+#include "test_util.h"
+
+namespace {
+
+struct FakeEngine {
+  size_t bytes;
+  size_t resident_bytes() const { return bytes; }
+};
+
+ModelKey key(const char *model, int noise, int scale) {
+  ModelKey k;
+  k.model = model;
+  k.noise = noise;
+  k.scale = scale;
+  return k;
+}
+
+} // namespace
+
+static void test_lru_within_budget() {
+  ModelRegistry<FakeEngine> registry(100);
+  auto cugan = std::make_shared<FakeEngine>(FakeEngine{40});
+  auto esrgan = std::make_shared<FakeEngine>(FakeEngine{40});
+  CHECK(!registry.find(key("cugan", 0, 2)));
+  registry.insert(key("cugan", 0, 2), cugan);
+  registry.insert(key("esrgan", 0, 4), esrgan);
+  CHECK(registry.stats().entries == 2 && registry.stats().bytes == 80);
+
+  // Noise and scale are part of the key
+  CHECK(!registry.find(key("cugan", 1, 2)));
+  CHECK(!registry.find(key("cugan", 0, 4)));
+
+  // Using cugan makes esrgan the least recently used, so it goes first
+  CHECK(registry.find(key("cugan", 0, 2)) == cugan);
+  registry.insert(key("cugan", 3, 2), std::make_shared<FakeEngine>(
+                                          FakeEngine{40}));
+  CHECK(!registry.find(key("esrgan", 0, 4)));
+  CHECK(registry.find(key("cugan", 0, 2)) == cugan);
+  ModelRegistryStats stats = registry.stats();
+  CHECK(stats.entries == 2 && stats.evictions == 1);
+  CHECK(stats.hits == 2 && stats.misses == 4);
+  // The evicted engine stays valid for whoever still holds it
+  CHECK(esrgan->resident_bytes() == 40);
+
+  // Engines grow while processing; the next insert sees it
+  cugan->bytes = 90;
+  registry.insert(key("waifu2x", 1, 2), std::make_shared<FakeEngine>(
+                                            FakeEngine{10}));
+  CHECK(registry.stats().entries == 2 && registry.stats().bytes == 100);
+  CHECK(!registry.find(key("cugan", 3, 2)));
+}
+
+static void test_active_engine_stays() {
+  ModelRegistry<FakeEngine> registry(100);
+  registry.insert(key("small", 0, 2),
+                  std::make_shared<FakeEngine>(FakeEngine{10}));
+  // Over budget on its own: it replaces everything else but stays
+  auto big = std::make_shared<FakeEngine>(FakeEngine{150});
+  registry.insert(key("big", 0, 2), big);
+  CHECK(registry.stats().entries == 1);
+  CHECK(registry.find(key("big", 0, 2)) == big);
+
+  // Replacing an entry keeps a single copy of the key
+  registry.set_max_bytes(1000);
+  registry.insert(key("big", 0, 2),
+                  std::make_shared<FakeEngine>(FakeEngine{20}));
+  CHECK(registry.stats().entries == 1 && registry.stats().bytes == 20);
+
+  registry.clear();
+  CHECK(registry.stats().entries == 0 && registry.stats().bytes == 0);
+}
+
+int main() {
+  test_lru_within_budget();
+  test_active_engine_stays();
+  return 0;
+}
@@ -0,0 +1,71 @@
+// Exercises the store of partial results left by cancelled calls.
+
+#include "partial_results.h"
+#include "test_util.h"
+
+static PartialResult make_result(int tiles, int done, size_t pixel_bytes) {
+  PartialResult result;
+  result.done.assign(tiles, 0);
+  for (int t = 0; t < done; t++)
+    result.done[t] = 1;
+  result.pixels.assign(pixel_bytes, (unsigned char)done);
+  return result;
+}
+
+static PartialResultKey make_key(uint64_t content) {
+  PartialResultKey key;
+  key.content[0] = content;
+  key.w = 8;
+  key.h = 8;
+  key.scale = 2;
+  return key;
+}
+
+static void test_take_moves_out() {
+  PartialResults store(1024);
+  store.store(make_key(1), make_result(4, 2, 100));
+  CHECK(store.stats().entries == 1 && store.stats().bytes == 104);
+
+  PartialResult out;
+  PartialResultKey other = make_key(1);
+  other.scale = 4; // same pixels, different settings
+  CHECK(!store.take(other, out));
+  CHECK(store.take(make_key(1), out));
+  CHECK(out.done_tiles() == 2 && out.pixels.size() == 100);
+  CHECK(out.pixels[0] == 2);
+  // Taken results are gone until the caller stores them again
+  CHECK(!store.take(make_key(1), out));
+  CHECK(store.stats().entries == 0 && store.stats().bytes == 0);
+  CHECK(store.stats().stored == 1 && store.stats().resumed == 1);
+}
+
+static void test_replace_and_evict() {
+  PartialResults store(250);
+  store.store(make_key(1), make_result(4, 1, 100));
+  store.store(make_key(2), make_result(4, 1, 100));
+  // A newer result for the same page replaces the older one
+  store.store(make_key(1), make_result(4, 3, 100));
+  CHECK(store.stats().entries == 2 && store.stats().bytes == 208);
+
+  // Over budget: the least recently stored page goes first
+  store.store(make_key(3), make_result(4, 1, 100));
+  PartialResult out;
+  CHECK(!store.take(make_key(2), out));
+  CHECK(store.take(make_key(1), out) && out.done_tiles() == 3);
+  CHECK(store.take(make_key(3), out));
+
+  // Nothing worth keeping, or more than the whole budget
+  store.store(make_key(4), make_result(4, 0, 100));
+  store.store(make_key(5), make_result(4, 4, 300));
+  CHECK(store.stats().entries == 0);
+
+  store.store(make_key(6), make_result(4, 1, 100));
+  store.set_max_bytes(50);
+  CHECK(store.stats().entries == 0 && store.stats().bytes == 0);
+}
+
+int main() {
+  test_take_moves_out();
+  test_replace_and_evict();
+  return 0;
+}
@@ -0,0 +1,205 @@
+// Checks the RGBA8 <-> tile conversion kernels against straightforward
+// reference implementations.
+
+#include "pixel_kernels.h"
+#include "test_util.h"
+
+#include <algorithm>
+
+static void test_gather_replicates_border() {
+  const int w = 37;
+  const int h = 23;
+  const int stride = w * 4 + 8; // padded rows, like some Android bitmaps
+  std::vector<unsigned char> pixels(stride * h);
+  for (size_t i = 0; i < pixels.size(); i++)
+    pixels[i] = (unsigned char)((i * 31 + 7) & 255);
+
+  const float norm = 1.0f / 255.0f;
+  const int widths[] = {1, 5, 30, 80};
+  for (int x0 = -20; x0 < 40; x0 += 3) {
+    for (int y0 = -20; y0 < 30; y0 += 5) {
+      for (int tw : widths) {
+        const int th = 17;
+        ncnn::Mat tile(tw, th, 3);
+        unsigned char min_alpha =
+            gather_rgba_tile_bgr(pixels.data(), w, h, stride, x0, y0, tile);
+
+        unsigned char ref_alpha = 255;
+        for (int i = 0; i < th; i++) {
+          for (int j = 0; j < tw; j++) {
+            int sx = std::min(std::max(x0 + j, 0), w - 1);
+            int sy = std::min(std::max(y0 + i, 0), h - 1);
+            const unsigned char *p = &pixels[sy * stride + sx * 4];
+            CHECK(tile.channel(0).row(i)[j] == p[2] * norm);
+            CHECK(tile.channel(1).row(i)[j] == p[1] * norm);
+            CHECK(tile.channel(2).row(i)[j] == p[0] * norm);
+            ref_alpha = std::min(ref_alpha, p[3]);
+          }
+        }
+        CHECK(min_alpha == ref_alpha);
+      }
+    }
+  }
+}
+
+static void test_opaque_window() {
+  const int w = 16;
+  const int h = 12;
+  std::vector<unsigned char> pixels(w * h * 4, 255);
+  ncnn::Mat tile(24, 20, 3);
+  CHECK(gather_rgba_tile_bgr(pixels.data(), w, h, w * 4, -4, -4, tile) ==
+        255);
+  CHECK(rgba_window_is_opaque(pixels.data(), w * 4, 0, 0, w, h));
+
+  pixels[(11 * w + 15) * 4 + 3] = 254; // bottom-right corner
+  CHECK(!rgba_window_is_opaque(pixels.data(), w * 4, 0, 0, w, h));
+  CHECK(rgba_window_is_opaque(pixels.data(), w * 4, 0, 0, w - 1, h));
+  // The replicated border repeats the corner, so gather sees it too
+  CHECK(gather_rgba_tile_bgr(pixels.data(), w, h, w * 4, 20, 16, tile) ==
+        254);
+}
+
+static void test_grayscale_detection() {
+  const int w = 20;
+  const int h = 10;
+  std::vector<unsigned char> pixels = make_test_page(w, h);
+  for (size_t i = 0; i < pixels.size(); i += 4)
+    pixels[i + 2] = pixels[i]; // make it neutral gray
+  CHECK(rgba_is_grayscale(pixels.data(), w, h, w * 4, 0));
+
+  pixels[0] = 200;
+  pixels[1] = 0;
+  CHECK(rgba_is_grayscale(pixels.data(), w, h, w * 4, 1));
+  CHECK(!rgba_is_grayscale(pixels.data(), w, h, w * 4, 0));
+}
+
+static void test_flat_window() {
+  const int w = 40;
+  const int h = 30;
+  std::vector<unsigned char> pixels(w * h * 4, 250);
+  pixels[(12 * w + 25) * 4 + 1] = 248; // within tolerance 2
+  pixels[(20 * w + 5) * 4 + 0] = 0;    // ink stroke
+
+  unsigned char rgb[3];
+  // Window hanging off the top-right corner, away from the stroke
+  CHECK(rgba_window_is_flat(pixels.data(), w, h, w * 4, 20, -10, 40, 25, 2,
+                            rgb));
+  CHECK(rgb[0] == 250 && rgb[1] == 249 && rgb[2] == 250);
+  CHECK(!rgba_window_is_flat(pixels.data(), w, h, w * 4, 20, -10, 40, 25, 1,
+                             rgb));
+  CHECK(!rgba_window_is_flat(pixels.data(), w, h, w * 4, -10, 10, 20, 20, 2,
+                             rgb));
+  // Entirely outside the image: nothing to scan, never treated as flat
+  CHECK(!rgba_window_is_flat(pixels.data(), w, h, w * 4, w, 0, 8, 8, 2, rgb));
+
+  const unsigned char alpha[3] = {0, 128, 255};
+  unsigned char px[3 * 4];
+  fill_rgba_row(rgb, alpha, px, 3);
+  for (int j = 0; j < 3; j++)
+    CHECK(px[j * 4] == 250 && px[j * 4 + 1] == 249 && px[j * 4 + 2] == 250);
+  CHECK(px[3] == 0 && px[7] == 128 && px[11] == 255);
+  fill_rgba_row(rgb, nullptr, px, 1);
+  CHECK(px[3] == 255);
+}
+
+static void test_writeback_matches_scalar() {
+  // Values straddle every rounding boundary plus out-of-range model output
+  const int n = 4096;
+  std::vector<float> planes[3];
+  std::vector<unsigned char> alpha(n);
+  unsigned int seed = 1;
+  for (int i = 0; i < n; i++)
+    alpha[i] = (unsigned char)(i * 37 + 11);
+  for (int c = 0; c < 3; c++) {
+    planes[c].resize(n);
+    for (int i = 0; i < n; i++) {
+      seed = seed * 1664525u + 1013904223u;
+      if (i < 512)
+        planes[c][i] = (i / 2 + (i % 2 ? 0.5f : 0.4999f)) / 255.0f;
+      else
+        planes[c][i] = (int)(seed >> 8) / (float)(1 << 24) * 1.4f - 0.2f;
+    }
+  }
+
+  // Odd lengths and offsets exercise the vector tails
+  const int lengths[] = {0, 1, 3, 7, 8, 9, 15, 16, 17, 33, 1000, n - 5};
+  for (int len : lengths) {
+    for (int offset = 0; offset < 3; offset++) {
+      if (offset + len > n)
+        continue;
+      for (int variant = 0; variant < 4; variant++) {
+        const bool grayscale = variant & 1;
+        const unsigned char *a =
+            (variant & 2) ? alpha.data() + offset : nullptr;
+        std::vector<unsigned char> ref(len * 4 + 4, 0xcd);
+        std::vector<unsigned char> out(len * 4 + 4, 0xcd);
+        planar_bgr_to_rgba_row_scalar(
+            planes[0].data() + offset, planes[1].data() + offset,
+            planes[2].data() + offset, a, ref.data(), len, grayscale);
+        planar_bgr_to_rgba_row(planes[0].data() + offset,
+                               planes[1].data() + offset,
+                               planes[2].data() + offset, a, out.data(), len,
+                               grayscale);
+        CHECK(ref == out); // includes the untouched guard bytes
+      }
+    }
+  }
+
+  // Reference semantics: round to nearest, clamp, RGBA order
+  const float b = 0.0f, g = 0.5f, r = 1.2f;
+  const unsigned char a = 7;
+  unsigned char px[4];
+  planar_bgr_to_rgba_row(&b, &g, &r, &a, px, 1, false);
+  CHECK(px[0] == 255 && px[1] == 128 && px[2] == 0 && px[3] == 7);
+  planar_bgr_to_rgba_row(&b, &g, &r, nullptr, px, 1, false);
+  CHECK(px[3] == 255);
+
+  // Alpha rows from the bicubic upscale can overshoot 0-1 near hard edges
+  const float unit[4] = {-0.1f, 0.5f, 0.4999f / 255.0f, 1.2f};
+  unsigned char u8[4];
+  unit_to_u8_row(unit, u8, 4);
+  CHECK(u8[0] == 0 && u8[1] == 128 && u8[2] == 0 && u8[3] == 255);
+}
+
+static void test_bilinear_preview() {
+  // Scale 1 is a copy
+  const int w = 7;
+  const int h = 5;
+  std::vector<unsigned char> page = make_test_page(w, h);
+  std::vector<unsigned char> copy(page.size());
+  upscale_rgba_bilinear_rows(page.data(), w, h, w * 4, 1, copy.data(), w * 4,
+                             0, h);
+  CHECK(copy == page);
+
+  // A two-pixel ramp, doubled: edges clamp, inner pixels blend 3:1
+  const unsigned char ramp[8] = {0, 0, 0, 255, 255, 255, 255, 255};
+  unsigned char px[4 * 4 * 2];
+  upscale_rgba_bilinear_rows(ramp, 2, 1, 8, 2, px, 16, 0, 2);
+  const unsigned char expected[4] = {0, 64, 191, 255};
+  for (int y = 0; y < 2; y++) {
+    for (int x = 0; x < 4; x++) {
+      CHECK(px[y * 16 + x * 4] == expected[x]);
+      CHECK(px[y * 16 + x * 4 + 3] == 255);
+    }
+  }
+
+  // Row ranges compose: two halves equal one pass
+  std::vector<unsigned char> whole(w * 3 * h * 3 * 4), halves(whole.size());
+  upscale_rgba_bilinear_rows(page.data(), w, h, w * 4, 3, whole.data(),
+                             w * 12, 0, h * 3);
+  upscale_rgba_bilinear_rows(page.data(), w, h, w * 4, 3, halves.data(),
+                             w * 12, 0, 7);
+  upscale_rgba_bilinear_rows(page.data(), w, h, w * 4, 3, halves.data(),
+                             w * 12, 7, h * 3);
+  CHECK(whole == halves);
+}
+
+int main() {
+  test_gather_replicates_border();
+  test_opaque_window();
+  test_grayscale_detection();
+  test_flat_window();
+  test_writeback_matches_scalar();
+  test_bilinear_preview();
+  return 0;
+}
@@ -0,0 +1,41 @@
+// Minimal helpers shared by the host tests.
+
+#ifndef UPSCALE_TEST_UTIL_H
+#define UPSCALE_TEST_UTIL_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+      exit(1);                                                                 \
+    }                                                                          \
+  } while (0)
+
+static inline std::string model_path(const char *relative) {
+  return std::string(UPSCALE_MODEL_DIR) + "/" + relative;
+}
+
+// Packed RGBA8 test page: soft gradient with a dark stroke, fully opaque.
+static inline std::vector<unsigned char> make_test_page(int w, int h) {
+  std::vector<unsigned char> pixels(w * h * 4);
+  for (int y = 0; y < h; y++) {
+    for (int x = 0; x < w; x++) {
+      unsigned char *p = &pixels[(y * w + x) * 4];
+      int v = 255 - (x + y) * 64 / (w + h);
+      if (std::abs(x - y) < 2)
+        v = 16;
+      p[0] = (unsigned char)v;
+      p[1] = (unsigned char)v;
+      p[2] = (unsigned char)(v * 3 / 4);
+      p[3] = 255;
+    }
+  }
+  return pixels;
+}
+
+#endif // UPSCALE_TEST_UTIL_H
@@ -0,0 +1,85 @@
+// Exercises the content hash and the LRU tile cache.
+
+#include "test_util.h"
+#include "tile_cache.h"
+
+static ncnn::Mat make_tile(int w, int h, float seed) {
+  ncnn::Mat tile(w, h, 3);
+  for (int c = 0; c < 3; c++) {
+    float *p = tile.channel(c);
+    for (int i = 0; i < w * h; i++)
+      p[i] = seed + c * 0.25f + i * 1e-4f;
+  }
+  return tile;
+}
+
+static void test_hash_tracks_content() {
+  uint64_t a[2], b[2];
+  ncnn::Mat tile = make_tile(17, 9, 0.1f);
+  hash_tile(tile, a);
+  hash_tile(tile.clone(), b);
+  CHECK(a[0] == b[0] && a[1] == b[1]);
+
+  tile.channel(2)[17 * 9 - 1] += 1e-6f; // last value of the last plane
+  hash_tile(tile, b);
+  CHECK(a[0] != b[0] && a[1] != b[1]);
+
+  // Same values, different shape
+  uint64_t c[2];
+  hash_tile(make_tile(9, 17, 0.1f), c);
+  CHECK(a[0] != c[0]);
+}
+
+static void test_lru_eviction() {
+  const ncnn::Mat tile = make_tile(8, 8, 0.5f);
+  const size_t tile_bytes = tile.total() * tile.elemsize;
+  TileCache cache(tile_bytes * 2);
+
+  TileCacheKey keys[3];
+  for (int i = 0; i < 3; i++) {
+    keys[i].content[0] = 1000 + i;
+    keys[i].model = 7;
+    keys[i].scale = 2;
+  }
+
+  ncnn::Mat out;
+  CHECK(!cache.lookup(keys[0], out));
+  cache.insert(keys[0], tile);
+  cache.insert(keys[1], tile);
+  CHECK(cache.lookup(keys[0], out)); // keys[1] is now least recently used
+  CHECK(out.w == 8 && out.channel(1)[5] == tile.channel(1)[5]);
+  CHECK(out.data != tile.data); // entries own their copy
+
+  cache.insert(keys[2], tile);
+  CHECK(!cache.lookup(keys[1], out));
+  CHECK(cache.lookup(keys[0], out));
+  CHECK(cache.lookup(keys[2], out));
+
+  // Model, scale and padding are part of the key
+  TileCacheKey other = keys[0];
+  other.model = 8;
+  CHECK(!cache.lookup(other, out));
+  other = keys[0];
+  other.prepadding = 10;
+  CHECK(!cache.lookup(other, out));
+
+  TileCacheStats stats = cache.stats();
+  CHECK(stats.entries == 2);
+  CHECK(stats.bytes == tile_bytes * 2);
+  CHECK(stats.hits == 3);
+  CHECK(stats.misses == 4);
+
+  cache.set_max_bytes(tile_bytes);
+  CHECK(cache.stats().entries == 1);
+  CHECK(cache.lookup(keys[2], out)); // most recently used survives
+
+  cache.clear();
+  stats = cache.stats();
+  CHECK(stats.entries == 0 && stats.bytes == 0 && stats.hits == 0);
+}
+
+int main() {
+  test_hash_tracks_content();
+  test_lru_eviction();
+  return 0;
+}
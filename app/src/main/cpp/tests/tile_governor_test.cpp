@@ -0,0 +1,99 @@
+// Checks the duty-cycle pacing, thermal drift detection and UI back-off of
+// the tile governor.
+
+#include "test_util.h"
+#include "tile_governor.h"
+
+#include <cmath>
+
+static bool near(double a, double b) { return std::fabs(a - b) < 1e-6; }
+
+static void test_duty_cycle() {
+  TileGovernor governor;
+  GovernorDecision d = governor.on_wave(10, 100000);
+  CHECK(d.duty == 100 && near(d.gap_ms, 0) && !d.hot && !d.changed);
+
+  // Half the wall time busy: the gap matches the wave
+  governor.set_duty_cycle(50);
+  d = governor.on_wave(10, 100000);
+  CHECK(d.duty == 50 && near(d.gap_ms, 10));
+  governor.set_duty_cycle(25);
+  d = governor.on_wave(10, 100000);
+  CHECK(near(d.gap_ms, 30));
+
+  // Nothing inferred, nothing to pace
+  d = governor.on_wave(0, 0);
+  CHECK(near(d.gap_ms, 0));
+  CHECK(governor.stats().waves == 3);
+}
+
+static void test_thermal_drift() {
+  TileGovernor governor;
+  governor.set_duty_cycle(80);
+  for (int i = 0; i < 10; i++)
+    governor.on_wave(10, 100000);
+  CHECK(!governor.stats().hot);
+
+  // The same tiles take twice as long once the clocks throttle
+  GovernorDecision d;
+  int changes = 0;
+  for (int i = 0; i < 20; i++) {
+    d = governor.on_wave(20, 100000);
+    changes += d.changed;
+  }
+  CHECK(d.hot && changes == 1);
+  CHECK(d.drift > 1.9 && d.drift <= 2.0);
+  CHECK(d.duty == 40 && near(d.gap_ms, 30));
+  CHECK(governor.stats().throttle_events == 1);
+
+  // Cooling down restores the configured duty cycle
+  for (int i = 0; i < 20; i++)
+    d = governor.on_wave(10, 100000);
+  CHECK(!d.hot && d.duty == 80);
+
+  governor.reset();
+  CHECK(near(governor.stats().drift, 1) && !governor.stats().hot);
+}
+
+static void test_ui_busy() {
+  TileGovernor governor;
+  governor.set_ui_busy(true);
+  GovernorDecision d = governor.on_wave(2, 10000);
+  CHECK(d.ui_busy && d.changed && d.duty == 50);
+  CHECK(near(d.gap_ms, 16)); // at least a frame
+  d = governor.on_wave(40, 200000);
+  CHECK(!d.changed && near(d.gap_ms, 40));
+
+  governor.set_ui_busy(false);
+  d = governor.on_wave(2, 10000);
+  CHECK(d.changed && d.duty == 100 && near(d.gap_ms, 0));
+  CHECK(governor.stats().throttle_events == 1);
+}
+
+static void test_interleaved_calls() {
+  // Two calls alternate waves: one sees the UI flag, the other has none and
+  // tiles twice the size at the same cost per pixel
+  TileGovernor governor;
+  int changes = 0;
+  GovernorDecision d;
+  for (int i = 0; i < 10; i++) {
+    governor.set_ui_busy(i < 5);
+    d = governor.on_wave(10, 100000);
+    changes += d.changed;
+    d = governor.on_wave(20, 200000);
+    changes += d.changed;
+    CHECK(d.ui_busy == (i < 5) && !d.hot);
+  }
+  // Busy once, idle once: the flagless call never flips the state back
+  CHECK(changes == 2);
+  CHECK(governor.stats().throttle_events == 1);
+  CHECK(near(governor.stats().drift, 1));
+}
+
+int main() {
+  test_duty_cycle();
+  test_thermal_drift();
+  test_ui_busy();
+  test_interleaved_calls();
+  return 0;
+}
@@ -0,0 +1,45 @@
+// Checks the viewport-first tile order.
+
+#include "test_util.h"
+#include "tile_order.h"
+
+static void test_raster_without_viewport() {
+  std::vector<int> order;
+  CHECK(order_tiles(3, 2, 32, 32, 80, 60, Viewport(), order) == 6);
+  for (int t = 0; t < 6; t++)
+    CHECK(order[t] == t);
+}
+
+static void test_viewport_first() {
+  // A webtoon strip: 2 x 10 tiles of 100 px, 180 px wide, looking at the
+  // middle rows 4-5
+  Viewport viewport;
+  viewport.x = 0;
+  viewport.y = 450;
+  viewport.w = 180;
+  viewport.h = 100;
+  std::vector<int> order;
+  CHECK(order_tiles(2, 10, 100, 100, 180, 1000, viewport, order) == 4);
+  CHECK(order[0] == 8 && order[1] == 9 && order[2] == 10 && order[3] == 11);
+  // Then the rows just above and below, in raster order
+  CHECK(order[4] == 6 && order[5] == 7 && order[6] == 12 && order[7] == 13);
+  CHECK(order[16] == 0 && order[19] == 19);
+
+  // Scrolling down: the rows below come before the ones above
+  viewport.scroll_dy = 1;
+  CHECK(order_tiles(2, 10, 100, 100, 180, 1000, viewport, order) == 4);
+  CHECK(order[4] == 12 && order[5] == 13 && order[6] == 6 && order[7] == 7);
+  CHECK(order[19] == 1);
+
+  // A viewport past the image edge still orders by distance
+  viewport.y = 2000;
+  viewport.scroll_dy = 0;
+  CHECK(order_tiles(2, 10, 100, 100, 180, 1000, viewport, order) == 0);
+  CHECK(order[0] == 18 && order[19] == 1);
+}
+
+int main() {
+  test_raster_without_viewport();
+  test_viewport_first();
+  return 0;
+}
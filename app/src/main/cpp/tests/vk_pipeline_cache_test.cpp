@@ -0,0 +1,76 @@
+// Checks the on-disk pipeline cache format: a file is only accepted for the
+// device and driver it was written for, and only when intact.
+
+#include "test_util.h"
+#include "vk_pipeline_cache.h"
+
+#include <cstring>
+
+static PipelineCacheKey make_key() {
+  PipelineCacheKey key;
+  key.vendor_id = 0x10005;
+  key.device_id = 0;
+  key.driver_version = 0x6001;
+  for (int i = 0; i < 16; i++)
+    key.uuid[i] = (uint8_t)i;
+  return key;
+}
+
+static void test_round_trip() {
+  const PipelineCacheKey key = make_key();
+  const std::string payload = "driver pipeline cache bytes";
+  const std::string file =
+      encode_pipeline_cache(key, payload.data(), payload.size());
+  std::string data;
+  CHECK(decode_pipeline_cache(file, key, data) == 0);
+  CHECK(data == payload);
+  // Deterministic, so an unchanged cache writes the same file
+  CHECK(encode_pipeline_cache(key, payload.data(), payload.size()) == file);
+}
+
+static void test_rejects_other_keys() {
+  const PipelineCacheKey key = make_key();
+  const std::string payload(1000, 'x');
+  const std::string file =
+      encode_pipeline_cache(key, payload.data(), payload.size());
+  std::string data;
+
+  PipelineCacheKey other = key;
+  other.driver_version++; // driver update
+  CHECK(decode_pipeline_cache(file, other, data) == -1);
+  other = key;
+  other.uuid[15] ^= 1;
+  CHECK(decode_pipeline_cache(file, other, data) == -1);
+  other = key;
+  other.device_id++;
+  CHECK(decode_pipeline_cache(file, other, data) == -1);
+  CHECK(data.empty());
+
+  // Each device and driver gets its own file
+  CHECK(pipeline_cache_path("/c", key) != pipeline_cache_path("/c", other));
+  CHECK(pipeline_cache_path("/c", key).compare(0, 3, "/c/") == 0);
+}
+
+static void test_rejects_damaged_files() {
+  const PipelineCacheKey key = make_key();
+  const std::string payload(1000, 'x');
+  const std::string file =
+      encode_pipeline_cache(key, payload.data(), payload.size());
+  std::string data;
+
+  CHECK(decode_pipeline_cache(file.substr(0, file.size() - 1), key, data) ==
+        -1);
+  CHECK(decode_pipeline_cache(file.substr(0, 10), key, data) == -1);
+  CHECK(decode_pipeline_cache(std::string(), key, data) == -1);
+  std::string flipped = file;
+  flipped[flipped.size() - 500] ^= 0x40;
+  CHECK(decode_pipeline_cache(flipped, key, data) == -1);
+  CHECK(decode_pipeline_cache(file + "x", key, data) == -1);
+}
+
+int main() {
+  test_round_trip();
+  test_rejects_other_keys();
+  test_rejects_damaged_files();
+  return 0;
+}
@@ -0,0 +1,260 @@
+// Runs the engine end to end on the CPU backend with a bundled model.
+
+#include "partial_results.h"
+#include "test_util.h"
+#include "tile_cache.h"
+#include "waifu2x.h"
+#include "worker_pool.h"
+
+#include <cmath>
+#include <thread>
+
+int main() {
+  const int w = 80;
+  const int h = 60;
+  std::vector<unsigned char> page = make_test_page(w, h);
+
+  Waifu2x engine(-1);
+  engine.scale = 2;
+  engine.prepadding = 18;
+  engine.tilesize = 32; // Force several tiles, including partial edge tiles
+  CHECK(engine.load(model_path("realcugan-models/up2x-no-denoise.param"),
+                    model_path("realcugan-models/up2x-no-denoise.bin")) == 0);
+  // The weights are read from a mapping of the file
+  CHECK(engine.load_stats.weights_in_place);
+  CHECK(engine.load_stats.weight_bytes > 0 && engine.load_stats.rss_after > 0);
+  // One dummy tile of the configured shape, ahead of the first page
+  CHECK(engine.warm_up() == 0);
+
+  const int out_w = w * 2;
+  const int out_h = h * 2;
+  std::vector<unsigned char> out(out_w * out_h * 4, 0);
+
+  std::atomic<int> progress{0};
+  ProcessContext ctx;
+  ctx.out_pixels = out.data();
+  ctx.out_stride = out_w * 4;
+  ctx.progress = &progress;
+  CHECK(engine.process(page.data(), w, h, w * 4, ctx) == 0);
+  CHECK(progress.load() == 100);
+
+  // The upscale must stay close to a nearest-neighbour enlargement.
+  double err = 0.0;
+  for (int y = 0; y < out_h; y++) {
+    for (int x = 0; x < out_w; x++) {
+      const unsigned char *src = &page[((y / 2) * w + x / 2) * 4];
+      const unsigned char *dst = &out[(y * out_w + x) * 4];
+      for (int c = 0; c < 3; c++)
+        err += std::abs((int)src[c] - (int)dst[c]);
+      CHECK(dst[3] == 255);
+    }
+  }
+  err /= (double)out_w * out_h * 3;
+  fprintf(stderr, "mean abs error vs nearest: %.2f\n", err);
+  CHECK(err < 12.0);
+
+  // A blank margin wider than tile plus padding skips inference and comes out
+  // as the exact paper color, with the inked part unaffected.
+  const int margin = 64;
+  for (int y = 0; y < h; y++)
+    for (int x = w - margin; x < w; x++)
+      for (int c = 0; c < 3; c++)
+        page[(y * w + x) * 4 + c] = 240;
+  Waifu2xStats stats;
+  ctx.stats = &stats;
+  CHECK(engine.process(page.data(), w, h, w * 4, ctx) == 0);
+  CHECK(stats.tiles == 6);
+  CHECK(stats.skipped_tiles == 2); // the 16 px wide right-hand tile column
+  // 32 + 2 * 18 is already even, as CUGAN's stride-2 stage needs; the
+  // 16 px column and 28 px row are fed as shifted full-size tiles
+  CHECK(stats.tile_input_size == 68);
+  // Same tile shapes as the first pass: the pools serve almost everything
+  CHECK(stats.pool_requests > 0);
+  CHECK(stats.pool_heap_allocs * 10 < stats.pool_requests);
+  for (int y = 0; y < out_h; y++) {
+    const unsigned char *dst = &out[(y * out_w + out_w - 32) * 4];
+    for (int x = 0; x < 32; x++)
+      CHECK(dst[x * 4] == 240 && dst[x * 4 + 2] == 240 &&
+            dst[x * 4 + 3] == 255);
+  }
+
+  // A second pass over the same page is served from the tile cache and
+  // reproduces the first output exactly.
+  TileCache cache(64u << 20);
+  engine.tile_cache = &cache;
+  std::vector<unsigned char> cached(out.size(), 0);
+  CHECK(engine.process(page.data(), w, h, w * 4, ctx) == 0);
+  CHECK(stats.cache_hits == 0);
+  ProcessContext cached_ctx = ctx;
+  cached_ctx.out_pixels = cached.data();
+  CHECK(engine.process(page.data(), w, h, w * 4, cached_ctx) == 0);
+  CHECK(stats.cache_hits == stats.tiles - stats.skipped_tiles);
+  CHECK(cached == out);
+  CHECK(cache.stats().entries == (size_t)stats.cache_hits);
+  engine.tile_cache = nullptr;
+
+  // The page so far is opaque: no tile may take the alpha path
+  CHECK(stats.alpha_tiles == 0);
+
+  // Alpha is upscaled per tile; a vertical ramp must come out as a ramp
+  // with no step at the tile boundaries (every 32 input rows).
+  for (int y = 0; y < h; y++)
+    for (int x = 0; x < w; x++)
+      page[(y * w + x) * 4 + 3] = (unsigned char)(y * 255 / (h - 1));
+  CHECK(engine.process(page.data(), w, h, w * 4, ctx) == 0);
+  for (int y = 2; y < out_h - 2; y++) {
+    const float expected = ((y + 0.5f) / 2 - 0.5f) * 255.f / (h - 1);
+    for (int x = 0; x < out_w; x++)
+      CHECK(std::fabs(out[(y * out_w + x) * 4 + 3] - expected) <= 2.f);
+  }
+  CHECK(stats.alpha_tiles == stats.tiles);
+
+  // A call cancelled after its first tile leaves the finished tiles behind,
+  // and the next call on the page resumes from them to the same output
+  PartialResults partials(16u << 20);
+  engine.partial_results = &partials;
+  // Long governor gaps leave time to cancel before the second wave
+  engine.governor.set_duty_cycle(5);
+  std::vector<unsigned char> resumed(out.size(), 0);
+  std::atomic<bool> stop{false};
+  ProcessContext stopped_ctx = ctx;
+  stopped_ctx.out_pixels = resumed.data();
+  stopped_ctx.cancel = &stop;
+  progress = 0;
+  std::thread canceller([&]() {
+    while (progress.load() == 0)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    stop = true;
+  });
+  CHECK(engine.process(page.data(), w, h, w * 4, stopped_ctx) == -1);
+  canceller.join();
+  engine.governor.set_duty_cycle(100);
+  CHECK(partials.stats().entries == 1);
+  // Only the finished tiles are kept, not the whole output
+  CHECK(partials.stats().bytes < out.size());
+  std::fill(resumed.begin(), resumed.end(), 0);
+  stopped_ctx.cancel = nullptr;
+  CHECK(engine.process(page.data(), w, h, w * 4, stopped_ctx) == 0);
+  CHECK(stats.resumed_tiles > 0 && stats.resumed_tiles < stats.tiles);
+  CHECK(resumed == out);
+  CHECK(partials.stats().entries == 0 && partials.stats().resumed == 1);
+
+  // A cancel after the last wave, here the flat bottom-right tile, is not
+  // missed: the call fails and keeps the earlier tiles, whose write-backs
+  // the governor gaps leave time to finish
+  engine.governor.set_duty_cycle(5);
+  stop = false;
+  stopped_ctx.cancel = &stop;
+  progress = 0;
+  const int last_progress = 5 * 99 / 6 + 1;
+  std::thread late_canceller([&]() {
+    while (progress.load() < last_progress) {
+    }
+    stop = true;
+  });
+  CHECK(engine.process(page.data(), w, h, w * 4, stopped_ctx) == -1);
+  late_canceller.join();
+  engine.governor.set_duty_cycle(100);
+  CHECK(progress.load() < 100);
+  CHECK(partials.stats().entries == 1);
+  std::fill(resumed.begin(), resumed.end(), 0);
+  stopped_ctx.cancel = nullptr;
+  CHECK(engine.process(page.data(), w, h, w * 4, stopped_ctx) == 0);
+  CHECK(stats.resumed_tiles > 0);
+  CHECK(resumed == out);
+  engine.partial_results = nullptr;
+
+  // Viewport-first order changes when tiles run, not what they write
+  std::vector<unsigned char> viewport_first(out.size(), 0);
+  std::atomic<int> viewport_progress{0};
+  ProcessContext viewport_ctx = ctx;
+  viewport_ctx.out_pixels = viewport_first.data();
+  viewport_ctx.viewport.x = 50;
+  viewport_ctx.viewport.y = 40;
+  viewport_ctx.viewport.w = 20;
+  viewport_ctx.viewport.h = 10;
+  viewport_ctx.viewport.scroll_dy = 1;
+  viewport_ctx.viewport_progress = &viewport_progress;
+  CHECK(engine.process(page.data(), w, h, w * 4, viewport_ctx) == 0);
+  CHECK(stats.viewport_tiles == 2); // the bottom row's last two tiles
+  CHECK(viewport_progress.load() == 100);
+  CHECK(stats.viewport_ms > 0 && stats.viewport_ms <= stats.total_ms);
+  CHECK(viewport_first == out);
+
+  // A viewport off the image has no tiles, and is complete from the start
+  viewport_progress = 0;
+  viewport_ctx.viewport.x = w + 10;
+  CHECK(engine.process(page.data(), w, h, w * 4, viewport_ctx) == 0);
+  CHECK(stats.viewport_tiles == 0);
+  CHECK(viewport_progress.load() == 100);
+
+  // Progressive output: the bilinear preview is posted first as the whole
+  // image, then each tile's rect; together the tiles cover the output once
+  // and the final pixels are the same
+  std::vector<unsigned char> progressive(out.size(), 0);
+  LockFreeQueue<DirtyRect> dirty_rects(64);
+  ProcessContext progressive_ctx = ctx;
+  progressive_ctx.out_pixels = progressive.data();
+  progressive_ctx.progressive = true;
+  progressive_ctx.dirty_rects = &dirty_rects;
+  CHECK(engine.process(page.data(), w, h, w * 4, progressive_ctx) == 0);
+  CHECK(progressive == out);
+  CHECK(stats.preview_ms > 0 && stats.preview_ms <= stats.first_tile_ms);
+  DirtyRect rect;
+  CHECK(dirty_rects.pop(rect));
+  CHECK(rect.x == 0 && rect.y == 0 && rect.w == out_w && rect.h == out_h);
+  int rects = 0;
+  long long area = 0;
+  while (dirty_rects.pop(rect)) {
+    rects++;
+    area += (long long)rect.w * rect.h;
+  }
+  CHECK(rects == stats.tiles);
+  CHECK(area == (long long)out_w * out_h);
+
+  // Concurrent extractors infer different tiles of a wave and must write
+  // the same page as one extractor
+  Waifu2x concurrent(-1, false, 4);
+  concurrent.scale = 2;
+  concurrent.tilesize = 32;
+  concurrent.inference_workers = 2;
+  CHECK(concurrent.load(
+            model_path("realcugan-models/up2x-no-denoise.param"),
+            model_path("realcugan-models/up2x-no-denoise.bin")) == 0);
+  Waifu2xStats concurrent_stats;
+  std::vector<unsigned char> parallel(out.size(), 0);
+  ProcessContext parallel_ctx;
+  parallel_ctx.out_pixels = parallel.data();
+  parallel_ctx.out_stride = out_w * 4;
+  parallel_ctx.stats = &concurrent_stats;
+  CHECK(concurrent.process(page.data(), w, h, w * 4, parallel_ctx) == 0);
+  CHECK(concurrent_stats.inference_workers == 2);
+  CHECK(concurrent_stats.inference_threads == 2);
+  CHECK(concurrent_stats.tiles == stats.tiles);
+  for (size_t i = 0; i < out.size(); i++)
+    CHECK(std::abs((int)parallel[i] - (int)out[i]) <= 1);
+
+  // One engine serves several calls at once, each with its own context;
+  // a cancelled call stops without disturbing the others
+  std::vector<unsigned char> pages[3];
+  std::atomic<bool> cancel{true};
+  int results[3];
+  std::thread callers[3];
+  for (int i = 0; i < 3; i++) {
+    pages[i].assign(out.size(), 0);
+    callers[i] = std::thread([&, i]() {
+      ProcessContext job;
+      job.out_pixels = pages[i].data();
+      job.out_stride = out_w * 4;
+      if (i == 2)
+        job.cancel = &cancel;
+      results[i] = concurrent.process(page.data(), w, h, w * 4, job);
+    });
+  }
+  for (std::thread &t : callers)
+    t.join();
+  CHECK(results[0] == 0 && results[1] == 0 && results[2] == -1);
+  CHECK(pages[0] == parallel && pages[1] == parallel);
+
+  return 0;
+}
@@ -0,0 +1,69 @@
+// Exercises the write-back pool and its lock-free completion queue.
+
+#include "test_util.h"
+#include "worker_pool.h"
+
+#include <algorithm>
+
+static void test_queue_bounds() {
+  LockFreeQueue<int> queue(3); // rounds up to 4
+  for (int i = 0; i < 4; i++)
+    CHECK(queue.push(i));
+  CHECK(!queue.push(4));
+  int v = -1;
+  for (int i = 0; i < 4; i++) {
+    CHECK(queue.pop(v));
+    CHECK(v == i);
+  }
+  CHECK(!queue.pop(v));
+}
+
+static void test_batches_share_pool() {
+  WorkerPool pool(3, 4);
+  for (int round = 0; round < 20; round++) {
+    const int tiles = 200;
+    std::vector<int> hits(tiles, 0);
+    std::vector<int> completed;
+    {
+      TileBatch batch(pool, tiles);
+      for (int i = 0; i < tiles; i++) {
+        batch.submit(i, [&hits, i]() { hits[i]++; });
+        TileCompletion done;
+        while (batch.poll(done))
+          completed.push_back(done.index);
+      }
+      batch.wait();
+      TileCompletion done;
+      while (batch.poll(done))
+        completed.push_back(done.index);
+    }
+    CHECK((int)completed.size() == tiles);
+    std::sort(completed.begin(), completed.end());
+    for (int i = 0; i < tiles; i++) {
+      CHECK(hits[i] == 1);
+      CHECK(completed[i] == i);
+    }
+  }
+}
+
+static void test_batch_destructor_waits() {
+  WorkerPool pool(2, 2);
+  std::atomic<int> ran{0};
+  {
+    TileBatch batch(pool, 16);
+    for (int i = 0; i < 16; i++)
+      batch.submit(i, [&ran]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        ran++;
+      });
+    // Early return without wait(): the destructor must still block
+  }
+  CHECK(ran.load() == 16);
+}
+
+int main() {
+  test_queue_bounds();
+  test_batches_share_pool();
+  test_batch_destructor_waits();
+  return 0;
+}
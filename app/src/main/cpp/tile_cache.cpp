@@ -0,0 +1,138 @@
+#include "tile_cache.h"
+#include <cstring>
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+// MurmurHash3 finalizer
+static inline uint64_t fmix64(uint64_t k) {
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdULL;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ULL;
+  k ^= k >> 33;
+  return k;
+}
+
+void hash128(const void *data, size_t size, const uint64_t seed[2],
+             uint64_t out[2]) {
+  const uint64_t c1 = 0x87c37b91114253d5ULL;
+  const uint64_t c2 = 0x4cf5ad432745937fULL;
+  const unsigned char *p = (const unsigned char *)data;
+  uint64_t h1 = seed ? seed[0] : 0x9e3779b97f4a7c15ULL;
+  uint64_t h2 = seed ? seed[1] : 0xc2b2ae3d27d4eb4fULL;
+
+  // Two independent lanes over 16-byte blocks, as in MurmurHash3 x64_128
+  const size_t blocks = size / 16;
+  for (size_t i = 0; i < blocks; i++, p += 16) {
+    uint64_t k1, k2;
+    memcpy(&k1, p, 8);
+    memcpy(&k2, p + 8, 8);
+
+    k1 *= c1;
+    k1 = rotl64(k1, 31);
+    k1 *= c2;
+    h1 ^= k1;
+    h1 = rotl64(h1, 27);
+    h1 += h2;
+    h1 = h1 * 5 + 0x52dce729;
+
+    k2 *= c2;
+    k2 = rotl64(k2, 33);
+    k2 *= c1;
+    h2 ^= k2;
+    h2 = rotl64(h2, 31);
+    h2 += h1;
+    h2 = h2 * 5 + 0x38495ab5;
+  }
+
+  uint64_t tail[2] = {0, 0};
+  memcpy(tail, p, size % 16);
+  h1 ^= rotl64(tail[0] * c1, 31) * c2;
+  h2 ^= rotl64(tail[1] * c2, 33) * c1;
+
+  h1 ^= size;
+  h2 ^= size;
+  h1 += h2;
+  h2 += h1;
+  h1 = fmix64(h1);
+  h2 = fmix64(h2);
+  h1 += h2;
+  h2 += h1;
+  out[0] = h1;
+  out[1] = h2;
+}
+
+void hash_tile(const ncnn::Mat &tile, uint64_t out[2]) {
+  const size_t plane_bytes = (size_t)tile.w * tile.h * tile.elemsize;
+  uint64_t h[2] = {(uint64_t)tile.w, (uint64_t)tile.h};
+  for (int c = 0; c < tile.c; c++)
+    hash128(tile.channel(c).data, plane_bytes, h, h);
+  out[0] = h[0];
+  out[1] = h[1];
+}
+
+TileCache::TileCache(size_t _max_bytes) : max_bytes(_max_bytes) {}
+
+bool TileCache::lookup(const TileCacheKey &key, ncnn::Mat &out) {
+  std::lock_guard<std::mutex> guard(mutex);
+  auto it = index.find(key);
+  if (it == index.end()) {
+    misses++;
+    return false;
+  }
+  hits++;
+  lru.splice(lru.begin(), lru, it->second);
+  out = it->second->tile;
+  return true;
+}
+
+void TileCache::insert(const TileCacheKey &key, const ncnn::Mat &tile) {
+  // Copy outside the lock. clone() allocates with the default allocator, so
+  // the entry does not pin the net's pooled blob memory.
+  ncnn::Mat copy = tile.clone();
+  if (copy.empty())
+    return;
+  const size_t entry_bytes = copy.total() * copy.elemsize;
+
+  std::lock_guard<std::mutex> guard(mutex);
+  if (entry_bytes > max_bytes || index.count(key))
+    return;
+  evict_to(max_bytes - entry_bytes);
+  lru.push_front(Entry{key, copy, entry_bytes});
+  index[key] = lru.begin();
+  bytes += entry_bytes;
+}
+
+void TileCache::set_max_bytes(size_t _max_bytes) {
+  std::lock_guard<std::mutex> guard(mutex);
+  max_bytes = _max_bytes;
+  evict_to(max_bytes);
+}
+
+void TileCache::clear() {
+  std::lock_guard<std::mutex> guard(mutex);
+  evict_to(0);
+  hits = 0;
+  misses = 0;
+}
+
+TileCacheStats TileCache::stats() const {
+  std::lock_guard<std::mutex> guard(mutex);
+  TileCacheStats s;
+  s.entries = lru.size();
+  s.bytes = bytes;
+  s.max_bytes = max_bytes;
+  s.hits = hits;
+  s.misses = misses;
+  return s;
+}
+
+void TileCache::evict_to(size_t limit) {
+  while (bytes > limit && !lru.empty()) {
+    bytes -= lru.back().bytes;
+    index.erase(lru.back().key);
+    lru.pop_back();
+  }
+}
@@ -0,0 +1,90 @@
+// Bounded LRU of upscaled tiles keyed by the content of their input window.
+
+#ifndef TILE_CACHE_H
+#define TILE_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+// ncnn
+#include "mat.h"
+
+// 128-bit content hash plus everything else that changes the network output
+// for identical input pixels.
+struct TileCacheKey {
+  uint64_t content[2] = {0, 0};
+  uint64_t model = 0; // Waifu2x model identity, see Waifu2x::load()
+  int scale = 0;
+  int prepadding = 0;
+  int w = 0; // padded input tile size
+  int h = 0;
+
+  bool operator==(const TileCacheKey &o) const {
+    return content[0] == o.content[0] && content[1] == o.content[1] &&
+           model == o.model && scale == o.scale &&
+           prepadding == o.prepadding && w == o.w && h == o.h;
+  }
+};
+
+struct TileCacheStats {
+  size_t entries = 0;
+  size_t bytes = 0;
+  size_t max_bytes = 0;
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+};
+
+// Fast non-cryptographic 128-bit hash of size bytes. Chain calls through
+// seed (the previous out) to hash several buffers as one.
+void hash128(const void *data, size_t size, const uint64_t seed[2],
+             uint64_t out[2]);
+
+// Hashes the w x h pixels of every channel of a planar float tile, skipping
+// the alignment gap between channels.
+void hash_tile(const ncnn::Mat &tile, uint64_t out[2]);
+
+// Thread-safe. Entries are owned copies, so they stay valid after the net
+// that produced them is destroyed and can be shared by several engines.
+class TileCache {
+public:
+  explicit TileCache(size_t max_bytes);
+
+  // On a hit, out shares the cached tile (read only) and the entry becomes
+  // the most recently used.
+  bool lookup(const TileCacheKey &key, ncnn::Mat &out);
+
+  // Stores a copy of tile, evicting least recently used entries to stay
+  // within max_bytes. Tiles larger than the whole budget are not cached.
+  void insert(const TileCacheKey &key, const ncnn::Mat &tile);
+
+  void set_max_bytes(size_t max_bytes);
+  void clear();
+  TileCacheStats stats() const;
+
+private:
+  struct KeyHash {
+    size_t operator()(const TileCacheKey &k) const {
+      return (size_t)(k.content[0] ^ k.model);
+    }
+  };
+  struct Entry {
+    TileCacheKey key;
+    ncnn::Mat tile;
+    size_t bytes;
+  };
+
+  void evict_to(size_t limit);
+
+  mutable std::mutex mutex;
+  std::list<Entry> lru; // front is most recently used
+  std::unordered_map<TileCacheKey, std::list<Entry>::iterator, KeyHash> index;
+  size_t max_bytes;
+  size_t bytes = 0;
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+};
+
+#endif // TILE_CACHE_H
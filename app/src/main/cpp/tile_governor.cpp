@@ -0,0 +1,92 @@
+#include "tile_governor.h"
+
+#include <algorithm>
+
+namespace {
+
+const double kSmoothing = 0.25; // weight of the newest wave in the cost
+// Thermal state hysteresis on the drift, so it does not flap
+const double kHotDrift = 1.3;
+const double kCoolDrift = 1.15;
+const int kMinDuty = 20;    // while hot, unless set lower
+const int kUiBusyDuty = 50; // cap while the UI animates
+const double kFrameMs = 16; // shortest gap while the UI animates
+const double kMaxGapMs = 500;
+
+} // namespace
+
+void TileGovernor::set_duty_cycle(int percent) {
+  std::lock_guard<std::mutex> guard(mutex);
+  duty = std::min(std::max(percent, 1), 100);
+}
+
+int TileGovernor::duty_cycle() const {
+  std::lock_guard<std::mutex> guard(mutex);
+  return duty;
+}
+
+void TileGovernor::set_ui_busy(bool busy) {
+  std::lock_guard<std::mutex> guard(mutex);
+  ui_busy = busy;
+}
+
+GovernorDecision TileGovernor::on_wave(double busy_ms, long long pixels) {
+  std::lock_guard<std::mutex> guard(mutex);
+  GovernorDecision d;
+  const bool was_hot = hot;
+  const bool was_busy = decided_busy;
+  const bool busy = ui_busy;
+  decided_busy = busy;
+
+  // Flat, cached and resumed tiles cost nothing to pace
+  if (pixels > 0 && busy_ms > 0) {
+    const double sample = busy_ms * 1e6 / (double)pixels;
+    cost = cost > 0 ? cost + kSmoothing * (sample - cost) : sample;
+    baseline = baseline > 0 ? std::min(baseline, cost) : cost;
+    totals.drift = cost / baseline;
+    if (totals.drift > kHotDrift)
+      hot = true;
+    else if (totals.drift < kCoolDrift)
+      hot = false;
+  }
+
+  d.drift = totals.drift;
+  d.hot = hot;
+  d.ui_busy = busy;
+  d.changed = hot != was_hot || busy != was_busy;
+  if ((hot && !was_hot) || (busy && !was_busy))
+    totals.throttle_events++;
+
+  d.duty = duty;
+  if (hot)
+    d.duty = std::max((int)(duty / d.drift), std::min(duty, kMinDuty));
+  if (busy)
+    d.duty = std::min(d.duty, kUiBusyDuty);
+  if (pixels > 0 && busy_ms > 0) {
+    d.gap_ms = busy_ms * (100 - d.duty) / d.duty;
+    if (busy)
+      d.gap_ms = std::max(d.gap_ms, kFrameMs);
+    d.gap_ms = std::min(d.gap_ms, kMaxGapMs);
+    totals.waves++;
+    totals.busy_ms += busy_ms;
+    totals.gap_ms += d.gap_ms;
+  }
+  totals.hot = hot;
+  return d;
+}
+
+void TileGovernor::reset() {
+  std::lock_guard<std::mutex> guard(mutex);
+  cost = 0;
+  baseline = 0;
+  hot = false;
+  ui_busy = false;
+  decided_busy = false;
+  totals.drift = 1;
+  totals.hot = false;
+}
+
+GovernorStats TileGovernor::stats() const {
+  std::lock_guard<std::mutex> guard(mutex);
+  return totals;
+}
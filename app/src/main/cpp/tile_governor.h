@@ -0,0 +1,72 @@
+// Paces tile inference to hold a duty cycle (the share of wall time spent in
+// the network) and backs off further when the device heats up or the UI is
+// busy.
+
+#ifndef TILE_GOVERNOR_H
+#define TILE_GOVERNOR_H
+
+#include <mutex>
+
+// What the governor decided after a wave of tiles.
+struct GovernorDecision {
+  double gap_ms = 0;   // pause before the next wave
+  int duty = 100;      // duty cycle aimed at, percent
+  double drift = 1;    // latency per pixel relative to the cool baseline
+  bool hot = false;    // drift crossed the thermal threshold
+  bool ui_busy = false;
+  bool changed = false; // hot or ui_busy differs from the previous wave
+};
+
+struct GovernorStats {
+  long long waves = 0;
+  double busy_ms = 0; // inference time reported by on_wave()
+  double gap_ms = 0;  // pauses handed out
+  int throttle_events = 0; // entries into the hot or UI-busy state
+  double drift = 1;
+  bool hot = false;
+};
+
+// Thread-safe; one per engine, shared by its concurrent calls.
+//
+// Every wave reports how long it kept the network busy and how many input
+// pixels it covered. Latency per pixel is smoothed, and its lowest smoothed
+// value so far is the cool baseline; a device that throttles its clocks
+// drifts above it. The gap after a wave makes busy / (busy + gap) equal the
+// duty cycle, which drops by the drift while hot and is capped while the UI
+// animates, when the gap also lasts at least a frame. Only the gaps change:
+// the tile size stays fixed, since the warmed-up pipelines, the tile cache
+// and partial results are all keyed by the tile shape.
+//
+// Its state is engine-wide. The waves of concurrent calls feed one latency
+// history, and the UI state is whatever a caller last set, so a call
+// without a UI flag of its own leaves it alone. Each change of state is
+// reported once, to whichever call's wave first sees it.
+class TileGovernor {
+public:
+  // Duty cycle when cool and idle, 1-100 percent; 100 runs flat out.
+  void set_duty_cycle(int percent);
+  int duty_cycle() const;
+
+  // Whether the UI is animating; applies from the next wave of any call.
+  void set_ui_busy(bool busy);
+
+  // Records a wave of tiles that kept the network busy for busy_ms over
+  // pixels input pixels, and returns the pause to leave before the next.
+  GovernorDecision on_wave(double busy_ms, long long pixels);
+
+  // Forgets the latency history, for a new model.
+  void reset();
+  GovernorStats stats() const;
+
+private:
+  mutable std::mutex mutex;
+  int duty = 100;
+  double cost = 0;     // smoothed ms per megapixel, 0 before any wave
+  double baseline = 0; // lowest smoothed cost seen
+  bool hot = false;
+  bool ui_busy = false;     // as last set
+  bool decided_busy = false; // as of the last wave's decision
+  GovernorStats totals;
+};
+
+#endif // TILE_GOVERNOR_H
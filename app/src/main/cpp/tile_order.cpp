@@ -0,0 +1,45 @@
+#include "tile_order.h"
+
+#include <algorithm>
+
+namespace {
+
+// Gap between [a0, a1) and the viewport span [v0, v1) along one axis, 0 when
+// they overlap. A gap on the side the viewport moves away from counts double.
+int axis_distance(int a0, int a1, int v0, int v1, int scroll) {
+  if (a1 <= v0)
+    return (v0 - a1 + 1) * (scroll > 0 ? 2 : 1);
+  if (a0 >= v1)
+    return (a0 - v1 + 1) * (scroll < 0 ? 2 : 1);
+  return 0;
+}
+
+} // namespace
+
+int order_tiles(int xtiles, int ytiles, int tile_w, int tile_h, int w, int h,
+                const Viewport &viewport, std::vector<int> &order) {
+  const int tiles = xtiles * ytiles;
+  order.resize(tiles);
+  for (int t = 0; t < tiles; t++)
+    order[t] = t;
+  if (viewport.empty())
+    return tiles;
+
+  std::vector<int> distance(tiles);
+  int viewport_tiles = 0;
+  for (int t = 0; t < tiles; t++) {
+    const int x = t % xtiles * tile_w;
+    const int y = t / xtiles * tile_h;
+    const int dx = axis_distance(x, std::min(x + tile_w, w), viewport.x,
+                                 viewport.x + viewport.w, viewport.scroll_dx);
+    const int dy = axis_distance(y, std::min(y + tile_h, h), viewport.y,
+                                 viewport.y + viewport.h, viewport.scroll_dy);
+    distance[t] = std::max(dx, dy);
+    if (distance[t] == 0)
+      viewport_tiles++;
+  }
+  std::stable_sort(order.begin(), order.end(), [&distance](int a, int b) {
+    return distance[a] < distance[b];
+  });
+  return viewport_tiles;
+}
@@ -0,0 +1,32 @@
+// Order in which the tiles of a page are upscaled.
+
+#ifndef TILE_ORDER_H
+#define TILE_ORDER_H
+
+#include <vector>
+
+// Region of the input the user is looking at, in input pixels, and the
+// direction it moves in (-1, 0 or 1 per axis; +1 scrolls towards larger
+// coordinates). An empty rectangle stands for the whole image.
+struct Viewport {
+  int x = 0;
+  int y = 0;
+  int w = 0;
+  int h = 0;
+  int scroll_dx = 0;
+  int scroll_dy = 0;
+
+  bool empty() const { return w <= 0 || h <= 0; }
+};
+
+// Lays out tile indices (raster numbering, xtiles per row, tiles of
+// tile_w x tile_h input pixels clipped to w x h) in processing order: tiles
+// touching the viewport first, then the others by their distance from it.
+// Distances behind the scroll direction count double, so the next content
+// to come on screen is upscaled before what was just scrolled past. Equal
+// distances keep raster order. Returns the number of viewport tiles, which
+// lead the order.
+int order_tiles(int xtiles, int ytiles, int tile_w, int tile_h, int w, int h,
+                const Viewport &viewport, std::vector<int> &order);
+
+#endif // TILE_ORDER_H
@@ -0,0 +1,236 @@
+#include "vk_pipeline_cache.h"
+#include "native_log.h"
+#include "tile_cache.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <sys/stat.h>
+#include <vector>
+
+#define TAG "Waifu2xNative"
+#define LOGD(...) NATIVE_LOGD(TAG, __VA_ARGS__)
+#define LOGE(...) NATIVE_LOGE(TAG, __VA_ARGS__)
+
+namespace {
+
+const char kMagic[8] = {'U', 'P', 'V', 'K', 'P', 'C', '0', '2'};
+
+// Written as is: the file is only ever read back on the same device
+struct FileHeader {
+  char magic[8];
+  uint32_t vendor_id;
+  uint32_t device_id;
+  uint32_t driver_version;
+  uint8_t uuid[16];
+  uint64_t size;
+  uint64_t checksum[2];
+};
+
+FileHeader make_header(const PipelineCacheKey &key, const void *data,
+                       size_t size) {
+  FileHeader h;
+  memset(&h, 0, sizeof(h)); // padding too, so the file is deterministic
+  memcpy(h.magic, kMagic, sizeof(kMagic));
+  h.vendor_id = key.vendor_id;
+  h.device_id = key.device_id;
+  h.driver_version = key.driver_version;
+  memcpy(h.uuid, key.uuid, sizeof(h.uuid));
+  h.size = size;
+  hash128(data, size, nullptr, h.checksum);
+  return h;
+}
+
+} // namespace
+
+std::string pipeline_cache_path(const std::string &dir,
+                                const PipelineCacheKey &key) {
+  char name[64];
+  snprintf(name, sizeof(name), "pipelines-%08x-%08x-%08x.bin", key.vendor_id,
+           key.device_id, key.driver_version);
+  return dir + "/" + name;
+}
+
+std::string encode_pipeline_cache(const PipelineCacheKey &key,
+                                  const void *data, size_t size) {
+  const FileHeader h = make_header(key, data, size);
+  std::string bytes((const char *)&h, sizeof(h));
+  bytes.append((const char *)data, size);
+  return bytes;
+}
+
+int decode_pipeline_cache(const std::string &bytes,
+                          const PipelineCacheKey &key, std::string &data) {
+  FileHeader h;
+  if (bytes.size() < sizeof(h))
+    return -1;
+  memcpy(&h, bytes.data(), sizeof(h));
+  if (memcmp(h.magic, kMagic, sizeof(kMagic)) != 0 ||
+      h.vendor_id != key.vendor_id || h.device_id != key.device_id ||
+      h.driver_version != key.driver_version ||
+      memcmp(h.uuid, key.uuid, sizeof(h.uuid)) != 0 ||
+      h.size != bytes.size() - sizeof(h))
+    return -1;
+  const char *payload = bytes.data() + sizeof(h);
+  const FileHeader expected = make_header(key, payload, h.size);
+  if (memcmp(h.checksum, expected.checksum, sizeof(h.checksum)) != 0)
+    return -1;
+  data.assign(payload, h.size);
+  return 0;
+}
+
+#if NCNN_VULKAN
+
+namespace {
+
+// ncnn's own vkCreateComputePipelines, which the hook forwards to
+std::atomic<PFN_vkCreateComputePipelines> g_create_compute_pipelines{
+    nullptr};
+std::mutex g_hook_lock;
+
+// The cache begun on this thread, if any
+thread_local PersistentPipelineCache *t_active = nullptr;
+
+int read_file(const std::string &path, std::string &bytes) {
+  FILE *fp = fopen(path.c_str(), "rb");
+  if (!fp)
+    return -1;
+  bytes.clear();
+  char buf[65536];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+    bytes.append(buf, n);
+  const bool failed = ferror(fp) != 0;
+  fclose(fp);
+  return failed ? -1 : 0;
+}
+
+// Replaces the file whole, so a crash mid-write leaves the old one. Models
+// loading at once share the file; the last to save wins.
+int write_file(const std::string &path, const std::string &bytes) {
+  static std::atomic<unsigned> serial{0};
+  const std::string tmp = path + "." + std::to_string(serial++) + ".tmp";
+  FILE *fp = fopen(tmp.c_str(), "wb");
+  if (!fp)
+    return -1;
+  const bool written =
+      fwrite(bytes.data(), 1, bytes.size(), fp) == bytes.size();
+  if (fclose(fp) != 0 || !written || rename(tmp.c_str(), path.c_str()) != 0) {
+    remove(tmp.c_str());
+    return -1;
+  }
+  return 0;
+}
+
+} // namespace
+
+void install_pipeline_cache_hook() {
+  // create_gpu_instance() leaves the pointers alone when the instance
+  // exists, so this only writes after a new one
+  std::lock_guard<std::mutex> lock(g_hook_lock);
+  if (ncnn::vkCreateComputePipelines &&
+      ncnn::vkCreateComputePipelines !=
+          PersistentPipelineCache::create_compute_pipelines) {
+    g_create_compute_pipelines = ncnn::vkCreateComputePipelines;
+    ncnn::vkCreateComputePipelines =
+        PersistentPipelineCache::create_compute_pipelines;
+  }
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL
+PersistentPipelineCache::create_compute_pipelines(
+    VkDevice device, VkPipelineCache pipeline_cache, uint32_t count,
+    const VkComputePipelineCreateInfo *infos,
+    const VkAllocationCallbacks *allocator, VkPipeline *pipelines) {
+  PersistentPipelineCache *active = t_active;
+  if (pipeline_cache == 0 && active && active->device == device) {
+    pipeline_cache = active->cache;
+    active->created += (int)count;
+  }
+  return g_create_compute_pipelines.load()(device, pipeline_cache, count,
+                                           infos, allocator, pipelines);
+}
+
+PersistentPipelineCache::PersistentPipelineCache(
+    const ncnn::VulkanDevice *vkdev, const std::string &dir) {
+  const ncnn::GpuInfo &info = vkdev->info;
+  device = vkdev->vkdevice();
+  key.vendor_id = info.vendor_id();
+  key.device_id = info.device_id();
+  key.driver_version = info.driver_version();
+  memcpy(key.uuid, info.pipeline_cache_uuid(), sizeof(key.uuid));
+  // ncnn knows drivers whose caches come back corrupted
+  if (!dir.empty() && !info.bug_corrupted_online_pipeline_cache()) {
+    mkdir(dir.c_str(), 0700);
+    path = pipeline_cache_path(dir, key);
+  }
+
+  std::string bytes;
+  std::string data;
+  if (!path.empty() && read_file(path, bytes) == 0 &&
+      decode_pipeline_cache(bytes, key, data) != 0) {
+    LOGD("Discarding stale pipeline cache %s", path.c_str());
+    data.clear();
+  }
+
+  VkPipelineCacheCreateInfo create_info;
+  create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+  create_info.pNext = 0;
+  create_info.flags = 0;
+  create_info.initialDataSize = data.size();
+  create_info.pInitialData = data.empty() ? 0 : data.data();
+  if (ncnn::vkCreatePipelineCache(device, &create_info, 0, &cache) ==
+      VK_SUCCESS) {
+    restored_bytes = data.size();
+    return;
+  }
+  // Data the driver rejects must not stop the model from loading
+  create_info.initialDataSize = 0;
+  create_info.pInitialData = 0;
+  if (ncnn::vkCreatePipelineCache(device, &create_info, 0, &cache) !=
+      VK_SUCCESS) {
+    LOGE("Cannot create a pipeline cache");
+    cache = 0;
+  }
+}
+
+PersistentPipelineCache::~PersistentPipelineCache() {
+  end();
+  if (cache)
+    ncnn::vkDestroyPipelineCache(device, cache, 0);
+}
+
+void PersistentPipelineCache::begin() {
+  if (cache)
+    t_active = this;
+}
+
+void PersistentPipelineCache::end() {
+  if (t_active == this)
+    t_active = nullptr;
+}
+
+int PersistentPipelineCache::save() {
+  if (!cache || path.empty())
+    return -1;
+  if (created == 0)
+    return 0; // nothing new to write
+  size_t size = 0;
+  if (ncnn::vkGetPipelineCacheData(device, cache, &size, 0) != VK_SUCCESS)
+    return -1;
+  if (size <= restored_bytes)
+    return 0; // every pipeline came from the restored data
+  std::vector<unsigned char> data(size);
+  if (size == 0 || ncnn::vkGetPipelineCacheData(device, cache, &size,
+                                                data.data()) != VK_SUCCESS)
+    return -1;
+  if (write_file(path, encode_pipeline_cache(key, data.data(), size)) != 0) {
+    LOGE("Cannot write pipeline cache %s", path.c_str());
+    return -1;
+  }
+  LOGD("Saved %zu KB of pipelines to %s", size / 1024, path.c_str());
+  return 0;
+}
+
+#endif // NCNN_VULKAN
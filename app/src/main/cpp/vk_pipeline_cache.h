@@ -0,0 +1,98 @@
+// Vulkan pipeline cache kept on disk, so an engine loaded again in a later
+// run of the app gets its compute pipelines from the driver's cache rather
+// than having the driver compile every shader again. Only that driver
+// compile, SPIR-V to the GPU's code, is saved: ncnn still compiles its GLSL
+// to SPIR-V with glslang on every launch.
+
+#ifndef VK_PIPELINE_CACHE_H
+#define VK_PIPELINE_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// ncnn
+#include "gpu.h"
+
+// What a saved cache is valid for. The driver checks its own header too,
+// but some accept stale data, so a mismatch here discards the file first.
+struct PipelineCacheKey {
+  uint32_t vendor_id = 0;
+  uint32_t device_id = 0;
+  uint32_t driver_version = 0;
+  uint8_t uuid[16] = {}; // VkPhysicalDeviceProperties::pipelineCacheUUID
+};
+
+// File under dir holding the cache for key. One per device and driver,
+// shared by every model: a model loaded after another in the same run gets
+// the shaders they share from ncnn's in-memory pipeline cache, without the
+// driver, so a file per model would miss them. Each save keeps what the
+// file was restored from, so models add to it rather than replace it.
+std::string pipeline_cache_path(const std::string &dir,
+                                const PipelineCacheKey &key);
+
+// Serialized file: a header with key, size and checksum, then data.
+std::string encode_pipeline_cache(const PipelineCacheKey &key,
+                                  const void *data, size_t size);
+
+// Extracts the driver data from file bytes written for key. Returns 0, or -1
+// when they were written for another key, are truncated or corrupted.
+int decode_pipeline_cache(const std::string &bytes,
+                          const PipelineCacheKey &key, std::string &data);
+
+#if NCNN_VULKAN
+// Routes ncnn's pipeline creation through the hook that begun caches
+// use. Call right after every ncnn::create_gpu_instance(), before anything
+// creates pipelines: a new instance reloads ncnn's function pointers, and
+// the pointer is only written then, never while other threads may call it.
+void install_pipeline_cache_hook();
+
+// A VkPipelineCache restored from dir. While begun, the pipelines ncnn
+// creates on the calling thread for vkdev go through it; ncnn itself passes
+// no cache, and other threads' pipelines are left alone. Needs
+// install_pipeline_cache_hook(). Pipelines do not need their cache once
+// created, so it can go as soon as the net is loaded. Create it only once
+// the previous load has saved, so it starts from that load's pipelines.
+class PersistentPipelineCache {
+public:
+  PersistentPipelineCache(const ncnn::VulkanDevice *vkdev,
+                          const std::string &dir);
+  ~PersistentPipelineCache();
+
+  // Routes this thread's pipeline creation through the cache until end().
+  void begin();
+  void end();
+
+  // Writes the cache back to dir if it gained pipelines. Returns 0, or -1.
+  int save();
+
+  // Started from a valid file: loading pipelines should skip compilation
+  bool restored() const { return restored_bytes > 0; }
+  size_t restored_size() const { return restored_bytes; }
+  // Created by the driver while begun. Pipelines ncnn already holds from
+  // an earlier load in this run are not counted.
+  int pipelines() const { return created; }
+
+private:
+  PersistentPipelineCache(const PersistentPipelineCache &) = delete;
+  PersistentPipelineCache &
+  operator=(const PersistentPipelineCache &) = delete;
+
+  friend void install_pipeline_cache_hook();
+
+  // Installed as ncnn::vkCreateComputePipelines
+  static VKAPI_ATTR VkResult VKAPI_CALL create_compute_pipelines(
+      VkDevice device, VkPipelineCache pipeline_cache, uint32_t count,
+      const VkComputePipelineCreateInfo *infos,
+      const VkAllocationCallbacks *allocator, VkPipeline *pipelines);
+
+  VkDevice device = 0;
+  VkPipelineCache cache = 0;
+  std::string path; // empty when persistence is off
+  PipelineCacheKey key;
+  size_t restored_bytes = 0;
+  int created = 0;
+};
+#endif // NCNN_VULKAN
+
+#endif // VK_PIPELINE_CACHE_H
@@ -1,48 +1,116 @@
 #include "waifu2x.h"
+#include "blob_pool.h"
+#include "datareader.h"
+#include "model_geometry.h"
+#include "native_log.h"
+#include "partial_results.h"
+#include "pixel_kernels.h"
 #include "shaders.h"
+#include "tile_cache.h"
+#include "tile_order.h"
+#include "vk_pipeline_cache.h"
+#include "worker_pool.h"
 #include <algorithm>
-#include <android/log.h>
 #include <chrono>
+#include <cmath>
+#include <cstdio>
 #include <cstring>
-#include <deque>
-#include <future>
-#include <sys/system_properties.h>
+#include <memory>
 #include <thread>
 #include <vector>
 
 #define TAG "Waifu2xNative"
-#define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, TAG, __VA_ARGS__)
-#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, TAG, __VA_ARGS__)
+#define LOGD(...) NATIVE_LOGD(TAG, __VA_ARGS__)
+#define LOGE(...) NATIVE_LOGE(TAG, __VA_ARGS__)
 
 Waifu2x::Waifu2x(int gpuid, bool _tta_mode, int num_threads) {
+#if NCNN_VULKAN
   vkdev = gpuid == -1 ? 0 : ncnn::get_gpu_device(gpuid);
-  net.opt.num_threads = num_threads;
   waifu2x_preproc = 0;
   waifu2x_postproc = 0;
   waifu2x_preproc_tta = 0;
   waifu2x_postproc_tta = 0;
-  bicubic_2x = 0;
+  blob_vkallocator = 0;
+  workspace_vkallocator = 0;
+  staging_vkallocator = 0;
+#else
+  (void)gpuid; // CPU-only ncnn build
+#endif
+  net.opt.num_threads = num_threads;
+  blob_pool = 0;
+  workspace_pool = 0;
+  for (ncnn::Layer *&interp : alpha_interp)
+    interp = 0;
+  writeback_pool = 0;
+  inference_pool = 0;
+  cpu_threads = num_threads;
+  model_id = 0;
+  model_offset = 0;
+  model_alignment = 1;
   tta_mode = _tta_mode;
   noise = 0;
   scale = 2;
   tilesize = 128;  // Balanced speed and memory
-  prepadding = 18; // Slightly reduced padding for speed, safe for 256 tile size
-  progress_ptr = nullptr;
+  prepadding = 18; // replaced by the model's halo in load()
 }
 
 Waifu2x::~Waifu2x() {
+#if NCNN_VULKAN
   delete waifu2x_preproc;
   delete waifu2x_postproc;
   delete waifu2x_preproc_tta;
   delete waifu2x_postproc_tta;
-  if (bicubic_2x) {
-    bicubic_2x->destroy_pipeline(net.opt);
-    delete bicubic_2x;
+#endif
+  for (ncnn::Layer *interp : alpha_interp) {
+    if (interp) {
+      interp->destroy_pipeline(net.opt);
+      delete interp;
+    }
   }
+  delete writeback_pool;
+  delete inference_pool;
+
+  // No blob outlives process(), so the pools can go before the net
+  net.opt.blob_allocator = 0;
+  net.opt.workspace_allocator = 0;
+  delete blob_pool;
+  delete workspace_pool;
+#if NCNN_VULKAN
+  net.opt.blob_vkallocator = 0;
+  net.opt.workspace_vkallocator = 0;
+  net.opt.staging_vkallocator = 0;
+  delete blob_vkallocator;
+  delete workspace_vkallocator;
+  delete staging_vkallocator;
+#endif
 }
 
 int Waifu2x::load(const std::string &parampath, const std::string &modelpath) {
+  ModelData param;
+  ModelData model;
+  if (param.map_file(parampath) != 0) {
+    LOGE("Failed to load param: %s", parampath.c_str());
+    return -1;
+  }
+  if (model.map_file(modelpath) != 0) {
+    LOGE("Failed to load model: %s", modelpath.c_str());
+    return -1;
+  }
+  return load(param, std::move(model), parampath + "\n" + modelpath);
+}
+
+int Waifu2x::load(const ModelData &param, ModelData &&model,
+                  const std::string &name) {
+  using clock = std::chrono::steady_clock;
+  const clock::time_point t_start = clock::now();
+  load_stats = ModelLoadStats();
+  load_stats.rss_before = process_rss_bytes();
+
+#if NCNN_VULKAN
   net.opt.use_vulkan_compute = vkdev ? true : false;
+#else
+  net.opt.use_vulkan_compute = false;
+#endif
   net.opt.use_fp16_packed = true;  // Disable FP16 packed
   net.opt.use_fp16_storage = true; // Disable FP16 storage
 
@@ -56,267 +124,1044 @@ int Waifu2x::load(const std::string &parampath, const std::string &modelpath) {
   net.opt.use_local_pool_allocator = true; // Better memory allocation
   net.opt.use_shader_local_memory = true;  // Use shader local memory
 
-  net.opt.num_threads = 3; // Optimized for Snapdragon multi-core architecture
-
   // Hardware-specific optimizations are already set in constructor
   // (use_subgroup_ops, use_cooperative_matrix, num_threads)
   // No need to override them here
 
+#if NCNN_VULKAN
   net.set_vulkan_device(vkdev);
-
-  if (net.load_param(parampath.c_str()) != 0) {
-    LOGE("Failed to load param: %s", parampath.c_str());
+#endif
+
+  // The text parser needs a terminated string; the param is a few KB
+  const std::string param_text = param.text();
+
+#if NCNN_VULKAN
+  // Pipelines are created from here to the end of the Interp setup. They
+  // come from the on-disk cache when pipeline_cache_dir has one for this
+  // device, and go back to it otherwise.
+  std::unique_ptr<PersistentPipelineCache> pipeline_cache;
+  if (vkdev) {
+    pipeline_cache.reset(
+        new PersistentPipelineCache(vkdev, pipeline_cache_dir));
+    pipeline_cache->begin();
+  }
+#endif
+  if (net.load_param_mem(param_text.c_str()) != 0) {
+    LOGE("Failed to load param of %s", name.c_str());
     return -1;
   }
-  if (net.load_model(modelpath.c_str()) != 0) {
-    LOGE("Failed to load model: %s", modelpath.c_str());
+  // Weights are read straight from the caller's bytes, and ncnn references
+  // the ones it can use as they are instead of copying them, so the bytes
+  // are kept for as long as the net
+  const unsigned char *mem = model.data();
+  const ncnn::DataReaderFromMemory reader(mem);
+  if (net.load_model(reader) != 0) {
+    LOGE("Failed to load model of %s", name.c_str());
     return -1;
   }
+  weights = std::move(model);
+  load_stats.weight_bytes = weights.size();
+  load_stats.weights_in_place = weights.in_place();
+
+  // Halo and output crop come from the graph: conv kernels, strides,
+  // deconvolutions and crops. Without them (unknown layer types) keep the
+  // caller's prepadding and assume the output covers the whole input tile.
+  ModelGeometry geo;
+  if (parse_model_geometry(param_text, geo) == 0) {
+    if (geo.scale != scale) {
+      LOGE("Model %s upscales %dx but scale is %d", name.c_str(), geo.scale,
+           scale);
+      return -1;
+    }
+    prepadding = geo.halo;
+    model_offset = geo.offset;
+    model_alignment = geo.alignment;
+    LOGD("Model geometry: halo %d, crop %d, alignment %d, receptive radius "
+         "%.2f",
+         geo.halo, geo.offset, geo.alignment, geo.receptive_radius);
+  } else {
+    model_offset = 0;
+    model_alignment = 1;
+    LOGE("Cannot derive tile geometry of %s, using prepadding %d",
+         name.c_str(), prepadding);
+  }
+
+  // Tile cache entries from different models must never match
+  {
+    std::string id = name + (tta_mode ? "\ntta" : "");
+    uint64_t h[2];
+    hash128(id.data(), id.size(), nullptr, h);
+    model_id = h[0];
+  }
+  // Latency history of the previous model says nothing about this one
+  governor.reset();
 
   // No custom shaders for now - just use the model directly
   // The preproc/postproc will be handled in CPU
 
-  // Create interp layer for bicubic alpha scaling
-  bicubic_2x = ncnn::create_layer("Interp");
-  if (!bicubic_2x) {
-    LOGE("Failed to create Interp layer!");
-    return -1;
+  // Bicubic Interp layers for alpha, one per supported scale, built once
+  // here so process() never creates or destroys a pipeline. Scale 1 models
+  // copy alpha through.
+  for (int s = 2; s <= kMaxAlphaScale; s++) {
+    if (alpha_interp[s])
+      continue;
+    ncnn::Layer *interp = ncnn::create_layer("Interp");
+    if (!interp) {
+      LOGE("Failed to create Interp layer!");
+      return -1;
+    }
+#if NCNN_VULKAN
+    interp->vkdev = vkdev;
+#endif
+    ncnn::ParamDict pd;
+    pd.set(0, 3);        // bicubic
+    pd.set(1, (float)s); // height scale
+    pd.set(2, (float)s); // width scale
+    interp->load_param(pd);
+    if (interp->create_pipeline(net.opt) != 0) {
+      LOGE("Failed to create Interp pipeline for %dx", s);
+      delete interp;
+      return -1;
+    }
+    alpha_interp[s] = interp;
   }
 
-  bicubic_2x->vkdev = vkdev;
-  ncnn::ParamDict pd;
-  pd.set(0, 3); // bicubic
-  pd.set(1, 2.f);
-  pd.set(2, 2.f);
-  bicubic_2x->load_param(pd);
-  if (bicubic_2x->create_pipeline(net.opt) != 0) {
-    LOGE("Failed to create Interp pipeline");
-    return -1;
+#if NCNN_VULKAN
+  if (pipeline_cache) {
+    pipeline_cache->end();
+    pipeline_cache->save();
+    load_stats.pipelines_restored = pipeline_cache->restored();
+    load_stats.pipelines_created = pipeline_cache->pipelines();
+  }
+#endif
+
+  // Engine-owned allocators replace the per-extractor ones ncnn would
+  // otherwise create and drop for every tile. Set after load_model() so
+  // weights stay on the default allocator.
+  if (!blob_pool) {
+    blob_pool = new BlobPool;
+    workspace_pool = new BlobPool;
+  }
+  net.opt.blob_allocator = blob_pool;
+  net.opt.workspace_allocator = workspace_pool;
+#if NCNN_VULKAN
+  if (vkdev && !blob_vkallocator) {
+    blob_vkallocator = new CountingVkAllocator<ncnn::VkBlobAllocator>(vkdev);
+    workspace_vkallocator =
+        new CountingVkAllocator<ncnn::VkBlobAllocator>(vkdev);
+    staging_vkallocator =
+        new CountingVkAllocator<ncnn::VkStagingAllocator>(vkdev);
+  }
+  net.opt.blob_vkallocator = blob_vkallocator;
+  net.opt.workspace_vkallocator = workspace_vkallocator;
+  net.opt.staging_vkallocator = staging_vkallocator;
+#endif
+
+  // Persistent write-back workers, reused for every image. Two queued tiles
+  // per worker keep them busy while bounding output tiles held in memory.
+  if (!writeback_pool) {
+    writeback_pool = new WorkerPool(writeback_threads, 2 * writeback_threads);
   }
 
+  // Concurrent CPU extractors, each given an equal slice of the thread
+  // budget. A wave of tiles is queued at once, so the queue holds one tile
+  // per worker.
+  const int workers =
+      net.opt.use_vulkan_compute ? 1 : std::max(inference_workers, 1);
+  net.opt.num_threads = std::max(cpu_threads / workers, 1);
+  if (inference_pool && inference_pool->size() != workers) {
+    delete inference_pool;
+    inference_pool = 0;
+  }
+  if (workers > 1 && !inference_pool) {
+    inference_pool = new WorkerPool(workers, workers);
+  }
+
+  load_stats.load_ms =
+      std::chrono::duration<double, std::milli>(clock::now() - t_start)
+          .count();
+  load_stats.rss_after = process_rss_bytes();
+  LOGD("Loaded %s in %.1f ms: %zu KB of weights%s, RSS %zu -> %zu KB, "
+       "%d pipelines%s",
+       name.c_str(), load_stats.load_ms, load_stats.weight_bytes / 1024,
+       load_stats.weights_in_place ? " in place" : "",
+       load_stats.rss_before / 1024, load_stats.rss_after / 1024,
+       load_stats.pipelines_created,
+       load_stats.pipelines_restored ? " from the disk cache" : "");
   return 0;
 }
 
-int Waifu2x::process(const ncnn::Mat &inimage, void *out_pixels, int out_stride,
-                     std::unique_lock<std::mutex> &lock,
-                     std::atomic<int> *progress_ptr) const {
-  // Input: planar RGBA float Mat with values 0-255 from from_pixels
-  // inimage has dims=3, w=width, h=height, c=4 (RGBA)
+namespace {
 
-  int orig_w = inimage.w;
-  int orig_h = inimage.h;
+// A network output tile placed on the target image: target pixel (X, Y) is
+// column X - x0, row Y - y0 of mat. Empty when the tile failed.
+struct PlacedTile {
+  ncnn::Mat mat;
+  int x0 = 0;
+  int y0 = 0;
 
-  // Use original resolution for full quality per user request
-  const ncnn::Mat &work_img = inimage;
+  const float *row(int c, int X, int Y) const {
+    return mat.channel(c).row(Y - y0) + (X - x0);
+  }
+};
+
+// Weight of the later tile at target coordinate v of a blend zone
+// [z0, z0 + len): 0 before it, 1 after it, linear in between.
+inline float blend_ramp(int v, int z0, int len) {
+  if (v < z0)
+    return 0.f;
+  if (v >= z0 + len)
+    return 1.f;
+  return (v - z0 + 0.5f) / len;
+}
 
-  int w = work_img.w;
-  int h = work_img.h;
-  int target_w = w * scale;
-  int target_h = h * scale;
+// Writes target rectangle [x0, x1) x [y0, y1) for tiles[0], feather-blending
+// it with its left, top and top-left neighbours (tiles[1..3]) across the
+// vertical zone starting at target column zx and the horizontal one starting
+// at row zy, both zone pixels wide. Missing neighbours drop out and their
+// weight goes to the others. Rows and columns past both zones come straight
+// from tiles[0].
+void write_blended(const PlacedTile tiles[4], int x0, int x1, int y0, int y1,
+                   int zx, int zy, int zone, const ncnn::Mat &alpha,
+                   bool grayscale, unsigned char *out, int out_stride,
+                   ncnn::Allocator *allocator) {
+  const int n = x1 - x0;
+  ncnn::Mat blended(n, 1, 3, (size_t)4u, allocator);
+  float *bgr[3] = {blended.channel(0), blended.channel(1),
+                   blended.channel(2)};
+
+  for (int Y = y0; Y < y1; Y++) {
+    const float wy = blend_ramp(Y, zy, zone);
+    // Columns [0, split) need blending
+    int split = std::min(std::max(zx + zone - x0, 0), n);
+    if (wy < 1.f)
+      split = n;
+
+    for (int j = 0; j < split; j++) {
+      const int X = x0 + j;
+      const float wx = blend_ramp(X, zx, zone);
+      const float weight[4] = {wx * wy, (1.f - wx) * wy, wx * (1.f - wy),
+                               (1.f - wx) * (1.f - wy)};
+      float sum = 0.f;
+      float acc[3] = {0.f, 0.f, 0.f};
+      for (int k = 0; k < 4; k++) {
+        if (tiles[k].mat.empty() || weight[k] <= 0.f)
+          continue;
+        sum += weight[k];
+        for (int c = 0; c < 3; c++)
+          acc[c] += weight[k] * *tiles[k].row(c, X, Y);
+      }
+      for (int c = 0; c < 3; c++)
+        bgr[c][j] = sum > 0.f ? acc[c] / sum : 0.f;
+    }
 
-  LOGD("Processing image %dx%d (orig %dx%d) -> %dx%d", w, h, orig_w, orig_h,
-       target_w, target_h);
+    unsigned char *dst = out + (size_t)Y * out_stride + (size_t)x0 * 4;
+    const unsigned char *a =
+        alpha.empty() ? nullptr : alpha.row<const unsigned char>(Y - y0);
+    planar_bgr_to_rgba_row(bgr[0], bgr[1], bgr[2], a, dst, split, grayscale);
+    if (split < n) {
+      planar_bgr_to_rgba_row(tiles[0].row(0, x0 + split, Y),
+                             tiles[0].row(1, x0 + split, Y),
+                             tiles[0].row(2, x0 + split, Y),
+                             a ? a + split : nullptr, dst + split * 4,
+                             n - split, grayscale);
+    }
+  }
+}
 
-  // Normalization using work_img
-  ncnn::Mat rgb_normalized(w, h, 3);
-  bool is_grayscale = true;
+} // namespace
+
+void Waifu2x::tile_geometry(int tile_size, int &padding, int &overlap,
+                            int &in_tile_size) const {
+  // A prepadding below the network's own crop would leave holes. Blend mode
+  // gives each tile only that crop plus the overlap it shares with its
+  // neighbours, and feathers the overlaps instead.
+  const bool blend = seam_mode == SEAM_BLEND;
+  overlap = blend ? std::min(std::max(blend_overlap, 0), tile_size / 2) : 0;
+  padding =
+      blend ? model_offset + overlap : std::max(prepadding, model_offset);
+
+  // Every tile fed to the network has the same shape, so ncnn reuses one set
+  // of workspaces and pooled buffers for all tiles of all pages. The tile
+  // grows until tile + 2 * padding is a multiple of the model's alignment.
+  in_tile_size = tile_size + 2 * padding;
+  in_tile_size = (in_tile_size + model_alignment - 1) / model_alignment *
+                 model_alignment;
+}
 
-  // Channel mapping from work_img
-  const float *in_r = work_img.channel(0);
-  const float *in_g = work_img.channel(1);
-  const float *in_b = work_img.channel(2);
+int Waifu2x::warm_up() {
+  using clock = std::chrono::steady_clock;
+  const clock::time_point t_start = clock::now();
+  int padding;
+  int overlap;
+  int in_tile_size;
+  tile_geometry(std::max(tilesize.load(), 1), padding, overlap,
+                in_tile_size);
+
+  // A ramp, so nothing in the network sees a degenerate all-equal input
+  ncnn::Mat in(in_tile_size, in_tile_size, 3, (size_t)4u, blob_pool);
+  for (int c = 0; c < 3; c++) {
+    float *p = in.channel(c);
+    for (int i = 0; i < in_tile_size * in_tile_size; i++)
+      p[i] = (float)((i + c * 85) % 256) / 255.f;
+  }
 
-  float *out_b = rgb_normalized.channel(0); // B goes to channel 0
-  float *out_g = rgb_normalized.channel(1); // G stays at channel 1
-  float *out_r = rgb_normalized.channel(2); // R goes to channel 2
+  std::unique_lock<std::mutex> gpu_lock(gpu_mutex, std::defer_lock);
+  if (net.opt.use_vulkan_compute)
+    gpu_lock.lock();
+  ncnn::Mat out;
+  {
+    ncnn::Extractor ex = net.create_extractor();
+    ex.set_light_mode(true);
+    ex.input(net.input_indexes()[0], in);
+    if (ex.extract(net.output_indexes()[net.output_indexes().size() - 1],
+                   out) != 0) {
+      LOGE("Warm-up inference failed");
+      return -1;
+    }
+  }
+  load_stats.warm_up_ms =
+      std::chrono::duration<double, std::milli>(clock::now() - t_start)
+          .count();
+  LOGD("Warmed up on a %dx%d tile in %.1f ms", in_tile_size, in_tile_size,
+       load_stats.warm_up_ms);
+  return 0;
+}
 
-  const float norm = 1.0f / 255.0f;
+int Waifu2x::max_concurrent_calls() const {
+  if (net.opt.use_vulkan_compute)
+    return 1;
+  const int cores = (int)std::thread::hardware_concurrency();
+  return std::max(cores / std::max(cpu_threads, 1), 1);
+}
 
-  // Robust grayscale detection: allow up to 0.5% of pixels to be "colorful"
-  // (noise tolerance)
-  int color_pixel_count = 0;
-  int color_threshold_count = w * h / 200; // 0.5%
-
-  for (int i = 0; i < w * h; i++) {
-    // Detect if pixel has significant color
-    if (std::abs(in_r[i] - in_g[i]) > 5.0f ||
-        std::abs(in_r[i] - in_b[i]) > 5.0f) {
-      color_pixel_count++;
-    }
+size_t Waifu2x::resident_bytes() const {
+  size_t bytes = load_stats.weight_bytes;
+  if (blob_pool)
+    bytes += blob_pool->stats().bytes;
+  if (workspace_pool)
+    bytes += workspace_pool->stats().bytes;
+  return bytes;
+}
 
-    out_b[i] = in_b[i] * norm;
-    out_g[i] = in_g[i] * norm;
-    out_r[i] = in_r[i] * norm;
-  }
+int Waifu2x::process(const unsigned char *in_pixels, int w, int h,
+                     int in_stride, const ProcessContext &ctx) const {
+  // Input: packed RGBA8 pixels (Android bitmap layout), read in place. Tiles
+  // are gathered straight from it, so no full-size float copy of the image
+  // is ever made; see the row band loop below.
+  void *const out_pixels = ctx.out_pixels;
+  const int out_stride = ctx.out_stride;
+  const int tile_size = std::max(tilesize.load(), 1);
+
+  using clock = std::chrono::steady_clock;
+  auto ms_since = [](clock::time_point t0) {
+    return std::chrono::duration<double, std::milli>(clock::now() - t0)
+        .count();
+  };
+  const clock::time_point t_start = clock::now();
 
-  if (color_pixel_count > color_threshold_count) {
-    is_grayscale = false;
-  }
+  int target_w = w * scale;
+  int target_h = h * scale;
+
+  LOGD("Processing image %dx%d -> %dx%d", w, h, target_w, target_h);
 
-  if (disable_grayscale_check) {
-    is_grayscale = false;
+  // Robust grayscale detection: allow up to 0.5% of pixels to be "colorful"
+  // (noise tolerance)
+  bool is_grayscale = false;
+  if (!disable_grayscale_check) {
+    is_grayscale = rgba_is_grayscale(in_pixels, w, h, in_stride, w * h / 200);
   }
 
   if (is_grayscale)
     LOGD("Grayscale image detected, forcing pure grayscale output.");
 
-  // PRE-PROCESS ALPHA CHANNEL (moved to start)
-  // We need full alpha map to merge tiles on the fly
-  ncnn::Mat alpha_out;
-  bool has_alpha = (inimage.c >= 4);
-  const float *alpha_data = nullptr;
-
-  if (has_alpha) {
-    ncnn::Mat alpha_in = inimage.channel_range(3, 1);
-    if (scale == 2) {
-      bicubic_2x->forward(alpha_in, alpha_out, net.opt);
-    } else {
-      // For 3x/4x, use bicubic interpolation (same quality as 2x)
-      // Create dynamic Interp layer with correct scale factor
-      ncnn::Layer *interp = ncnn::create_layer("Interp");
-      if (interp) {
-        interp->vkdev = vkdev;
-        ncnn::ParamDict pd;
-        pd.set(0, 3);            // bicubic interpolation
-        pd.set(1, (float)scale); // width scale
-        pd.set(2, (float)scale); // height scale
-        interp->load_param(pd);
-        interp->create_pipeline(net.opt);
-        interp->forward(alpha_in, alpha_out, net.opt);
-        interp->destroy_pipeline(net.opt);
-        delete interp;
-      } else {
-        // Fallback to bilinear if layer creation fails
-        ncnn::resize_bilinear(alpha_in, alpha_out, target_w, target_h, net.opt);
-      }
+  const double preprocess_ms = ms_since(t_start);
+
+  // Alpha is upscaled per tile inside the write-back tasks, from a small
+  // window of the input and only where it is not fully opaque (nearly every
+  // manga page is). Interp runs single-threaded there so concurrent tasks do
+  // not oversubscribe the cores.
+  const ncnn::Layer *interp =
+      scale >= 2 && scale <= kMaxAlphaScale ? alpha_interp[scale] : nullptr;
+  ncnn::Option alpha_opt = net.opt;
+  alpha_opt.num_threads = 1;
+  alpha_opt.use_vulkan_compute = false;
+
+  // Returns the alpha of input tile (x, y, tw, th) at target resolution as
+  // 8-bit rows, or an empty Mat when every output pixel would be 255.
+  // Bicubic reads two input pixels past each output pixel, so the window
+  // gets a two-pixel halo (clamped to the image) and matches a whole-image
+  // upscale up to float rounding.
+  auto upscale_tile_alpha = [=](int x, int y, int tw, int th) {
+    const int wx0 = std::max(x - 2, 0);
+    const int wy0 = std::max(y - 2, 0);
+    const int wx1 = std::min(x + tw + 2, w);
+    const int wy1 = std::min(y + th + 2, h);
+    if (rgba_window_is_opaque(in_pixels, in_stride, wx0, wy0, wx1 - wx0,
+                              wy1 - wy0))
+      return ncnn::Mat();
+
+    ncnn::Mat window(wx1 - wx0, wy1 - wy0, (size_t)4u, blob_pool);
+    const float norm = 1.0f / 255.0f;
+    for (int wy = wy0; wy < wy1; wy++) {
+      const unsigned char *src =
+          in_pixels + (size_t)wy * in_stride + (size_t)wx0 * 4 + 3;
+      float *dst = window.row(wy - wy0);
+      for (int i = 0; i < wx1 - wx0; i++)
+        dst[i] = src[i * 4] * norm;
     }
-    alpha_data = (const float *)alpha_out.data;
-  }
-
-  // Tiling parameters
-  const int TILE_SIZE_X = tilesize;
-  const int TILE_SIZE_Y = tilesize;
 
-  // Create padded input to handle borders easily
-  ncnn::Mat padded_input;
-  ncnn::copy_make_border(rgb_normalized, padded_input, prepadding, prepadding,
-                         prepadding, prepadding, ncnn::BORDER_REPLICATE, 0.f,
-                         net.opt);
+    ncnn::Mat upscaled = window;
+    if (interp) {
+      interp->forward(window, upscaled, alpha_opt);
+    } else if (scale != 1) {
+      ncnn::resize_bilinear(window, upscaled, window.w * scale,
+                            window.h * scale, alpha_opt);
+    }
 
-  // NO huge model_out allocation needed anymore!
+    const int out_w = std::min(tw * scale, target_w - x * scale);
+    const int out_h = std::min(th * scale, target_h - y * scale);
+    const int ox = (x - wx0) * scale;
+    const int oy = (y - wy0) * scale;
+    ncnn::Mat alpha(out_w, out_h, (size_t)1u, blob_pool);
+    for (int i = 0; i < out_h; i++)
+      unit_to_u8_row(upscaled.row(oy + i) + ox, alpha.row<unsigned char>(i),
+                     out_w);
+    return alpha;
+  };
+
+  const bool blend = seam_mode == SEAM_BLEND;
+  int padding;
+  int overlap;
+  int in_tile_size;
+  tile_geometry(tile_size, padding, overlap, in_tile_size);
+
+  // Last tiles shift inward to end at the image edge (images smaller than a
+  // tile are padded by replicating the border), and each tile writes only
+  // the output no earlier tile has written. Blend mode keeps the regular
+  // grid and pads instead, so every blend zone is 2 * overlap wide.
+  const int TILE_SIZE_X = in_tile_size - 2 * padding;
+  const int TILE_SIZE_Y = TILE_SIZE_X;
+  const int in_tile_w = in_tile_size;
+  const int in_tile_h = in_tile_size;
 
   const int xtiles = (w + TILE_SIZE_X - 1) / TILE_SIZE_X;
   const int ytiles = (h + TILE_SIZE_Y - 1) / TILE_SIZE_Y;
+  const int ntiles = xtiles * ytiles;
+
+  // Tiles run viewport first, so a tall strip or zoomed page shows the part
+  // on screen early. Blend mode needs each tile's left and upper neighbours
+  // first and keeps raster order; its viewport is still reported.
+  std::vector<int> order;
+  const int viewport_tiles = order_tiles(xtiles, ytiles, TILE_SIZE_X,
+                                         TILE_SIZE_Y, w, h, ctx.viewport,
+                                         order);
+  std::vector<unsigned char> in_viewport(ntiles, 0);
+  for (int n = 0; n < viewport_tiles; n++)
+    in_viewport[order[n]] = 1;
+  if (blend) {
+    for (int t = 0; t < ntiles; t++)
+      order[t] = t;
+  }
 
-  // Future for the background CPU conversion tasks (Buffered Pipeline)
-  // Depth 32 allows GPU to run way ahead of CPU.
-  std::deque<std::future<void>> pipeline;
+  // Output a tile owns, [r[0], r[2]) x [r[1], r[3]): its own cells, or in
+  // blend mode from the start of its left and top blend zones up to the
+  // start of its right and bottom ones. Together they cover the output once.
+  auto tile_rect = [=](int t, int r[4]) {
+    const int xi = t % xtiles;
+    const int yi = t / xtiles;
+    const int x = xi * TILE_SIZE_X;
+    const int y = yi * TILE_SIZE_Y;
+    const int x0 = blend && xi > 0 ? x - overlap : x;
+    const int y0 = blend && yi > 0 ? y - overlap : y;
+    const int x1 = xi == xtiles - 1 ? w : x + TILE_SIZE_X - overlap;
+    const int y1 = yi == ytiles - 1 ? h : y + TILE_SIZE_Y - overlap;
+    r[0] = x0 * scale;
+    r[1] = y0 * scale;
+    r[2] = std::min(x1 * scale, target_w);
+    r[3] = std::min(y1 * scale, target_h);
+  };
+
+  // Tells a progressive-output reader which part of the output changed
+  auto post_dirty = [&ctx](const int r[4]) {
+    if (!ctx.dirty_rects)
+      return;
+    DirtyRect rect;
+    rect.x = r[0];
+    rect.y = r[1];
+    rect.w = r[2] - r[0];
+    rect.h = r[3] - r[1];
+    if (!ctx.dirty_rects->push(rect) && ctx.dirty_overflow)
+      ctx.dirty_overflow->store(true);
+  };
+
+  // Time spent inside write-back tasks. Declared before the batch so they
+  // outlive any task still running when we return early.
+  std::atomic<long long> writeback_us{0};
+  std::atomic<long long> alpha_us{0};
+  std::atomic<int> alpha_tiles{0};
+  double inference_ms = 0;
+  int skipped_tiles = 0;
+  int cache_hits = 0;
+  std::vector<float> tile_latency_ms;
+  // Blend mode: outputs of the previous and current tile rows, which later
+  // tiles blend with
+  std::vector<PlacedTile> prev_row(blend ? xtiles : 0);
+  std::vector<PlacedTile> cur_row(blend ? xtiles : 0);
+
+  auto tile_alpha = [&](int x, int y, int tw, int th) {
+    const clock::time_point t_alpha = clock::now();
+    ncnn::Mat alpha = upscale_tile_alpha(x, y, tw, th);
+    if (!alpha.empty())
+      alpha_tiles++;
+    alpha_us += (long long)(ms_since(t_alpha) * 1000.0);
+    return alpha;
+  };
+
+  if (net.input_indexes().empty() || net.output_indexes().empty()) {
+    LOGE("Model has no inputs or outputs!");
+    return -1;
+  }
 
-  for (int yi = 0; yi < ytiles; yi++) {
-    for (int xi = 0; xi < xtiles; xi++) {
-      int x = xi * TILE_SIZE_X;
-      int y = yi * TILE_SIZE_Y;
+  // Checked before every wave, by each inference worker and at the start of
+  // every write-back task, so a cancelled call stops within one tile
+  auto cancelled = [&ctx]() {
+    return ctx.cancel && ctx.cancel->load(std::memory_order_relaxed);
+  };
+
+  // Pages flipped away from and back to are the same pixels, so a cancelled
+  // call's finished tiles are found again by content, not by page id
+  PartialResultKey partial_key;
+  if (partial_results) {
+    uint64_t *hash = partial_key.content;
+    hash[0] = (uint64_t)w;
+    hash[1] = (uint64_t)h;
+    for (int y = 0; y < h; y++)
+      hash128(in_pixels + (size_t)y * in_stride, (size_t)w * 4, hash, hash);
+    partial_key.model = model_id;
+    partial_key.w = w;
+    partial_key.h = h;
+    partial_key.scale = scale;
+    partial_key.tile_input_size = in_tile_size;
+    partial_key.prepadding = padding;
+    partial_key.blend_overlap = blend ? overlap : -1;
+    partial_key.flat_tile_tolerance = flat_tile_tolerance;
+    partial_key.grayscale_check = !disable_grayscale_check;
+  }
 
-      int w_tile = std::min(TILE_SIZE_X, w - x);
-      int h_tile = std::min(TILE_SIZE_Y, h - y);
+  // Progressive mode: a bilinear preview goes into the output in row bands
+  // on the write-back pool, before the call waits for its turn, so the page
+  // can be shown at once and tiles replace the preview as they finish
+  double preview_ms = 0;
+  if (ctx.progressive) {
+    const int bands = writeback_pool->size() * 2;
+    TileBatch preview(*writeback_pool, bands);
+    for (int b = 0; b < bands; b++) {
+      const int y0 = target_h * b / bands;
+      const int y1 = target_h * (b + 1) / bands;
+      preview.submit(b, [=]() {
+        upscale_rgba_bilinear_rows(in_pixels, w, h, in_stride, scale,
+                                   (unsigned char *)out_pixels, out_stride,
+                                   y0, y1);
+      });
+    }
+    preview.wait();
+    const int whole[4] = {0, 0, target_w, target_h};
+    post_dirty(whole);
+    preview_ms = ms_since(t_start);
+  }
 
-      int in_tile_w = w_tile + 2 * prepadding;
-      int in_tile_h = h_tile + 2 * prepadding;
+  // Wait for this call's turn among the scheduled jobs
+  ScheduledJob turn(ctx.scheduler, ctx.job);
+  if (!turn.enter(ctx.cancel)) {
+    LOGD("Waifu2x process cancelled while queued");
+    return -1;
+  }
 
-      // Extract tile from padded_input
-      ncnn::Mat in_tile(in_tile_w, in_tile_h, 3);
-      for (int c = 0; c < 3; c++) {
-        const float *ptr = padded_input.channel(c).row(y) + x;
-        float *outptr = in_tile.channel(c);
+  // Pool counters are engine-wide: with concurrent calls, each call's deltas
+  // include the others' allocations
+  const BlobPoolStats blob_before = blob_pool->stats();
+  const BlobPoolStats workspace_before = workspace_pool->stats();
+#if NCNN_VULKAN
+  const uint64_t vk_before =
+      blob_vkallocator ? blob_vkallocator->requests +
+                             workspace_vkallocator->requests +
+                             staging_vkallocator->requests
+                       : 0;
+#endif
+
+  // One extractor per inference worker, cleared between tiles. Their blobs
+  // come from the engine's pools (see load()), which are thread-safe.
+  const int wave_size = inference_pool ? inference_pool->size() : 1;
+  std::vector<ncnn::Extractor> extractors;
+  extractors.reserve(wave_size);
+  for (int k = 0; k < wave_size; k++) {
+    extractors.push_back(net.create_extractor());
+    extractors.back().set_light_mode(true);
+  }
+  // On GPU engines their device blobs go back to the shared Vulkan
+  // allocators under gpu_mutex, on every exit path
+  struct ReleaseBlobs {
+    std::vector<ncnn::Extractor> &extractors;
+    std::mutex *gpu_mutex;
+    ~ReleaseBlobs() {
+      if (!gpu_mutex)
+        return;
+      std::lock_guard<std::mutex> guard(*gpu_mutex);
+      for (ncnn::Extractor &ex : extractors)
+        ex.clear();
+    }
+  } release_blobs{extractors,
+                  net.opt.use_vulkan_compute ? &gpu_mutex : nullptr};
+
+  // Tiles already in the output, flagged by their write-back task once it
+  // has written them. Resumed tiles are copied back up front and skipped;
+  // in blend mode those an unfinished neighbour blends with are inferred
+  // again, but not written.
+  // Output bytes of tile t, as kept in a PartialResult
+  auto tile_bytes = [&](int t) {
+    int r[4];
+    tile_rect(t, r);
+    return (size_t)(r[2] - r[0]) * 4 * (size_t)(r[3] - r[1]);
+  };
+  PartialResult partial;
+  size_t partial_bytes = 0;
+  if (partial_results && partial_results->take(partial_key, partial) &&
+      partial.done.size() == (size_t)ntiles) {
+    for (int t = 0; t < ntiles; t++)
+      partial_bytes += partial.done[t] ? tile_bytes(t) : 0;
+  }
+  if (partial_bytes > 0 && partial_bytes == partial.pixels.size()) {
+    const unsigned char *src = partial.pixels.data();
+    for (int t = 0; t < ntiles; t++) {
+      if (!partial.done[t])
+        continue;
+      int r[4];
+      tile_rect(t, r);
+      const size_t row_bytes = (size_t)(r[2] - r[0]) * 4;
+      for (int y = r[1]; y < r[3]; y++, src += row_bytes)
+        memcpy((unsigned char *)out_pixels + (size_t)y * out_stride + r[0] * 4,
+               src, row_bytes);
+    }
+    LOGD("Resuming from %d of %d finished tiles", partial.done_tiles(),
+         ntiles);
+    partial.pixels = std::vector<unsigned char>();
+  } else {
+    partial = PartialResult();
+    partial.done.assign(ntiles, 0);
+  }
+  const int resumed_tiles = partial.done_tiles();
+  std::vector<unsigned char> needed(ntiles, 1);
+  for (int t = 0; resumed_tiles > 0 && t < ntiles; t++) {
+    const bool right = t % xtiles < xtiles - 1;
+    const bool below = t + xtiles < ntiles;
+    needed[t] = !partial.done[t] ||
+                (blend && ((right && !partial.done[t + 1]) ||
+                           (below && !partial.done[t + xtiles]) ||
+                           (right && below && !partial.done[t + xtiles + 1])));
+  }
 
-        for (int i = 0; i < in_tile_h; i++) {
-          memcpy(outptr, ptr, in_tile_w * sizeof(float));
-          ptr += padded_input.w;
-          outptr += in_tile.w;
-        }
-      }
+  // Called once a tile's output is in place: by its write-back task, or
+  // right away for a resumed tile
+  std::atomic<int> viewport_done{0};
+  std::atomic<long long> viewport_us{0};
+  std::atomic<long long> first_tile_us{0};
+  // No tile on screen (no viewport, or one off the image): nothing to wait
+  // for
+  if (viewport_tiles == 0 && ctx.viewport_progress)
+    ctx.viewport_progress->store(100);
+  auto finish_tile = [&](int t) {
+    partial.done[t] = 1;
+    int r[4];
+    tile_rect(t, r);
+    post_dirty(r);
+    long long none = 0;
+    first_tile_us.compare_exchange_strong(
+        none, std::max((long long)(ms_since(t_start) * 1000.0), 1LL));
+    if (!in_viewport[t])
+      return;
+    const int n = ++viewport_done;
+    if (ctx.viewport_progress)
+      ctx.viewport_progress->store(n * 100 / std::max(viewport_tiles, 1));
+    if (n == viewport_tiles)
+      viewport_us = (long long)(ms_since(t_start) * 1000.0);
+  };
+
+  // Write-back runs on the engine's persistent pool; the batch waits for its
+  // tasks on every exit path. The pool's bounded queue lets the GPU run a few
+  // tiles ahead of the CPU without holding many output tiles in memory.
+  TileBatch batch(*writeback_pool, ntiles);
+  auto collect_completions = [&]() {
+    TileCompletion done;
+    while (batch.poll(done))
+      tile_latency_ms.push_back(done.latency_ms);
+  };
+
+  // On cancellation: lets started write-back tasks finish, then leaves the
+  // finished tiles for a later call on this page. Only their pixels are
+  // kept, as many as the store's budget holds, in raster order.
+  auto keep_partial = [&]() {
+    batch.wait();
+    if (!partial_results || partial.done_tiles() == 0)
+      return;
+    const size_t budget =
+        partial_results->stats().max_bytes - std::min(
+            partial_results->stats().max_bytes, partial.done.size());
+    size_t bytes = 0;
+    for (int t = 0; t < ntiles; t++) {
+      if (!partial.done[t])
+        continue;
+      if (bytes + tile_bytes(t) > budget)
+        partial.done[t] = 0; // redone by the next call
+      else
+        bytes += tile_bytes(t);
+    }
+    if (bytes == 0)
+      return;
+    partial.pixels.resize(bytes);
+    unsigned char *dst = partial.pixels.data();
+    for (int t = 0; t < ntiles; t++) {
+      if (!partial.done[t])
+        continue;
+      int r[4];
+      tile_rect(t, r);
+      const size_t row_bytes = (size_t)(r[2] - r[0]) * 4;
+      for (int y = r[1]; y < r[3]; y++, dst += row_bytes)
+        memcpy(dst,
+               (const unsigned char *)out_pixels + (size_t)y * out_stride +
+                   r[0] * 4,
+               row_bytes);
+    }
+    LOGD("Keeping %d of %d finished tiles, %zu KB", partial.done_tiles(),
+         ntiles, bytes / 1024);
+    partial_results->store(partial_key, std::move(partial));
+  };
+
+  // A tile of the current inference wave: planned and gathered on this
+  // thread, inferred by one of the extractors, written back in raster order.
+  struct TileJob {
+    int x = 0;
+    int y = 0;
+    int w_tile = 0;
+    int h_tile = 0;
+    int x_in = 0; // top-left of the full-size input tile
+    int y_in = 0;
+    bool flat = false;
+    unsigned char flat_rgb[3] = {0, 0, 0};
+    bool opaque = false;
+    bool resumed = false; // already in the output
+    bool infer = false;   // needs a network pass
+    TileCacheKey cache_key;
+    ncnn::Mat in_tile;
+    ncnn::Mat out_tile;
+  };
+  std::vector<TileJob> wave(wave_size);
+  int wave_begin = 0;
+  int wave_end = 0;
+  double busy_total_ms = 0; // network time of this call's waves
+  double wave_gap_ms = 0;   // governor pause after the current wave
+  double throttle_ms = 0;
+
+  // Plans, gathers and infers the next wave_size tiles. With several
+  // inference workers their forward passes run concurrently, one tile per
+  // extractor; everything else stays on this thread.
+  auto run_wave = [&]() {
+    const clock::time_point t_wave = clock::now();
+    wave_begin = wave_end;
+    wave_end = std::min(wave_begin + wave_size, ntiles);
+    for (int n = wave_begin; n < wave_end; n++) {
+      const int t = order[n];
+      TileJob &job = wave[n - wave_begin];
+      job = TileJob();
+      const int xi = t % xtiles;
+      const int yi = t / xtiles;
+      job.x = xi * TILE_SIZE_X;
+      job.y = yi * TILE_SIZE_Y;
+      job.w_tile = std::min(TILE_SIZE_X, w - job.x);
+      job.h_tile = std::min(TILE_SIZE_Y, h - job.y);
+      job.x_in =
+          blend ? job.x : std::max(std::min(job.x, w - TILE_SIZE_X), 0);
+      job.y_in =
+          blend ? job.y : std::max(std::min(job.y, h - TILE_SIZE_Y), 0);
+      job.resumed = partial.done[t];
+      if (!needed[t])
+        continue;
 
-      // Run inference on tile (GPU WORK)
-      ncnn::Mat out_tile;
-      {
-        ncnn::Extractor ex = net.create_extractor();
-        ex.set_light_mode(true);
-        if (net.input_indexes().empty() || net.output_indexes().empty()) {
-          LOGE("Model has no inputs or outputs!");
-          return -1;
+      // Blank paper, solid panels and letterbox bars: when the whole
+      // receptive field is one color the network reproduces that color, so
+      // fill the output directly and skip inference.
+      job.flat = flat_tile_tolerance >= 0 &&
+                 rgba_window_is_flat(in_pixels, w, h, in_stride,
+                                     job.x_in - padding, job.y_in - padding,
+                                     in_tile_w, in_tile_h,
+                                     flat_tile_tolerance, job.flat_rgb);
+      if (job.flat) {
+        skipped_tiles++;
+        if (is_grayscale) {
+          int sum = job.flat_rgb[0] + job.flat_rgb[1] + job.flat_rgb[2];
+          unsigned char gray = (unsigned char)((sum + 1) / 3);
+          job.flat_rgb[0] = job.flat_rgb[1] = job.flat_rgb[2] = gray;
+        }
+        if (blend) {
+          // Neighbours still need this tile's output for their seams, and
+          // it is exactly the flat color
+          const int out_size = (in_tile_size - 2 * model_offset) * scale;
+          job.out_tile.create(out_size, out_size, 3, (size_t)4u, blob_pool);
+          for (int c = 0; c < 3; c++)
+            job.out_tile.channel(c).fill(job.flat_rgb[2 - c] / 255.0f);
         }
-        ex.input(net.input_indexes()[0], in_tile);
-        ex.extract(net.output_indexes()[net.output_indexes().size() - 1],
-                   out_tile);
+        continue;
       }
 
-      if (out_tile.empty() || out_tile.c < 3) {
-        LOGE("Inference tile failed or invalid channels (c=%d) at %d,%d",
-             out_tile.c, xi, yi);
-        continue;
+      // Gather tile (with replicated border) straight from the RGBA8 input.
+      // An opaque window covering the two-pixel bicubic halo around what
+      // this tile writes means the upscaled alpha is 255 throughout, so the
+      // alpha pass is skipped.
+      job.in_tile.create(in_tile_w, in_tile_h, 3, (size_t)4u, blob_pool);
+      const unsigned char min_alpha =
+          gather_rgba_tile_bgr(in_pixels, w, h, in_stride, job.x_in - padding,
+                               job.y_in - padding, job.in_tile);
+      job.opaque = min_alpha == 255 && padding - overlap >= 2;
+
+      // Identical input windows recur across a chapter (borders, credit
+      // pages, recurring panels), so look the result up before inferring.
+      bool cache_hit = false;
+      if (tile_cache) {
+        hash_tile(job.in_tile, job.cache_key.content);
+        job.cache_key.model = model_id;
+        job.cache_key.scale = scale;
+        job.cache_key.prepadding = padding;
+        job.cache_key.w = in_tile_w;
+        job.cache_key.h = in_tile_h;
+        cache_hit = tile_cache->lookup(job.cache_key, job.out_tile);
+        if (cache_hit)
+          cache_hits++;
       }
+      job.infer = !cache_hit;
+    }
 
-      // Debug logging for first tile to diagnose x3/x4 issues
-      if (xi == 0 && yi == 0) {
-        int expected_w = (std::min(TILE_SIZE_X, w) + 2 * prepadding) * scale;
-        int expected_h = (std::min(TILE_SIZE_Y, h) + 2 * prepadding) * scale;
-        LOGD("Tile debug: scale=%d, prepadding=%d", scale, prepadding);
-        LOGD("  in_tile: %dx%dx%d", in_tile.w, in_tile.h, in_tile.c);
-        LOGD("  out_tile: %dx%dx%d (expected ~%dx%d)", out_tile.w, out_tile.h,
-             out_tile.c, expected_w, expected_h);
+    // Run inference on tiles (GPU WORK). Concurrent calls on a GPU engine
+    // take turns here, one wave at a time.
+    std::unique_lock<std::mutex> gpu_lock(gpu_mutex, std::defer_lock);
+    if (net.opt.use_vulkan_compute)
+      gpu_lock.lock();
+    const clock::time_point t_busy = clock::now();
+    auto infer = [&](int k) {
+      TileJob &job = wave[k];
+      if (cancelled())
+        return;
+      ncnn::Extractor &ex = extractors[k];
+      ex.clear();
+      ex.input(net.input_indexes()[0], job.in_tile);
+      ex.extract(net.output_indexes()[net.output_indexes().size() - 1],
+                 job.out_tile);
+      job.in_tile.release();
+    };
+    if (inference_pool) {
+      TileBatch inference(*inference_pool, wave_end - wave_begin);
+      for (int k = 0; k < wave_end - wave_begin; k++) {
+        if (wave[k].infer)
+          inference.submit(wave_begin + k, [&infer, k]() { infer(k); });
+      }
+      inference.wait();
+    } else if (wave[0].infer) {
+      infer(0);
+    }
+    if (gpu_lock.owns_lock())
+      gpu_lock.unlock();
+
+    // Pace the next wave by how long this one held the network, not
+    // counting the wait for the GPU
+    int inferred = 0;
+    for (int k = 0; k < wave_end - wave_begin; k++)
+      inferred += wave[k].infer;
+    const double busy_ms = inferred ? ms_since(t_busy) : 0;
+    if (ctx.ui_busy)
+      governor.set_ui_busy(ctx.ui_busy->load() != 0);
+    const GovernorDecision decision =
+        governor.on_wave(busy_ms, (long long)inferred * in_tile_w * in_tile_h);
+    if (decision.changed)
+      LOGD("Governor: duty %d%%, drift %.2f%s%s, gap %.1f ms", decision.duty,
+           decision.drift, decision.hot ? ", hot" : "",
+           decision.ui_busy ? ", UI busy" : "", decision.gap_ms);
+    busy_total_ms += busy_ms;
+    wave_gap_ms = decision.gap_ms;
+
+    for (int k = 0; k < wave_end - wave_begin; k++) {
+      const TileJob &job = wave[k];
+      if (job.infer && tile_cache && !job.out_tile.empty() &&
+          job.out_tile.c >= 3)
+        tile_cache->insert(job.cache_key, job.out_tile);
+    }
+    inference_ms += ms_since(t_wave);
+  };
+
+  // Input windows are gathered straight from the bitmap and alpha is built
+  // per tile, so working memory is O(tilesize^2 x (queued + wave tiles))
+  // whatever the image size.
+  for (int n = 0; n < ntiles; n++) {
+    const int t = order[n];
+    const int xi = t % xtiles;
+    const int yi = t / xtiles;
+    // Blend mode runs in raster order: a new row blends with the last one
+    if (blend && xi == 0 && yi > 0) {
+      prev_row.swap(cur_row);
+      std::fill(cur_row.begin(), cur_row.end(), PlacedTile());
+    }
+    if (n == wave_end) {
+      if (cancelled()) {
+        LOGD("Waifu2x process cancelled");
+        keep_partial();
+        return -1;
+      }
+      // Tile boundary: a higher-priority job may take over here; this
+      // one resumes with its finished tiles and loop state intact
+      if (!turn.checkpoint(ctx.cancel)) {
+        LOGD("Waifu2x process cancelled while preempted");
+        keep_partial();
+        return -1;
+      }
+      run_wave();
+    }
+    const TileJob &job = wave[n - wave_begin];
+    const int x = job.x;
+    const int y = job.y;
+    const int w_tile = job.w_tile;
+    const int h_tile = job.h_tile;
+    const int x_in = job.x_in;
+    const int y_in = job.y_in;
+    const bool flat = job.flat;
+    const bool opaque = job.opaque;
+    const ncnn::Mat &out_tile = job.out_tile;
+    const unsigned char flat_rgb[3] = {job.flat_rgb[0], job.flat_rgb[1],
+                                       job.flat_rgb[2]};
+
+    if (job.resumed) {
+      if (blend) {
+        // Empty unless an unfinished neighbour blends with it
+        PlacedTile placed;
+        placed.mat = out_tile;
+        placed.x0 = (x - overlap) * scale;
+        placed.y0 = (y - overlap) * scale;
+        cur_row[xi] = placed;
       }
+      finish_tile(t);
+      if (ctx.progress)
+        ctx.progress->store(n * 99 / ntiles + 1);
+      continue;
+    }
 
-      // Update progress IMMEDIATELY after GPU inference to show activity
-      if (progress_ptr) {
-        int p =
-            (xi + yi * xtiles) * 99 / (xtiles * ytiles) + 1; // Slight offset
-        progress_ptr->store(p);
+    if (flat && !blend) {
+      if (ctx.progress) {
+        ctx.progress->store(n * 99 / ntiles + 1);
       }
+      batch.submit(t, [=, &writeback_us, &tile_alpha, &finish_tile]() {
+        if (cancelled())
+          return;
+        const clock::time_point t_write = clock::now();
+        const ncnn::Mat alpha = tile_alpha(x, y, w_tile, h_tile);
+        int out_x = x * scale;
+        int copy_w = std::min(w_tile * scale, target_w - out_x);
+        int y_end = std::min((y + h_tile) * scale, target_h);
+        for (int dst_y = y * scale; dst_y < y_end; dst_y++) {
+          unsigned char *dst_row =
+              (unsigned char *)out_pixels + (size_t)dst_y * out_stride;
+          const unsigned char *ptr_a = nullptr;
+          if (!alpha.empty())
+            ptr_a = alpha.row<const unsigned char>(dst_y - y * scale);
+          fill_rgba_row(flat_rgb, ptr_a, dst_row + out_x * 4, copy_w);
+        }
+        finish_tile(t);
+        writeback_us += (long long)(ms_since(t_write) * 1000.0);
+      });
+      collect_completions();
+      continue;
+    }
 
-      // ---------------------------------------------------------
-      // BUFFERED PIPELINE MANAGEMENT
-      // ---------------------------------------------------------
-      // Wait for the oldest task if the pipeline is full
-      while (pipeline.size() >= 32) {
-        pipeline.front().wait();
-        pipeline.pop_front();
+    if (out_tile.empty() || out_tile.c < 3) {
+      // Inference skipped by a cancel during the wave
+      if (cancelled()) {
+        LOGD("Waifu2x process cancelled");
+        keep_partial();
+        return -1;
       }
+      LOGE("Inference tile failed or invalid channels (c=%d) at %d,%d",
+           out_tile.c, xi, yi);
+      continue;
+    }
+
+    // The network crops model_offset input pixels from each side, so the
+    // tile content starts (padding - model_offset) * scale into the output;
+    // shifted edge tiles skip the part their neighbour already wrote.
+    const int src_x = (padding - model_offset + x - x_in) * scale;
+    const int src_y = (padding - model_offset + y - y_in) * scale;
+    const int need_w = blend ? (TILE_SIZE_X + 2 * overlap) * scale
+                             : src_x + w_tile * scale;
+    const int need_h = blend ? (TILE_SIZE_Y + 2 * overlap) * scale
+                             : src_y + h_tile * scale;
+    if (out_tile.w < need_w || out_tile.h < need_h) {
+      LOGE("Output tile %dx%d too small for %dx%d input (offset %d)",
+           out_tile.w, out_tile.h, in_tile_w, in_tile_h, model_offset);
+      return -1;
+    }
 
-      // Capture by value [=] ensures all local variables needed for conversion
-      // are copied. ncnn::Mat out_tile is ref-counted, so copy is fast.
-      pipeline.push_back(
-          std::async(std::launch::async, [=, out_tile_captured = out_tile]() {
+    // Update progress IMMEDIATELY after GPU inference to show activity
+    if (ctx.progress) {
+      int p = n * 99 / ntiles + 1; // Slight offset
+      ctx.progress->store(p);
+    }
+
+    if (blend) {
+      // Neighbours in the row below and to the right blend with this tile
+      PlacedTile placed;
+      placed.mat = out_tile;
+      placed.x0 = (x - overlap) * scale;
+      placed.y0 = (y - overlap) * scale;
+      cur_row[xi] = placed;
+
+      // This tile owns the output from the start of its left and top
+      // blend zones up to the start of its right and bottom ones
+      const PlacedTile tiles[4] = {
+          placed, xi > 0 ? cur_row[xi - 1] : PlacedTile(), prev_row[xi],
+          xi > 0 ? prev_row[xi - 1] : PlacedTile()};
+      const int ox0 = xi > 0 ? x - overlap : 0;
+      const int oy0 = yi > 0 ? y - overlap : 0;
+      const int ox1 = xi < xtiles - 1 ? x + TILE_SIZE_X - overlap : w;
+      const int oy1 = yi < ytiles - 1 ? y + TILE_SIZE_Y - overlap : h;
+      const int zone = 2 * overlap * scale;
+      const int zx = xi > 0 ? (x - overlap) * scale : -zone;
+      const int zy = yi > 0 ? (y - overlap) * scale : -zone;
+      batch.submit(t, [=, &writeback_us, &tile_alpha, &finish_tile]() {
+        if (cancelled())
+          return;
+        const clock::time_point t_write = clock::now();
+        const ncnn::Mat alpha =
+            opaque ? ncnn::Mat()
+                   : tile_alpha(ox0, oy0, ox1 - ox0, oy1 - oy0);
+        write_blended(tiles, ox0 * scale, std::min(ox1 * scale, target_w),
+                      oy0 * scale, std::min(oy1 * scale, target_h), zx, zy,
+                      zone, alpha, is_grayscale,
+                      (unsigned char *)out_pixels, out_stride, blob_pool);
+        finish_tile(t);
+        writeback_us += (long long)(ms_since(t_write) * 1000.0);
+      });
+    } else {
+      // Capture by value [=] ensures all local variables needed for
+      // conversion are copied. ncnn::Mat out_tile is ref-counted, so copy
+      // is fast.
+      batch.submit(
+          t,
+          [=, &writeback_us, &tile_alpha, &finish_tile,
+           out_tile_captured = out_tile]() {
+            if (cancelled())
+              return;
+            const clock::time_point t_write = clock::now();
+            const ncnn::Mat alpha =
+                opaque ? ncnn::Mat() : tile_alpha(x, y, w_tile, h_tile);
             int out_x = x * scale;
             int out_y = y * scale;
             int out_w_tile = w_tile * scale;
             int out_h_tile = h_tile * scale;
-            int out_pad = prepadding * scale;
-
-            // Calculate source offset based on actual model output
-            // Models typically output: input_tile * scale (without additional
-            // padding) For full tiles, this equals (tilesize + 2*prepadding) *
-            // scale For edge tiles, the output may be smaller
-            int expected_out_w = in_tile_w * scale;
-            int expected_out_h = in_tile_h * scale;
-
-            int src_offset_x, src_offset_y;
-
-            if (out_tile_captured.w >= expected_out_w &&
-                out_tile_captured.h >= expected_out_h) {
-              // Model output includes padding - use standard offset
-              src_offset_x = out_pad;
-              src_offset_y = out_pad;
-            } else if (out_tile_captured.w >= out_w_tile &&
-                       out_tile_captured.h >= out_h_tile) {
-              // Model output is content-only (stripped padding) - calculate
-              // center offset
-              src_offset_x = (out_tile_captured.w - out_w_tile) / 2;
-              src_offset_y = (out_tile_captured.h - out_h_tile) / 2;
-            } else {
-              // Output smaller than content - use from beginning (edge case)
-              src_offset_x = 0;
-              src_offset_y = 0;
-            }
 
             const float *tile_b = out_tile_captured.channel(0);
             const float *tile_g = out_tile_captured.channel(1);
@@ -325,97 +1170,125 @@ int Waifu2x::process(const ncnn::Mat &inimage, void *out_pixels, int out_stride,
             // Iterate over valid output rows for this tile
             for (int i = 0; i < out_h_tile; i++) {
               int dst_y = out_y + i;
-              int src_y = src_offset_y + i;
+              int src_row = src_y + i;
 
               if (dst_y >= target_h)
                 break;
-              if (src_y >= out_tile_captured.h)
-                break;
 
               unsigned char *dst_row =
-                  (unsigned char *)out_pixels + dst_y * out_stride;
+                  (unsigned char *)out_pixels + (size_t)dst_y * out_stride;
 
               // Pointers into the tile data
-              int src_row_offset = src_y * out_tile_captured.w;
-              const float *ptr_b = tile_b + src_row_offset + src_offset_x;
-              const float *ptr_g = tile_g + src_row_offset + src_offset_x;
-              const float *ptr_r = tile_r + src_row_offset + src_offset_x;
+              int src_row_offset = src_row * out_tile_captured.w + src_x;
+              const float *ptr_b = tile_b + src_row_offset;
+              const float *ptr_g = tile_g + src_row_offset;
+              const float *ptr_r = tile_r + src_row_offset;
 
-              // Pointer into global alpha data
-              const float *ptr_a = nullptr;
-              if (alpha_data) {
-                ptr_a = alpha_data + dst_y * target_w + out_x;
-              }
+              const unsigned char *ptr_a =
+                  alpha.empty() ? nullptr : alpha.row<const unsigned char>(i);
 
               int copy_w = out_w_tile;
               if (out_x + copy_w > target_w)
                 copy_w = target_w - out_x;
-              if (src_offset_x + copy_w > out_tile_captured.w)
-                copy_w = out_tile_captured.w - src_offset_x;
-
-#pragma omp parallel for num_threads(2) if (copy_w > 512)
-              for (int j = 0; j < copy_w; j++) {
-                float r = ptr_r[j] * 255.0f;
-                float g = ptr_g[j] * 255.0f;
-                float b = ptr_b[j] * 255.0f;
-
-                if (is_grayscale) {
-                  float gray = (r + g + b) * 0.333333f;
-                  r = g = b = gray;
-                }
-
-                int dst_x = out_x + j;
-                int dst_idx = dst_x * 4;
-
-                dst_row[dst_idx + 0] =
-                    (unsigned char)std::max(0.0f, std::min(255.0f, r));
-                dst_row[dst_idx + 1] =
-                    (unsigned char)std::max(0.0f, std::min(255.0f, g));
-                dst_row[dst_idx + 2] =
-                    (unsigned char)std::max(0.0f, std::min(255.0f, b));
-                dst_row[dst_idx + 3] =
-                    ptr_a ? (unsigned char)(ptr_a[j] * 255.0f) : 255;
-              }
-            }
 
-            // Update progress after this tile is fully written to UI
-            if (progress_ptr) {
-              int p = (xi + yi * xtiles + 1) * 99 / (xtiles * ytiles);
-              progress_ptr->store(p);
+              // Rounds, clamps and interleaves in one SIMD pass
+              planar_bgr_to_rgba_row(ptr_b, ptr_g, ptr_r, ptr_a,
+                                     dst_row + out_x * 4, copy_w,
+                                     is_grayscale);
             }
-          }));
 
-      // Check for abort signal
-      if (should_abort_ptr && should_abort_ptr->load()) {
-        LOGD("Waifu2x process aborted by signal");
-        return -1;
-      }
+            finish_tile(t);
+            writeback_us += (long long)(ms_since(t_write) * 1000.0);
+          });
+    }
+    collect_completions();
 
-      // Skip sleep for the last few tiles
-      bool is_near_end = (xi + yi * xtiles) > (xtiles * ytiles - 5);
-      if (tile_sleep_ms > 0 && !is_near_end) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(tile_sleep_ms));
-      }
+    if (cancelled()) {
+      LOGD("Waifu2x process cancelled");
+      keep_partial();
+      return -1;
+    }
+
+    // Governor gap after each wave but the last, with nothing left to pace
+    if (n == wave_end - 1 && wave_end < ntiles && wave_gap_ms > 0) {
+      std::this_thread::sleep_for(
+          std::chrono::duration<double, std::milli>(wave_gap_ms));
+      throttle_ms += wave_gap_ms;
     }
   }
 
-  // ---------------------------------------------------------
-  // GPU WORK DONE - RELEASE LOCK EARLY!
-  // ---------------------------------------------------------
-  // All GPU inference tasks are submitted. Releasing the lock allows the NEXT
-  // image to start its GPU work while we finish CPU conversion for the current
-  // image's buffered tiles.
-  LOGD("GPU work finished, releasing lock early for next image.");
-  lock.unlock();
+  // All inference is done; other calls have the GPU to themselves while we
+  // finish CPU conversion of this image's buffered tiles.
+  LOGD("GPU work finished for this image.");
+  turn.leave();
 
-  // Wait for all remaining tile conversions in the pipeline
-  while (!pipeline.empty()) {
-    pipeline.front().wait();
-    pipeline.pop_front();
+  // Wait for all remaining tile conversions
+  batch.wait();
+  collect_completions();
+
+  // A cancel landing after the last wave skips the tiles not yet written
+  if (cancelled()) {
+    LOGD("Waifu2x process cancelled");
+    keep_partial();
+    return -1;
+  }
+
+  if (ctx.progress) {
+    ctx.progress->store(100);
   }
 
-  if (progress_ptr) {
-    progress_ptr->store(100);
+  if (ctx.stats) {
+    ctx.stats->preprocess_ms = preprocess_ms;
+    ctx.stats->alpha_ms = alpha_us.load() / 1000.0;
+    ctx.stats->inference_ms = inference_ms;
+    ctx.stats->writeback_ms = writeback_us.load() / 1000.0;
+    ctx.stats->total_ms = ms_since(t_start);
+    ctx.stats->tiles = ntiles;
+    ctx.stats->skipped_tiles = skipped_tiles;
+    ctx.stats->cache_hits = cache_hits;
+    ctx.stats->resumed_tiles = resumed_tiles;
+    ctx.stats->viewport_tiles = viewport_tiles;
+    ctx.stats->viewport_ms = viewport_us.load() / 1000.0;
+    ctx.stats->preview_ms = preview_ms;
+    ctx.stats->first_tile_ms = first_tile_us.load() / 1000.0;
+    ctx.stats->throttle_ms = throttle_ms;
+    if (busy_total_ms > 0)
+      ctx.stats->duty_cycle =
+          100.0 * busy_total_ms / (busy_total_ms + throttle_ms);
+    ctx.stats->thermal_drift = governor.stats().drift;
+    ctx.stats->alpha_tiles = alpha_tiles.load();
+    ctx.stats->prepadding = padding;
+    ctx.stats->tile_input_size = in_tile_size;
+    ctx.stats->blend_overlap = overlap;
+    ctx.stats->inference_workers = wave_size;
+    ctx.stats->inference_threads = net.opt.num_threads;
+    if (ctx.job) {
+      ctx.stats->preemptions = ctx.job->preemptions;
+      ctx.stats->queued_ms = ctx.job->waited_ms;
+    }
+    const BlobPoolStats blob_after = blob_pool->stats();
+    const BlobPoolStats workspace_after = workspace_pool->stats();
+    ctx.stats->pool_requests =
+        (int)(blob_after.requests - blob_before.requests +
+              workspace_after.requests - workspace_before.requests);
+    ctx.stats->pool_heap_allocs =
+        (int)(blob_after.heap_allocs - blob_before.heap_allocs +
+              workspace_after.heap_allocs - workspace_before.heap_allocs);
+    ctx.stats->pool_mb =
+        (blob_after.bytes + workspace_after.bytes) / (1024.0 * 1024.0);
+#if NCNN_VULKAN
+    if (blob_vkallocator) {
+      ctx.stats->vk_pool_requests =
+          (int)(blob_vkallocator->requests + workspace_vkallocator->requests +
+                staging_vkallocator->requests - vk_before);
+    }
+#endif
+    std::sort(tile_latency_ms.begin(), tile_latency_ms.end());
+    if (!tile_latency_ms.empty()) {
+      const size_t n = tile_latency_ms.size();
+      ctx.stats->tile_latency_p50_ms = tile_latency_ms[n / 2];
+      ctx.stats->tile_latency_p99_ms = tile_latency_ms[(n - 1) * 99 / 100];
+    }
   }
 
   LOGD("Processing complete: %dx%d (Native side finished)", target_w, target_h);
@@ -4,50 +4,230 @@
 #define WAIFU2X_H
 
 #include <atomic>
+#include <cstdint>
 #include <mutex>
 #include <string>
 
+#include "blob_pool.h"
+#include "job_scheduler.h"
+#include "model_data.h"
+#include "tile_governor.h"
+#include "tile_order.h"
+
 // ncnn
 #include "gpu.h"
 #include "layer.h"
 #include "net.h"
 
+// Per-call timing breakdown, filled by process() when the context has stats.
+struct Waifu2xStats {
+  double preprocess_ms = 0; // normalization, grayscale check, border padding
+  double alpha_ms = 0;      // alpha upscale, summed over write-back tasks
+  double inference_ms = 0;  // tile extraction and network forward
+  double writeback_ms = 0;  // float to RGBA8 conversion, summed over tasks
+  double total_ms = 0;
+  double tile_latency_p50_ms = 0; // write-back submit to done, per tile
+  double tile_latency_p99_ms = 0;
+  int tiles = 0;
+  int skipped_tiles = 0; // flat tiles filled without running the network
+  int cache_hits = 0;    // tiles served from tile_cache
+  int resumed_tiles = 0; // tiles kept from an earlier cancelled call
+  int viewport_tiles = 0;  // tiles touching the viewport (all without one)
+  double viewport_ms = 0;  // from the start until they were all written
+  double preview_ms = 0;    // progressive mode: bilinear preview, from start
+  double first_tile_ms = 0; // from the start until a tile was final
+  double throttle_ms = 0;  // governor gaps between waves
+  double duty_cycle = 100; // inference share of inference plus gaps, %
+  double thermal_drift = 1; // tile latency over the cool baseline, at the end
+  int alpha_tiles = 0;   // tiles whose alpha was not fully opaque
+  int pool_requests = 0;    // CPU blob/workspace allocations during the call
+  int pool_heap_allocs = 0; // of those, fresh heap blocks (0 once warm)
+  int vk_pool_requests = 0; // Vulkan blob/workspace/staging allocations
+  double pool_mb = 0;       // memory held by the CPU pools after the call
+  int prepadding = 0;      // halo actually used per tile side
+  int tile_input_size = 0; // side of every tile fed to the network
+  int blend_overlap = 0;   // per-side overlap in blend seam mode, else 0
+  int inference_workers = 1; // tiles inferred concurrently
+  int inference_threads = 0; // ncnn threads per concurrent tile
+  int preemptions = 0;  // times the call yielded to a higher-priority job
+  double queued_ms = 0; // waiting for its turn, before and between tiles
+};
+
+// Cost of bringing a model up, filled by load() and warm_up().
+struct ModelLoadStats {
+  double load_ms = 0;    // param, weights and pipelines
+  double warm_up_ms = 0; // the dummy tile of warm_up()
+  size_t weight_bytes = 0;
+  bool weights_in_place = false; // read from a mapping, not a heap copy
+  size_t rss_before = 0; // process RSS around load(), bytes
+  size_t rss_after = 0;
+  // Vulkan pipelines load() had the driver create, and whether they came
+  // from a pipeline cache saved by an earlier run. Shaders ncnn already
+  // built for a model loaded earlier in the run are reused without the
+  // driver and not counted.
+  int pipelines_created = 0;
+  bool pipelines_restored = false;
+};
+
+// Region of the output, in output pixels, that changed.
+struct DirtyRect {
+  int x = 0;
+  int y = 0;
+  int w = 0;
+  int h = 0;
+};
+
+template <typename T> class LockFreeQueue;
+
+// Per-call state of Waifu2x::process(): where the output goes and how the
+// call is reported and steered. The engine keeps only the loaded model and
+// its configuration, so one engine serves several calls at once, each with
+// its own context.
+struct ProcessContext {
+  // Output sink: packed RGBA8 at the target resolution, out_stride bytes per
+  // row
+  void *out_pixels = nullptr;
+  int out_stride = 0;
+  std::atomic<int> *progress = nullptr;      // 0-100
+  const std::atomic<bool> *cancel = nullptr; // checked between tiles
+  const std::atomic<int> *ui_busy = nullptr; // nonzero while the UI animates
+  // Optional part of the page on screen: its tiles run first, and
+  // viewport_progress (0-100) counts them as they are written, so the UI
+  // can show the enhanced region before the whole image is done
+  Viewport viewport;
+  std::atomic<int> *viewport_progress = nullptr;
+  // Progressive output: the output first gets a bilinear preview, then every
+  // tile overwrites its part as it finishes. Changed regions are pushed to
+  // dirty_rects (the whole image for the preview) from the write-back
+  // threads; when the ring is full the rect is dropped and dirty_overflow
+  // set, and the reader should refresh everything.
+  bool progressive = false;
+  LockFreeQueue<DirtyRect> *dirty_rects = nullptr;
+  std::atomic<bool> *dirty_overflow = nullptr;
+  Waifu2xStats *stats = nullptr;
+  // Optional priority scheduling: the call waits for its turn and yields
+  // to higher-priority jobs between tiles. Both or neither.
+  JobScheduler *scheduler = nullptr;
+  JobScheduler::Job *job = nullptr;
+};
+
+class PartialResults;
+class TileCache;
+class WorkerPool;
+
 class Waifu2x {
 public:
-  Waifu2x(int gpuid, bool tta_mode = false, int num_threads = 1);
+  // num_threads: CPU worker threads for ncnn (3 suits Snapdragon big cores)
+  Waifu2x(int gpuid, bool tta_mode = false, int num_threads = 3);
   ~Waifu2x();
 
   int load(const std::string &parampath, const std::string &modelpath);
+  // Same, from model files already in memory (see ModelData). The engine
+  // keeps model, since ncnn may reference weights in it rather than copy
+  // them. name identifies the model in logs and cache keys.
+  int load(const ModelData &param, ModelData &&model, const std::string &name);
+
+  // Unified process method: runs inference and writes directly to the
+  // context's output. Safe to call from several threads at once; GPU
+  // engines interleave the calls' tiles, CPU engines run them in parallel.
+  // in: in_pixels (RGBA packed, w x h, in_stride bytes per row), read in
+  //     place and must stay valid until process() returns
+  // Returns 0, or -1 on failure or cancellation.
+  int process(const unsigned char *in_pixels, int w, int h, int in_stride,
+              const ProcessContext &ctx) const;
+
+  // Runs the network once on a dummy tile of the shape the next call will
+  // use, so the first page does not pay for first-use pipeline, workspace
+  // and pool setup. Call after load(). Returns 0, or -1 on failure.
+  int warm_up();
 
-  // Unified process method: runs inference and writes directly to output
-  // in: inimage (RGBA planar)
-  // out: out_pixels (RGBA packed), out_stride
-  // lock: The JNI lock, passed in to allow early release of the GPU.
-  int process(const ncnn::Mat &inimage, void *out_pixels, int out_stride,
-              std::unique_lock<std::mutex> &lock,
-              std::atomic<int> *progress_ptr = nullptr) const;
+  // Memory the loaded engine holds: its weights plus whatever the CPU blob
+  // pools have grown to. What ModelRegistry budgets.
+  size_t resident_bytes() const;
+
+  // process() calls worth running at once, and so the scheduler slots for
+  // this engine: 1 on the GPU, where calls take turns per wave anyway; on
+  // the CPU as many as the cores hold at the engine's thread budget.
+  int max_concurrent_calls() const;
 
 public:
   // waifu2x parameters
   int noise;
   int scale;
-  int tilesize;
-  int prepadding;
-  std::atomic<int> *progress_ptr = nullptr;
-  std::atomic<int> *ui_busy_ptr = nullptr;
-  std::atomic<bool> *should_abort_ptr = nullptr;
-  int tile_sleep_ms = 0; // Sleep between tiles for cooling (0 = full speed)
+  // Tuned while pages are processing; each call reads it once
+  std::atomic<int> tilesize;
+  int prepadding; // set from the model's receptive field by load()
+  // Paces tiles to its duty cycle and backs off when the device heats up or
+  // ctx.ui_busy is set. It only sets the pause between waves; the tile size
+  // stays tilesize. Shared by the engine's concurrent calls.
+  mutable TileGovernor governor;
   bool is_snapdragon = false;
   bool disable_grayscale_check = false;
+  int writeback_threads = 2; // size of the write-back pool created by load()
+  // CPU backend: extractors running concurrently on different tiles, which
+  // split the constructor's num_threads between them. Many cores spend most
+  // of a small tile's forward pass in per-layer fork/join; a few extractors
+  // with fewer threads each keep them busy. Read by load(); GPU engines
+  // always use one.
+  int inference_workers = 1;
+  // Max per-channel spread (0-255) of a tile's padded input window for it to
+  // be filled with its flat color instead of running the network; -1 disables
+  int flat_tile_tolerance = 2;
+  // How tiles avoid seams. SEAM_PADDING gives every tile the model's full
+  // halo and is exact. SEAM_BLEND gives tiles only the model's own crop plus
+  // blend_overlap input pixels per side and feather-blends the overlaps,
+  // which cuts inference volume on zero-padded models (Real-ESRGAN).
+  enum SeamMode { SEAM_PADDING, SEAM_BLEND };
+  SeamMode seam_mode = SEAM_PADDING;
+  int blend_overlap = 8; // at most half the tile size
+  // Optional upscaled-tile cache, owned by the caller and shareable between
+  // engines; entries are keyed by model, scale and prepadding.
+  TileCache *tile_cache = nullptr;
+  ModelLoadStats load_stats;
+  // Where load() keeps the Vulkan pipeline cache between runs, one file per
+  // device and driver; empty to compile pipelines every time
+  std::string pipeline_cache_dir;
+  // Optional store, owned by the caller, where cancelled calls leave their
+  // finished tiles; a later call on the same pixels with the same model and
+  // settings copies them back and infers only the missing tiles.
+  PartialResults *partial_results = nullptr;
 
 private:
+  // Per-side halo and blend overlap of a call whose tiles own tile_size
+  // input pixels, and the side of the square tile fed to the network
+  void tile_geometry(int tile_size, int &padding, int &overlap,
+                     int &in_tile_size) const;
+
+#if NCNN_VULKAN
   ncnn::VulkanDevice *vkdev;
-  ncnn::Net net;
   ncnn::Pipeline *waifu2x_preproc;
   ncnn::Pipeline *waifu2x_postproc;
   ncnn::Pipeline *waifu2x_preproc_tta;
   ncnn::Pipeline *waifu2x_postproc_tta;
-  ncnn::Layer *bicubic_2x;
+#endif
+  // Declared before net, so it outlives the weights net references in it
+  ModelData weights;
+  ncnn::Net net;
+  // Installed in net.opt by load(), so every extractor reuses the same
+  // buffers across tiles and images
+  BlobPool *blob_pool;
+  BlobPool *workspace_pool;
+#if NCNN_VULKAN
+  CountingVkAllocator<ncnn::VkBlobAllocator> *blob_vkallocator;
+  CountingVkAllocator<ncnn::VkBlobAllocator> *workspace_vkallocator;
+  CountingVkAllocator<ncnn::VkStagingAllocator> *staging_vkallocator;
+#endif
+  static const int kMaxAlphaScale = 4;
+  ncnn::Layer *alpha_interp[kMaxAlphaScale + 1]; // bicubic Interp per scale
+  WorkerPool *writeback_pool;
+  WorkerPool *inference_pool; // null with a single inference worker
+  int cpu_threads;            // ncnn thread budget for all extractors
+  // Vulkan allocators and the extractors' device blobs are not thread-safe,
+  // so concurrent calls on a GPU engine take turns per inference wave
+  mutable std::mutex gpu_mutex;
+  uint64_t model_id; // identifies the loaded model in tile_cache keys
+  int model_offset;    // input pixels the network crops from each tile side
+  int model_alignment; // network input sizes must be multiples of this
   bool tta_mode;
 };
 
@@ -1,10 +1,23 @@
 #include "anime4k.h"
+#include "job_scheduler.h"
+#include "model_registry.h"
+#include "partial_results.h"
+#include "tile_cache.h"
+#include "vk_pipeline_cache.h"
 #include "waifu2x.h"
+#include "worker_pool.h"
+#include <algorithm>
+#include <android/asset_manager_jni.h>
 #include <android/bitmap.h>
 #include <android/log.h>
 #include <atomic>
+#include <climits>
+#include <condition_variable>
+#include <cstdlib>
 #include <cstring>
+#include <functional>
 #include <jni.h>
+#include <memory>
 #include <mutex>
 #include <vector>
 
@@ -12,30 +25,284 @@
 #define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, TAG, __VA_ARGS__)
 #define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, TAG, __VA_ARGS__)
 
-static Waifu2x *g_waifu2x = nullptr;
+// g_lock guards the engine pointers, not processing: nativeProcess takes a
+// reference to the engine and runs without it, so several pages can be
+// upscaled at once on one loaded model.
+static std::shared_ptr<Waifu2x> g_waifu2x;
 static Anime4K *g_anime4k = nullptr;
 static std::mutex g_lock;
-static std::atomic<int> g_progress{0};
+static std::atomic<int> g_progress{0}; // last finished page, see g_jobs
+static std::atomic<int> g_viewport_progress{0};
 static std::atomic<int> g_current_id{-1};
 static std::atomic<int> g_ui_busy{0};
-static std::atomic<bool> g_abort_processing{false};
+// Survives model switches; keys include the model so entries never mix.
+static TileCache g_tile_cache(32u << 20);
+// Finished tiles of cancelled pages, so flipping back to a page resumes it.
+// Only the finished tiles are kept: 64 MB holds 16 MP of output, every tile
+// of a 2x page of up to 4 MP or a quarter of a 4x one; a page cancelled
+// further along keeps as many tiles as fit.
+static PartialResults g_partial_results(64u << 20);
+// Engines loaded so far, so switching back to a model or noise level skips
+// the reload; a few models with their pools fit.
+static ModelRegistry<Waifu2x> g_models(256u << 20);
+
+// Model loads read the weights, build the pipelines and warm the network up
+// without g_lock, so UI calls and pages still on the current engine never
+// wait for them. Each selection is numbered; a load installs its engine only
+// if no later selection came meanwhile.
+enum ModelState {
+  MODEL_NONE = 0,
+  MODEL_LOADING = 1, // reading weights and building pipelines
+  MODEL_WARMING = 2, // first inference on a dummy tile
+  MODEL_READY = 3,
+  MODEL_FAILED = 4,
+};
+static std::atomic<int> g_load_generation{0}; // changed under g_lock
+static bool g_load_pending = false; // a load will install; under g_lock
+static std::condition_variable g_load_cv; // g_load_pending cleared
+static std::atomic<int> g_model_state{MODEL_NONE};
+static ModelLoadStats g_load_stats; // of the current engine, under g_lock
+// Performance settings, applied to every engine made current
+static std::atomic<int> g_duty_cycle{100};
+static std::atomic<int> g_tile_size{0}; // 0 keeps the engine's default
+
+// Set by nativeSetAssetManager. Model directories named "asset:<dir>" are
+// read from the APK through it; g_assets_ref keeps the Java object, and so
+// the native manager, alive. Under g_lock.
+static AAssetManager *g_assets = nullptr;
+static jobject g_assets_ref = nullptr;
+// Set by nativeSetPipelineCacheDir; engines loaded from then on keep their
+// Vulkan pipelines there between runs. Under g_lock.
+static std::string g_pipeline_cache_dir;
+
+// Background loads, one at a time. Created on first use.
+static WorkerPool &loader() {
+  static WorkerPool pool(1, 8);
+  return pool;
+}
 
-extern "C" JNIEXPORT jboolean JNICALL
-Java_eu_kanade_tachiyomi_util_waifu2x_Waifu2x_nativeInit(JNIEnv *env,
-                                                         jobject thiz,
-                                                         jstring model_dir,
-                                                         jint noise_level,
-                                                         jint scale_level) {
-  g_abort_processing = true;
-  std::lock_guard<std::mutex> lock(g_lock);
-  g_abort_processing = false;
+// A nativeProcess call, registered for its whole duration so progress is
+// reported per page and each page can be cancelled on its own
+struct RunningJob {
+  int id;
+  const Waifu2x *engine = nullptr; // null while waiting for a load; g_lock
+  std::atomic<int> progress{0};
+  std::atomic<int> viewport_progress{0}; // tiles of the viewport written
+  std::atomic<bool> cancel{false}; // checked between tiles and in write-back
+  // Progressive calls only: output regions not yet polled
+  LockFreeQueue<DirtyRect> *dirty_rects = nullptr;
+  std::atomic<bool> dirty_overflow{false};
+  int out_w = 0; // output size, set before any rect is pushed
+  int out_h = 0;
+};
+static std::mutex g_jobs_lock;
+static std::vector<RunningJob *> g_jobs;
+
+// Adds job to g_jobs for the lifetime of this object.
+struct JobRegistration {
+  RunningJob &job;
+
+  explicit JobRegistration(RunningJob &job) : job(job) {
+    std::lock_guard<std::mutex> lock(g_jobs_lock);
+    g_jobs.push_back(&job);
+  }
+  ~JobRegistration() {
+    std::lock_guard<std::mutex> lock(g_jobs_lock);
+    g_jobs.erase(std::find(g_jobs.begin(), g_jobs.end(), &job));
+    if (g_current_id.load() == job.id) {
+      g_progress.store(job.progress.load());
+      g_viewport_progress.store(job.viewport_progress.load());
+    }
+  }
+};
+
+static std::atomic<int> g_focus_id{-1};
+
+// Higher runs first. Without a focus page every page ties and runs in
+// arrival order; jobs without an id go last.
+static int page_priority(int id) {
+  const int focus = g_focus_id.load();
+  if (focus < 0)
+    return 0;
+  if (id < 0)
+    return INT_MIN;
+  return -std::abs(id - focus);
+}
 
-  ncnn::create_gpu_instance();
+// Pages take turns on the engine by distance to the page on screen; a page
+// being prefetched yields to the visible one at its next tile boundary.
+// install_engine() sizes the slots to what the engine runs at once.
+static JobScheduler g_scheduler(1, page_priority);
+
+// The Kotlin side still configures a sleep between tiles. With a typical
+// 100 ms tile, sleeping s ms meant a duty cycle of 100 / (100 + s); the
+// governor now holds that share whatever the tile latency.
+static int duty_from_sleep_ms(int sleep_ms) {
+  return 100 * 100 / (100 + std::max(sleep_ms, 0));
+}
+
+// Stops using the current engine. Calls still running on it are cancelled;
+// calls on other engines are untouched. The engine stays loaded in g_models
+// until evicted, and an evicted one is freed when its last call returns.
+// Called with g_lock held.
+static void retire_engine() {
+  {
+    std::lock_guard<std::mutex> lock(g_jobs_lock);
+    for (RunningJob *job : g_jobs) {
+      if (job->engine && job->engine == g_waifu2x.get())
+        job->cancel.store(true);
+    }
+  }
+  g_waifu2x.reset();
+}
+
+static ModelKey model_key(const std::string &bin_file, int noise, int scale) {
+  ModelKey key;
+  key.model = bin_file;
+  key.noise = noise;
+  key.scale = scale;
+  return key;
+}
+
+// Makes engine current. Calls on the previous engine are cancelled unless
+// it is the same one. Called with g_lock held.
+static void install_engine(const std::shared_ptr<Waifu2x> &engine) {
+  if (engine == g_waifu2x)
+    return;
+  retire_engine();
+  g_waifu2x = engine;
+  g_scheduler.set_slots(engine->max_concurrent_calls());
+}
 
-  if (g_waifu2x) {
-    delete g_waifu2x;
+static void apply_performance(Waifu2x &engine) {
+  if (g_tile_size.load() > 0)
+    engine.tilesize = g_tile_size.load();
+  engine.governor.set_duty_cycle(g_duty_cycle.load());
+}
+
+// Reports state for the selection numbered generation, unless a later one
+// has started meanwhile.
+static void set_model_state(int generation, ModelState state) {
+  if (generation == g_load_generation.load())
+    g_model_state.store(state);
+}
+
+// Opens a model file in place: mapped from the file system, or from the
+// APK for paths under "asset:". Returns 0, or -1.
+static int open_model_file(const std::string &path, AAssetManager *assets,
+                           ModelData &data) {
+  static const std::string kAssetPrefix = "asset:";
+  if (path.compare(0, kAssetPrefix.size(), kAssetPrefix) == 0)
+    return assets ? data.open_asset(assets, path.substr(kAssetPrefix.size()))
+                  : -1;
+  return data.map_file(path);
+}
+
+// Creates an engine that configure sets up, loads param_file and bin_file
+// and warms it up. Runs without g_lock. Null on failure.
+static std::shared_ptr<Waifu2x>
+load_engine(int generation, const std::string &param_file,
+            const std::string &bin_file, AAssetManager *assets,
+            const std::function<void(Waifu2x &)> &configure) {
+  auto engine = std::make_shared<Waifu2x>(0); // GPU 0
+  engine->tile_cache = &g_tile_cache;
+  engine->partial_results = &g_partial_results;
+  configure(*engine);
+  apply_performance(*engine);
+
+  set_model_state(generation, MODEL_LOADING);
+  ModelData param;
+  ModelData model;
+  if (open_model_file(param_file, assets, param) != 0 ||
+      open_model_file(bin_file, assets, model) != 0) {
+    LOGE("Cannot open %s", bin_file.c_str());
+    set_model_state(generation, MODEL_FAILED);
+    return nullptr;
+  }
+  if (engine->load(param, std::move(model), param_file + "\n" + bin_file) !=
+      0) {
+    set_model_state(generation, MODEL_FAILED);
+    return nullptr;
   }
 
+  set_model_state(generation, MODEL_WARMING);
+  if (engine->warm_up() != 0) {
+    set_model_state(generation, MODEL_FAILED);
+    return nullptr;
+  }
+  return engine;
+}
+
+// Makes the engine for key current: the resident one if g_models has it,
+// else a new one that configure sets up before it loads param_file and
+// bin_file. Loading runs without g_lock, on this thread or, with async, on
+// loader(), in which case this returns 0 at once and the engine is current
+// when the state reads MODEL_READY. lock holds g_lock.
+static int select_engine(std::unique_lock<std::mutex> &lock,
+                         const ModelKey &key, const std::string &param_file,
+                         const std::string &bin_file,
+                         const std::function<void(Waifu2x &)> &configure,
+                         bool async) {
+  const int generation = ++g_load_generation;
+  std::shared_ptr<Waifu2x> engine = g_models.find(key);
+  if (engine) {
+    LOGD("Using resident model %s", key.model.c_str());
+    apply_performance(*engine);
+    install_engine(engine);
+    g_load_stats = engine->load_stats;
+    g_model_state.store(MODEL_READY);
+    g_load_pending = false;
+    g_load_cv.notify_all();
+    return 0;
+  }
+
+  // Pages wait for the new engine rather than run on the one it replaces
+  g_load_pending = true;
+  AAssetManager *assets = g_assets;
+  const std::string pipeline_cache_dir = g_pipeline_cache_dir;
+  auto setup = [configure, pipeline_cache_dir](Waifu2x &engine) {
+    engine.pipeline_cache_dir = pipeline_cache_dir;
+    configure(engine);
+  };
+  auto load = [generation, key, param_file, bin_file, assets, setup]() {
+    std::shared_ptr<Waifu2x> engine;
+    if (generation == g_load_generation.load())
+      engine = load_engine(generation, param_file, bin_file, assets, setup);
+    std::lock_guard<std::mutex> lock(g_lock);
+    if (generation != g_load_generation.load())
+      return engine ? 0 : -1; // a later selection installs its own
+    if (engine) {
+      g_models.insert(key, engine);
+      install_engine(engine);
+      g_load_stats = engine->load_stats;
+      g_model_state.store(MODEL_READY);
+    } else {
+      retire_engine();
+    }
+    g_load_pending = false;
+    g_load_cv.notify_all();
+    return engine ? 0 : -1;
+  };
+
+  lock.unlock();
+  int ret = 0;
+  if (async)
+    loader().submit([load]() { load(); });
+  else
+    ret = load();
+  lock.lock();
+  return ret;
+}
+
+extern "C" JNIEXPORT jboolean JNICALL
+Java_eu_kanade_tachiyomi_util_waifu2x_Waifu2x_nativeInit(
+    JNIEnv *env, jobject thiz, jstring model_dir, jint noise_level,
+    jint scale_level, jboolean async) {
+  std::unique_lock<std::mutex> lock(g_lock);
+
+  ncnn::create_gpu_instance();
+  install_pipeline_cache_hook();
+
   const char *model_dir_str = env->GetStringUTFChars(model_dir, 0);
   std::string model_path = std::string(model_dir_str);
 
@@ -58,16 +325,18 @@ Java_eu_kanade_tachiyomi_util_waifu2x_Waifu2x_nativeInit(JNIEnv *env,
                "_scale2.0x_model.bin";
   }
 
-  g_waifu2x = new Waifu2x(0); // GPU 0
-  g_waifu2x->disable_grayscale_check = true;
-  g_waifu2x->noise = noise_level;
-  g_waifu2x->scale = scale_level;
-  g_waifu2x->progress_ptr = &g_progress;
-  g_waifu2x->ui_busy_ptr = &g_ui_busy;
-  g_waifu2x->should_abort_ptr = &g_abort_processing;
   g_progress.store(0);
-
-  int ret = g_waifu2x->load(param_file, bin_file);
+  g_viewport_progress.store(0);
+
+  const ModelKey key = model_key(bin_file, noise_level, scale_level);
+  int ret = select_engine(
+      lock, key, param_file, bin_file,
+      [=](Waifu2x &engine) {
+        engine.disable_grayscale_check = true;
+        engine.noise = noise_level;
+        engine.scale = scale_level;
+      },
+      async);
 
   env->ReleaseStringUTFChars(model_dir, model_dir_str);
   return ret == 0 ? JNI_TRUE : JNI_FALSE;
@@ -76,16 +345,11 @@ Java_eu_kanade_tachiyomi_util_waifu2x_Waifu2x_nativeInit(JNIEnv *env,
 extern "C" JNIEXPORT jboolean JNICALL
 Java_eu_kanade_tachiyomi_util_waifu2x_Waifu2x_nativeInitWaifu2xUpconv7(
     JNIEnv *env, jobject thiz, jstring model_dir, jint noise_level,
-    jint scale_level) {
-  g_abort_processing = true;
-  std::lock_guard<std::mutex> lock(g_lock);
-  g_abort_processing = false;
+    jint scale_level, jboolean async) {
+  std::unique_lock<std::mutex> lock(g_lock);
 
   ncnn::create_gpu_instance();
-
-  if (g_waifu2x) {
-    delete g_waifu2x;
-  }
+  install_pipeline_cache_hook();
 
   const char *model_dir_str = env->GetStringUTFChars(model_dir, 0);
   std::string model_path = std::string(model_dir_str);
@@ -106,105 +370,160 @@ Java_eu_kanade_tachiyomi_util_waifu2x_Waifu2x_nativeInitWaifu2xUpconv7(
     // model or just fail/fallback For now assume 2x.
   }
 
-  g_waifu2x = new Waifu2x(0); // GPU 0
-  g_waifu2x->disable_grayscale_check = true;
-  g_waifu2x->noise = noise_level;
-  g_waifu2x->scale = scale_level;
-  g_waifu2x->prepadding = 7; // UpConv7 uses small padding
-  g_waifu2x->progress_ptr = &g_progress;
-  g_waifu2x->ui_busy_ptr = &g_ui_busy;
-  g_waifu2x->should_abort_ptr = &g_abort_processing;
   g_progress.store(0);
-
-  int ret = g_waifu2x->load(param_file, bin_file);
+  g_viewport_progress.store(0);
+
+  const ModelKey key = model_key(bin_file, noise_level, scale_level);
+  int ret = select_engine(
+      lock, key, param_file, bin_file,
+      [=](Waifu2x &engine) {
+        engine.disable_grayscale_check = true;
+        engine.noise = noise_level;
+        engine.scale = scale_level;
+      },
+      async);
 
   env->ReleaseStringUTFChars(model_dir, model_dir_str);
   return ret == 0 ? JNI_TRUE : JNI_FALSE;
 }
 
 extern "C" JNIEXPORT jobject JNICALL
-Java_eu_kanade_tachiyomi_util_waifu2x_Waifu2x_nativeProcess(JNIEnv *env,
-                                                            jobject thiz,
-                                                            jobject bitmap,
-                                                            jint id) {
+Java_eu_kanade_tachiyomi_util_waifu2x_Waifu2x_nativeProcess(
+    JNIEnv *env, jobject thiz, jobject bitmap, jint id, jintArray viewport,
+    jobject output) {
   int ret = -1;
   jobject outBitmap = nullptr;
 
-  // Inference Scope (GPU) - Holds Lock for entire duration of incremental
-  // process
+  // Optional [left, top, right, bottom, scroll_dx, scroll_dy] in input
+  // pixels: the part on screen is upscaled first
+  Viewport view;
+  if (viewport && env->GetArrayLength(viewport) >= 6) {
+    jint v[6];
+    env->GetIntArrayRegion(viewport, 0, 6, v);
+    view.x = v[0];
+    view.y = v[1];
+    view.w = v[2] - v[0];
+    view.h = v[3] - v[1];
+    view.scroll_dx = v[4] > 0 ? 1 : v[4] < 0 ? -1 : 0;
+    view.scroll_dy = v[5] > 0 ? 1 : v[5] < 0 ? -1 : 0;
+  }
+
+  // Per-call state lives here; the engine reference keeps it alive even if
+  // a model switch retires it meanwhile. Picking the engine under g_lock
+  // means a switch either sees this job on it and cancels it, or happened
+  // before. A model still loading is waited for, so the page runs on the
+  // new one; the job is registered first so it can be cancelled meanwhile.
+  std::shared_ptr<Waifu2x> engine;
+  RunningJob job;
+  job.id = id;
+  // With an output bitmap the caller already shows, the page is written
+  // progressively and the changed regions are read with
+  // nativePollDirtyRects
+  std::unique_ptr<LockFreeQueue<DirtyRect>> dirty_rects;
+  if (output) {
+    dirty_rects.reset(new LockFreeQueue<DirtyRect>(256));
+    job.dirty_rects = dirty_rects.get();
+  }
+  JobRegistration registration(job);
   {
     std::unique_lock<std::mutex> lock(g_lock);
+    g_load_cv.wait(lock,
+                   [&job] { return !g_load_pending || job.cancel.load(); });
+    engine = g_waifu2x;
+    job.engine = engine.get();
+  }
+  if (!engine || job.cancel.load())
+    return bitmap;
 
-    // Update ID only after acquiring lock (now we are truly the active process)
-    g_current_id.store(id);
-
-    if (!g_waifu2x)
-      return bitmap;
+  AndroidBitmapInfo info;
+  if (AndroidBitmap_getInfo(env, bitmap, &info) < 0)
+    return bitmap;
+  if (info.format != ANDROID_BITMAP_FORMAT_RGBA_8888)
+    return bitmap;
 
-    AndroidBitmapInfo info;
-    if (AndroidBitmap_getInfo(env, bitmap, &info) < 0)
-      return bitmap;
-    if (info.format != ANDROID_BITMAP_FORMAT_RGBA_8888)
-      return bitmap;
+  void *pixels;
+  if (AndroidBitmap_lockPixels(env, bitmap, &pixels) < 0)
+    return bitmap;
 
-    void *pixels;
-    if (AndroidBitmap_lockPixels(env, bitmap, &pixels) < 0)
+  int w = info.width;
+  int h = info.height;
+  int stride = info.stride;
+
+  // The engine gathers tiles straight from the locked input pixels, so the
+  // input stays locked until process() returns.
+  int out_w = w * engine->scale;
+  int out_h = h * engine->scale;
+  job.out_w = out_w;
+  job.out_h = out_h;
+
+  if (output) {
+    AndroidBitmapInfo outInfo;
+    if (AndroidBitmap_getInfo(env, output, &outInfo) < 0 ||
+        outInfo.format != ANDROID_BITMAP_FORMAT_RGBA_8888 ||
+        (int)outInfo.width != out_w || (int)outInfo.height != out_h) {
+      LOGE("Progressive output must be a %dx%d ARGB_8888 bitmap", out_w,
+           out_h);
+      AndroidBitmap_unlockPixels(env, bitmap);
       return bitmap;
+    }
+  }
 
-    int w = info.width;
-    int h = info.height;
-    int stride = info.stride;
-
-    // Use from_pixels for input (copy to ncnn Mat)
-    ncnn::Mat in = ncnn::Mat::from_pixels((const unsigned char *)pixels,
-                                          ncnn::Mat::PIXEL_RGBA, w, h, stride);
-
-    // Unlock input quickly if possible, checking if creating output needs it
-    // locked? No, createBitmap doesn't need input locked. But we need to keep
-    // 'pixels' valid if we didn't copy... ncnn::Mat::from_pixels COPIES data,
-    // so we can unlock input immediately.
-    AndroidBitmap_unlockPixels(env, bitmap);
-
-    if (g_waifu2x) {
-      int out_w = w * g_waifu2x->scale;
-      int out_h = h * g_waifu2x->scale;
-
-      // Create result bitmap
-      jclass bitmapClass = env->FindClass("android/graphics/Bitmap");
-      jmethodID createBitmapMethod = env->GetStaticMethodID(
-          bitmapClass, "createBitmap",
-          "(IILandroid/graphics/Bitmap$Config;)Landroid/graphics/Bitmap;");
-
-      jclass configClass = env->FindClass("android/graphics/Bitmap$Config");
-      jfieldID configField = env->GetStaticFieldID(
-          configClass, "ARGB_8888", "Landroid/graphics/Bitmap$Config;");
-      jobject config = env->GetStaticObjectField(configClass, configField);
-
-      outBitmap = env->CallStaticObjectMethod(bitmapClass, createBitmapMethod,
-                                              out_w, out_h, config);
-
-      if (outBitmap) {
-        void *outPixels;
-        if (AndroidBitmap_lockPixels(env, outBitmap, &outPixels) == 0) {
-          AndroidBitmapInfo outInfo;
-          AndroidBitmap_getInfo(env, outBitmap, &outInfo);
-
-          g_waifu2x->progress_ptr = &g_progress;
-          g_waifu2x->should_abort_ptr = &g_abort_processing;
-
-          // RUN UNIFIED PROCESS
-          ret = g_waifu2x->process(in, outPixels, outInfo.stride, lock,
-                                   &g_progress);
+  // Create result bitmap
+  jclass bitmapClass = env->FindClass("android/graphics/Bitmap");
+  jmethodID createBitmapMethod = env->GetStaticMethodID(
+      bitmapClass, "createBitmap",
+      "(IILandroid/graphics/Bitmap$Config;)Landroid/graphics/Bitmap;");
 
-          g_waifu2x->progress_ptr = nullptr;
-          g_waifu2x->should_abort_ptr = nullptr;
+  jclass configClass = env->FindClass("android/graphics/Bitmap$Config");
+  jfieldID configField = env->GetStaticFieldID(
+      configClass, "ARGB_8888", "Landroid/graphics/Bitmap$Config;");
+  jobject config = env->GetStaticObjectField(configClass, configField);
 
-          AndroidBitmap_unlockPixels(env, outBitmap);
-        }
-      }
+  outBitmap = output ? output
+                     : env->CallStaticObjectMethod(bitmapClass,
+                                                   createBitmapMethod, out_w,
+                                                   out_h, config);
+
+  if (outBitmap) {
+    void *outPixels;
+    if (AndroidBitmap_lockPixels(env, outBitmap, &outPixels) == 0) {
+      AndroidBitmapInfo outInfo;
+      AndroidBitmap_getInfo(env, outBitmap, &outInfo);
+
+      // The most recently started page is the one progress is reported for
+      // Its priority is read from page_priority() when it enters the
+      // schedule, after any progressive preview
+      JobScheduler::Job turn;
+      turn.id = id;
+      g_current_id.store(id);
+
+      ProcessContext ctx;
+      ctx.out_pixels = outPixels;
+      ctx.out_stride = outInfo.stride;
+      ctx.progress = &job.progress;
+      ctx.viewport = view;
+      ctx.viewport_progress = &job.viewport_progress;
+      ctx.progressive = output != nullptr;
+      ctx.dirty_rects = job.dirty_rects;
+      ctx.dirty_overflow = &job.dirty_overflow;
+      ctx.cancel = &job.cancel;
+      ctx.ui_busy = &g_ui_busy;
+      ctx.scheduler = &g_scheduler;
+      ctx.job = &turn;
+
+      // RUN UNIFIED PROCESS
+      ret = engine->process((const unsigned char *)pixels, w, h, stride, ctx);
+
+      AndroidBitmap_unlockPixels(env, outBitmap);
     }
   }
 
+  AndroidBitmap_unlockPixels(env, bitmap);
+
+  if (job.cancel.load()) {
+    LOGD("Page %d cancelled", id);
+    return bitmap;
+  }
   if (ret != 0 || !outBitmap) {
     LOGE("Waifu2x process failed or aborted");
     return bitmap; // Return original on failure
@@ -284,10 +603,14 @@ extern "C" JNIEXPORT void JNICALL
 Java_eu_kanade_tachiyomi_util_waifu2x_Waifu2x_nativeDestroy(JNIEnv *env,
                                                             jobject thiz) {
   std::lock_guard<std::mutex> lock(g_lock);
-  if (g_waifu2x) {
-    delete g_waifu2x;
-    g_waifu2x = nullptr;
-  }
+  // Calls still running keep the engine alive until they return. A load in
+  // flight finds itself superseded and installs nothing.
+  g_waifu2x.reset();
+  g_models.clear();
+  g_load_generation++;
+  g_load_pending = false;
+  g_load_cv.notify_all();
+  g_model_state.store(MODEL_NONE);
   if (g_anime4k) {
     delete g_anime4k;
     g_anime4k = nullptr;
@@ -369,16 +692,11 @@ Java_eu_kanade_tachiyomi_util_waifu2x_Waifu2x_nativeProcessAnime4K(
 extern "C" JNIEXPORT jboolean JNICALL
 Java_eu_kanade_tachiyomi_util_waifu2x_Waifu2x_nativeInitRealCugan(
     JNIEnv *env, jobject thiz, jstring model_dir, jint noise_level,
-    jint scale_level, jint tile_sleep_ms) {
-  g_abort_processing = true; // Signal abort to any running process
-  std::lock_guard<std::mutex> lock(g_lock);
-  g_abort_processing = false; // Reset
+    jint scale_level, jint tile_sleep_ms, jboolean async) {
+  std::unique_lock<std::mutex> lock(g_lock);
 
   ncnn::create_gpu_instance();
-
-  if (g_waifu2x) {
-    delete g_waifu2x;
-  }
+  install_pipeline_cache_hook();
 
   const char *model_dir_str = env->GetStringUTFChars(model_dir, 0);
   std::string model_path = std::string(model_dir_str);
@@ -418,32 +736,26 @@ Java_eu_kanade_tachiyomi_util_waifu2x_Waifu2x_nativeInitRealCugan(
   std::string bin_file = model_path + "/up" + std::to_string(scale_level) +
                          "x-" + noise_str + ".bin";
 
-  g_waifu2x = new Waifu2x(0); // GPU 0
-  g_waifu2x->noise = noise_level;
-  g_waifu2x->scale = scale_level;
-  g_waifu2x->tile_sleep_ms = tile_sleep_ms; // Set configurable sleep
-  g_waifu2x->progress_ptr = &g_progress;
-  g_waifu2x->ui_busy_ptr = &g_ui_busy;
-  g_waifu2x->should_abort_ptr = &g_abort_processing;
   g_progress.store(0);
-
-  // Real-CUGAN SE prepadding: 2x=18, 3x=14, 4x=19?
-  // Actually from official impl: 2x=18, 3x=14, 4x=19
-  if (scale_level == 2)
-    g_waifu2x->prepadding = 18;
-  else if (scale_level == 3)
-    g_waifu2x->prepadding = 14;
-  else if (scale_level == 4)
-    g_waifu2x->prepadding = 19;
-
-  int ret = g_waifu2x->load(param_file, bin_file);
+  g_viewport_progress.store(0);
+  g_duty_cycle.store(duty_from_sleep_ms(tile_sleep_ms));
+
+  const ModelKey key = model_key(bin_file, noise_level, scale_level);
+  int ret = select_engine(
+      lock, key, param_file, bin_file,
+      [=](Waifu2x &engine) {
+        engine.noise = noise_level;
+        engine.scale = scale_level;
+      },
+      async);
 
   if (ret != 0) {
     LOGE("Real-CUGAN load failed. ret=%d", ret);
     LOGE("Param path: %s", param_file.c_str());
     LOGE("Bin path: %s", bin_file.c_str());
   } else {
-    LOGD("Real-CUGAN loaded successfully. Scale=%d, Noise=%d, TileSleep=%dms",
+    LOGD("Real-CUGAN %s. Scale=%d, Noise=%d, TileSleep=%dms",
+         async ? "loading in the background" : "loaded successfully",
          scale_level, noise_level, tile_sleep_ms);
   }
 
@@ -453,24 +765,21 @@ Java_eu_kanade_tachiyomi_util_waifu2x_Waifu2x_nativeInitRealCugan(
 
 extern "C" JNIEXPORT jobject JNICALL
 Java_eu_kanade_tachiyomi_util_waifu2x_Waifu2x_nativeProcessRealCugan(
-    JNIEnv *env, jobject thiz, jobject bitmap, jint id) {
+    JNIEnv *env, jobject thiz, jobject bitmap, jint id, jintArray viewport,
+    jobject output) {
   // Real-CUGAN uses same processing logic as Waifu2x in this simplified impl
   return Java_eu_kanade_tachiyomi_util_waifu2x_Waifu2x_nativeProcess(
-      env, thiz, bitmap, id);
+      env, thiz, bitmap, id, viewport, output);
 }
 
 extern "C" JNIEXPORT jboolean JNICALL
 Java_eu_kanade_tachiyomi_util_waifu2x_Waifu2x_nativeInitRealESRGAN(
-    JNIEnv *env, jobject thiz, jstring model_dir, jint scale) {
-  g_abort_processing = true;
-  std::lock_guard<std::mutex> lock(g_lock);
-  g_abort_processing = false;
+    JNIEnv *env, jobject thiz, jstring model_dir, jint scale,
+    jboolean async) {
+  std::unique_lock<std::mutex> lock(g_lock);
 
   ncnn::create_gpu_instance();
-
-  if (g_waifu2x) {
-    delete g_waifu2x;
-  }
+  install_pipeline_cache_hook();
 
   const char *model_dir_str = env->GetStringUTFChars(model_dir, 0);
   std::string model_path = std::string(model_dir_str);
@@ -479,22 +788,22 @@ Java_eu_kanade_tachiyomi_util_waifu2x_Waifu2x_nativeInitRealESRGAN(
   std::string param_file = model_path + "/x" + std::to_string(scale) + ".param";
   std::string bin_file = model_path + "/x" + std::to_string(scale) + ".bin";
 
-  g_waifu2x = new Waifu2x(0); // GPU 0
-  g_waifu2x->noise = 0;
-  g_waifu2x->scale = scale;
-  g_waifu2x->prepadding = 10; // Real-ESRGAN usually uses smaller padding, 10 is
-                              // common in ncnn impls
-  g_waifu2x->progress_ptr = &g_progress;
-  g_waifu2x->ui_busy_ptr = &g_ui_busy;
-  g_waifu2x->should_abort_ptr = &g_abort_processing;
   g_progress.store(0);
+  g_viewport_progress.store(0);
 
-  int ret = g_waifu2x->load(param_file, bin_file);
+  const ModelKey key = model_key(bin_file, 0, scale);
+  int ret = select_engine(
+      lock, key, param_file, bin_file,
+      [=](Waifu2x &engine) {
+        engine.noise = 0;
+        engine.scale = scale;
+      },
+      async);
 
   if (ret != 0) {
     LOGE("Real-ESRGAN init failed: %s", param_file.c_str());
   } else {
-    LOGD("Real-ESRGAN loaded: x%d", scale);
+    LOGD("Real-ESRGAN %s: x%d", async ? "loading" : "loaded", scale);
   }
 
   env->ReleaseStringUTFChars(model_dir, model_dir_str);
@@ -503,16 +812,11 @@ Java_eu_kanade_tachiyomi_util_waifu2x_Waifu2x_nativeInitRealESRGAN(
 
 extern "C" JNIEXPORT jboolean JNICALL
 Java_eu_kanade_tachiyomi_util_waifu2x_Waifu2x_nativeInitNose(
-    JNIEnv *env, jobject thiz, jstring model_dir) {
-  g_abort_processing = true;
-  std::lock_guard<std::mutex> lock(g_lock);
-  g_abort_processing = false;
+    JNIEnv *env, jobject thiz, jstring model_dir, jboolean async) {
+  std::unique_lock<std::mutex> lock(g_lock);
 
   ncnn::create_gpu_instance();
-
-  if (g_waifu2x) {
-    delete g_waifu2x;
-  }
+  install_pipeline_cache_hook();
 
   const char *model_dir_str = env->GetStringUTFChars(model_dir, 0);
   std::string model_path = std::string(model_dir_str);
@@ -521,16 +825,17 @@ Java_eu_kanade_tachiyomi_util_waifu2x_Waifu2x_nativeInitNose(
   std::string param_file = model_path + "/up2x-no-denoise.param";
   std::string bin_file = model_path + "/up2x-no-denoise.bin";
 
-  g_waifu2x = new Waifu2x(0); // GPU 0
-  g_waifu2x->noise = 0;
-  g_waifu2x->scale = 2;       // Fixed 2x
-  g_waifu2x->prepadding = 18; // Assumed 18 for CUGAN 2x
-  g_waifu2x->progress_ptr = &g_progress;
-  g_waifu2x->ui_busy_ptr = &g_ui_busy;
-  g_waifu2x->should_abort_ptr = &g_abort_processing;
   g_progress.store(0);
+  g_viewport_progress.store(0);
 
-  int ret = g_waifu2x->load(param_file, bin_file);
+  const ModelKey key = model_key(bin_file, 0, 2);
+  int ret = select_engine(
+      lock, key, param_file, bin_file,
+      [=](Waifu2x &engine) {
+        engine.noise = 0;
+        engine.scale = 2; // Fixed 2x
+      },
+      async);
 
   env->ReleaseStringUTFChars(model_dir, model_dir_str);
   return ret == 0 ? JNI_TRUE : JNI_FALSE;
@@ -540,10 +845,99 @@ extern "C" JNIEXPORT jlong JNICALL
 Java_eu_kanade_tachiyomi_util_waifu2x_Waifu2x_nativeGetProgress(JNIEnv *env,
                                                                 jobject thiz) {
   // Return packed long: [ID (32)] [Progress (32)]
+  std::lock_guard<std::mutex> lock(g_jobs_lock);
   jlong id = (jlong)g_current_id.load();
   jlong progress = (jlong)g_progress.load();
+  for (const RunningJob *job : g_jobs) {
+    if (job->id == id)
+      progress = job->progress.load();
+  }
   return (id << 32) | (progress & 0xFFFFFFFF);
 }
+
+extern "C" JNIEXPORT jint JNICALL
+Java_eu_kanade_tachiyomi_util_waifu2x_Waifu2x_nativeGetViewportProgress(
+    JNIEnv *env, jobject thiz) {
+  // Percentage of the current page's viewport tiles written; 100 means the
+  // region on screen is final even if the rest of the page is not
+  std::lock_guard<std::mutex> lock(g_jobs_lock);
+  const int id = g_current_id.load();
+  for (const RunningJob *job : g_jobs) {
+    if (job->id == id)
+      return job->viewport_progress.load();
+  }
+  return g_viewport_progress.load();
+}
+
+extern "C" JNIEXPORT jintArray JNICALL
+Java_eu_kanade_tachiyomi_util_waifu2x_Waifu2x_nativePollDirtyRects(
+    JNIEnv *env, jobject thiz, jint id) {
+  // [x, y, w, h, ...] of the output regions of progressive page id written
+  // since the last poll; after an overflow, the whole bitmap. Null once the
+  // page is no longer running.
+  std::vector<jint> rects;
+  {
+    std::lock_guard<std::mutex> lock(g_jobs_lock);
+    RunningJob *found = nullptr;
+    for (RunningJob *job : g_jobs) {
+      if (job->id == id && job->dirty_rects)
+        found = job;
+    }
+    if (!found)
+      return nullptr;
+    DirtyRect rect;
+    while (found->dirty_rects->pop(rect)) {
+      const jint r[4] = {rect.x, rect.y, rect.w, rect.h};
+      rects.insert(rects.end(), r, r + 4);
+    }
+    if (found->dirty_overflow.exchange(false)) {
+      // The exchange orders the read after the sizes were set
+      const jint all[4] = {0, 0, found->out_w, found->out_h};
+      rects.assign(all, all + 4);
+    }
+  }
+  jintArray result = env->NewIntArray((jsize)rects.size());
+  if (result && !rects.empty())
+    env->SetIntArrayRegion(result, 0, (jsize)rects.size(), rects.data());
+  return result;
+}
+extern "C" JNIEXPORT jint JNICALL
+Java_eu_kanade_tachiyomi_util_waifu2x_Waifu2x_nativeCancelJobs(JNIEnv *env,
+                                                               jobject thiz,
+                                                               jint min_id,
+                                                               jint max_id) {
+  // Running and queued pages with min_id <= id <= max_id stop at their next
+  // tile; other pages are unaffected. Returns how many were cancelled.
+  int cancelled = 0;
+  {
+    std::lock_guard<std::mutex> lock(g_jobs_lock);
+    for (RunningJob *job : g_jobs) {
+      if (job->id >= min_id && job->id <= max_id && !job->cancel.load()) {
+        job->cancel.store(true);
+        cancelled++;
+      }
+    }
+  }
+  if (cancelled > 0) {
+    // Wakes pages waiting for a model load. Taking g_lock first means a
+    // waiter either sees the flag or is already waiting for this notify.
+    { std::lock_guard<std::mutex> lock(g_lock); }
+    g_load_cv.notify_all();
+    LOGD("Cancelled %d running pages in [%d, %d]", cancelled, min_id, max_id);
+  }
+  return cancelled;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_eu_kanade_tachiyomi_util_waifu2x_Waifu2x_nativeSetFocusPage(JNIEnv *env,
+                                                                 jobject thiz,
+                                                                 jint id) {
+  // Reorders queued pages and lets the running one yield to the new focus;
+  // pages yet to enter the schedule read the new focus when they do
+  g_focus_id.store(id);
+  g_scheduler.refresh_priorities();
+}
+
 extern "C" JNIEXPORT void JNICALL
 Java_eu_kanade_tachiyomi_util_waifu2x_Waifu2x_nativeSetUiBusy(JNIEnv *env,
                                                               jobject thiz,
@@ -554,11 +948,153 @@ Java_eu_kanade_tachiyomi_util_waifu2x_Waifu2x_nativeSetUiBusy(JNIEnv *env,
 extern "C" JNIEXPORT void JNICALL
 Java_eu_kanade_tachiyomi_util_waifu2x_Waifu2x_nativeUpdatePerformanceConfig(
     JNIEnv *env, jobject thiz, jint sleep_ms, jint tile_size) {
+  // Also applies to engines selected later, whose warm-up then uses the
+  // tile size their pages will
   std::lock_guard<std::mutex> lock(g_lock);
-  if (g_waifu2x) {
-    g_waifu2x->tile_sleep_ms = sleep_ms;
-    g_waifu2x->tilesize = tile_size;
-    LOGD("Updated performance config: sleep=%dms, tilesize=%d", sleep_ms,
-         tile_size);
-  }
+  g_duty_cycle.store(duty_from_sleep_ms(sleep_ms));
+  if (tile_size > 0)
+    g_tile_size.store(tile_size);
+  if (g_waifu2x)
+    apply_performance(*g_waifu2x);
+  LOGD("Updated performance config: sleep=%dms (duty %d%%), tilesize=%d",
+       sleep_ms, g_duty_cycle.load(), tile_size);
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_eu_kanade_tachiyomi_util_waifu2x_Waifu2x_nativeSetDutyCycle(
+    JNIEnv *env, jobject thiz, jint percent) {
+  std::lock_guard<std::mutex> lock(g_lock);
+  g_duty_cycle.store(std::min(std::max((int)percent, 1), 100));
+  if (g_waifu2x)
+    apply_performance(*g_waifu2x);
+  LOGD("Duty cycle set to %d%%", g_duty_cycle.load());
+}
+
+extern "C" JNIEXPORT jdoubleArray JNICALL
+Java_eu_kanade_tachiyomi_util_waifu2x_Waifu2x_nativeGetGovernorStats(
+    JNIEnv *env, jobject thiz) {
+  // [duty, waves, busy_ms, gap_ms, throttle_events, drift, hot]
+  std::lock_guard<std::mutex> lock(g_lock);
+  if (!g_waifu2x)
+    return nullptr;
+  GovernorStats stats = g_waifu2x->governor.stats();
+  jdouble values[7] = {(jdouble)g_waifu2x->governor.duty_cycle(),
+                       (jdouble)stats.waves,
+                       stats.busy_ms,
+                       stats.gap_ms,
+                       (jdouble)stats.throttle_events,
+                       stats.drift,
+                       stats.hot ? 1.0 : 0.0};
+  jdoubleArray result = env->NewDoubleArray(7);
+  if (result)
+    env->SetDoubleArrayRegion(result, 0, 7, values);
+  return result;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_eu_kanade_tachiyomi_util_waifu2x_Waifu2x_nativeSetAssetManager(
+    JNIEnv *env, jobject thiz, jobject asset_manager) {
+  std::lock_guard<std::mutex> lock(g_lock);
+  if (g_assets_ref)
+    return; // the application's manager lives as long as the process
+  g_assets_ref = env->NewGlobalRef(asset_manager);
+  g_assets = AAssetManager_fromJava(env, g_assets_ref);
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_eu_kanade_tachiyomi_util_waifu2x_Waifu2x_nativeSetPipelineCacheDir(
+    JNIEnv *env, jobject thiz, jstring dir) {
+  const char *path = env->GetStringUTFChars(dir, nullptr);
+  if (!path)
+    return;
+  std::lock_guard<std::mutex> lock(g_lock);
+  g_pipeline_cache_dir = path;
+  env->ReleaseStringUTFChars(dir, path);
+}
+
+extern "C" JNIEXPORT jdoubleArray JNICALL
+Java_eu_kanade_tachiyomi_util_waifu2x_Waifu2x_nativeGetModelState(
+    JNIEnv *env, jobject thiz) {
+  // [state (ModelState), load_ms, warm_up_ms, weight_bytes, in_place,
+  // rss_before, rss_after, pipelines_created, pipelines_restored]; all but
+  // the state describe the current engine
+  std::lock_guard<std::mutex> lock(g_lock);
+  const ModelLoadStats &stats = g_load_stats;
+  jdouble values[9] = {(jdouble)g_model_state.load(),
+                       stats.load_ms,
+                       stats.warm_up_ms,
+                       (jdouble)stats.weight_bytes,
+                       stats.weights_in_place ? 1.0 : 0.0,
+                       (jdouble)stats.rss_before,
+                       (jdouble)stats.rss_after,
+                       (jdouble)stats.pipelines_created,
+                       stats.pipelines_restored ? 1.0 : 0.0};
+  jdoubleArray result = env->NewDoubleArray(9);
+  if (result)
+    env->SetDoubleArrayRegion(result, 0, 9, values);
+  return result;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_eu_kanade_tachiyomi_util_waifu2x_Waifu2x_nativeSetTileCacheSize(
+    JNIEnv *env, jobject thiz, jint size_mb) {
+  g_tile_cache.set_max_bytes((size_t)std::max(0, (int)size_mb) << 20);
+  LOGD("Tile cache size set to %d MB", size_mb);
+}
+
+extern "C" JNIEXPORT jlongArray JNICALL
+Java_eu_kanade_tachiyomi_util_waifu2x_Waifu2x_nativeGetTileCacheStats(
+    JNIEnv *env, jobject thiz) {
+  // [entries, bytes, max_bytes, hits, misses]
+  TileCacheStats stats = g_tile_cache.stats();
+  jlong values[5] = {(jlong)stats.entries, (jlong)stats.bytes,
+                     (jlong)stats.max_bytes, (jlong)stats.hits,
+                     (jlong)stats.misses};
+  jlongArray result = env->NewLongArray(5);
+  if (result)
+    env->SetLongArrayRegion(result, 0, 5, values);
+  return result;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_eu_kanade_tachiyomi_util_waifu2x_Waifu2x_nativeSetModelMemoryBudget(
+    JNIEnv *env, jobject thiz, jint size_mb) {
+  // Evicted engines that are still processing are freed when they finish
+  g_models.set_max_bytes((size_t)std::max(0, (int)size_mb) << 20);
+  LOGD("Model memory budget set to %d MB", size_mb);
+}
+
+extern "C" JNIEXPORT jlongArray JNICALL
+Java_eu_kanade_tachiyomi_util_waifu2x_Waifu2x_nativeGetModelRegistryStats(
+    JNIEnv *env, jobject thiz) {
+  // [entries, bytes, max_bytes, hits, misses, evictions]
+  ModelRegistryStats stats = g_models.stats();
+  jlong values[6] = {(jlong)stats.entries, (jlong)stats.bytes,
+                     (jlong)stats.max_bytes, (jlong)stats.hits,
+                     (jlong)stats.misses, (jlong)stats.evictions};
+  jlongArray result = env->NewLongArray(6);
+  if (result)
+    env->SetLongArrayRegion(result, 0, 6, values);
+  return result;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_eu_kanade_tachiyomi_util_waifu2x_Waifu2x_nativeSetPartialResultsSize(
+    JNIEnv *env, jobject thiz, jint size_mb) {
+  g_partial_results.set_max_bytes((size_t)std::max(0, (int)size_mb) << 20);
+  LOGD("Partial results size set to %d MB", size_mb);
+}
+
+extern "C" JNIEXPORT jlongArray JNICALL
+Java_eu_kanade_tachiyomi_util_waifu2x_Waifu2x_nativeGetPartialResultsStats(
+    JNIEnv *env, jobject thiz) {
+  // [entries, bytes, max_bytes, stored, resumed]
+  PartialResultsStats stats = g_partial_results.stats();
+  jlong values[5] = {(jlong)stats.entries, (jlong)stats.bytes,
+                     (jlong)stats.max_bytes, (jlong)stats.stored,
+                     (jlong)stats.resumed};
+  jlongArray result = env->NewLongArray(5);
+  if (result)
+    env->SetLongArrayRegion(result, 0, 5, values);
+  return result;
 }
@@ -0,0 +1,85 @@
+#include "worker_pool.h"
+
+WorkerPool::WorkerPool(int num_threads, int max_queued)
+    : max_queued(max_queued < 1 ? 1 : max_queued) {
+  if (num_threads < 1)
+    num_threads = 1;
+  for (int i = 0; i < num_threads; i++)
+    workers.emplace_back(&WorkerPool::run, this);
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  task_cv.notify_all();
+  for (std::thread &t : workers)
+    t.join();
+}
+
+void WorkerPool::submit(std::function<void()> task) {
+  std::unique_lock<std::mutex> lock(mutex);
+  space_cv.wait(lock, [this] { return (int)tasks.size() < max_queued; });
+  tasks.push_back(std::move(task));
+  lock.unlock();
+  task_cv.notify_one();
+}
+
+void WorkerPool::notify_done() {
+  // Taking the mutex orders this with a waiter's predicate check, so the
+  // wake-up cannot be lost.
+  { std::lock_guard<std::mutex> lock(mutex); }
+  done_cv.notify_all();
+}
+
+void WorkerPool::wait_for_change(std::chrono::milliseconds timeout) {
+  std::unique_lock<std::mutex> lock(mutex);
+  done_cv.wait_for(lock, timeout);
+}
+
+void WorkerPool::run() {
+  for (;;) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      task_cv.wait(lock, [this] { return stopping || !tasks.empty(); });
+      if (tasks.empty())
+        return; // stopping and drained
+      task = std::move(tasks.front());
+      tasks.pop_front();
+    }
+    space_cv.notify_one();
+    task();
+  }
+}
+
+TileBatch::TileBatch(WorkerPool &pool, int max_tiles)
+    : pool(pool), completions(max_tiles) {}
+
+TileBatch::~TileBatch() { wait(); }
+
+void TileBatch::submit(int index, std::function<void()> task) {
+  submitted++;
+  const auto t_submit = std::chrono::steady_clock::now();
+  WorkerPool *owner = &pool;
+  pool.submit([this, owner, index, t_submit, task = std::move(task)]() {
+    task();
+    TileCompletion completion;
+    completion.index = index;
+    completion.latency_ms = std::chrono::duration<float, std::milli>(
+                                std::chrono::steady_clock::now() - t_submit)
+                                .count();
+    // Sized for every tile of the image, so this cannot fail
+    completions.push(completion);
+    // The batch may be destroyed as soon as finished is bumped; only touch
+    // the pool after this point.
+    finished.fetch_add(1, std::memory_order_release);
+    owner->notify_done();
+  });
+}
+
+void TileBatch::wait() {
+  while (finished.load(std::memory_order_acquire) < submitted)
+    pool.wait_for_change(std::chrono::milliseconds(2));
+}
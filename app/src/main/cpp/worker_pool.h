@@ -0,0 +1,148 @@
+// Long-lived worker threads for tile write-back.
+
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Bounded lock-free MPMC ring (Vyukov). push() fails when full, pop() when
+// empty; neither ever blocks.
+template <typename T> class LockFreeQueue {
+public:
+  explicit LockFreeQueue(size_t min_capacity)
+      : cells(round_up_pow2(min_capacity)), mask(cells.size() - 1) {
+    for (size_t i = 0; i < cells.size(); i++)
+      cells[i].seq.store(i, std::memory_order_relaxed);
+  }
+
+  bool push(const T &value) {
+    size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+    for (;;) {
+      Cell &cell = cells[pos & mask];
+      size_t seq = cell.seq.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+      if (diff == 0) {
+        if (enqueue_pos.compare_exchange_weak(pos, pos + 1,
+                                              std::memory_order_relaxed)) {
+          cell.value = value;
+          cell.seq.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = enqueue_pos.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  bool pop(T &value) {
+    size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+    for (;;) {
+      Cell &cell = cells[pos & mask];
+      size_t seq = cell.seq.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+      if (diff == 0) {
+        if (dequeue_pos.compare_exchange_weak(pos, pos + 1,
+                                              std::memory_order_relaxed)) {
+          value = cell.value;
+          cell.seq.store(pos + mask + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = dequeue_pos.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+private:
+  struct Cell {
+    std::atomic<size_t> seq{0};
+    T value{};
+  };
+
+  static size_t round_up_pow2(size_t n) {
+    size_t capacity = 2;
+    while (capacity < n)
+      capacity <<= 1;
+    return capacity;
+  }
+
+  std::vector<Cell> cells;
+  const size_t mask;
+  alignas(64) std::atomic<size_t> enqueue_pos{0};
+  alignas(64) std::atomic<size_t> dequeue_pos{0};
+};
+
+// Fixed set of threads created once and reused for every image. submit()
+// blocks while max_queued tasks are already waiting, which bounds the number
+// of output tiles held in memory.
+class WorkerPool {
+public:
+  WorkerPool(int num_threads, int max_queued);
+  ~WorkerPool();
+
+  void submit(std::function<void()> task);
+
+  // Wakes threads blocked in wait_for_change(). Called by tasks on completion.
+  void notify_done();
+
+  // Blocks until notify_done() is called or timeout expires.
+  void wait_for_change(std::chrono::milliseconds timeout);
+
+  int size() const { return (int)workers.size(); }
+
+private:
+  void run();
+
+  std::vector<std::thread> workers;
+  std::deque<std::function<void()>> tasks;
+  std::mutex mutex;
+  std::condition_variable task_cv;
+  std::condition_variable space_cv;
+  std::condition_variable done_cv;
+  int max_queued;
+  bool stopping = false;
+};
+
+struct TileCompletion {
+  int index;
+  float latency_ms; // submit to write-back finished
+};
+
+// The tasks one process() call submitted to a WorkerPool. Completions come
+// back through a lock-free queue so the submitting thread can poll them
+// between tiles without contending with the workers. The destructor waits for
+// every submitted task, so captured locals never dangle on early return.
+class TileBatch {
+public:
+  TileBatch(WorkerPool &pool, int max_tiles);
+  ~TileBatch();
+
+  void submit(int index, std::function<void()> task);
+
+  // Non-blocking; returns false when no completion is pending.
+  bool poll(TileCompletion &completion) { return completions.pop(completion); }
+
+  // Blocks until every submitted task has finished.
+  void wait();
+
+private:
+  WorkerPool &pool;
+  LockFreeQueue<TileCompletion> completions;
+  std::atomic<int> finished{0};
+  int submitted = 0;
+};
+
+#endif // WORKER_POOL_H
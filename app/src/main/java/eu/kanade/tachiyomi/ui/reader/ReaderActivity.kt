@@ -259,7 +259,8 @@ class ReaderActivity : BaseActivity() {
             .launchIn(lifecycleScope)
 
         if (readerPreferences.waifu2xEnabled().get()) {
-            Waifu2x.init(this, readerPreferences.waifu2xNoiseLevel().get())
+            // Loads and warms up in the background; the first page waits for it
+            Waifu2x.init(this, readerPreferences.waifu2xNoiseLevel().get(), async = true)
         }
     }
 
@@ -207,6 +207,7 @@ object ImageEnhancer {
         queue.clear()
         pendingRequests.clear()
         targetPageIndex = initialPageIndex
+        Waifu2x.setFocusPage(initialPageIndex)
         targetPageVariant = ""
         targetSecondaryPageIndex = -1
         targetSecondaryPageVariant = ""
@@ -224,6 +225,7 @@ object ImageEnhancer {
         secondaryPageVariant: String = "",
     ) {
         targetPageIndex = pageIndex
+        Waifu2x.setFocusPage(pageIndex)
         targetPageVariant = pageVariant
         targetSecondaryPageIndex = secondaryPageIndex ?: -1
         targetSecondaryPageVariant = if (secondaryPageIndex != null) secondaryPageVariant else ""
@@ -257,16 +259,22 @@ object ImageEnhancer {
     fun cancel(mangaId: Long, chapterId: Long, pageIndex: Int, pageVariant: String = "") {
         val requestKey = "${mangaId}_${chapterId}_${pageIndex}_${pageVariant}"
         if (pendingRequests.remove(requestKey) != null) {
-             val removed = queue.removeIf { 
-                 it.mangaId == mangaId && it.chapterId == chapterId && it.pageIndex == pageIndex && it.pageVariant == pageVariant
-             }
-             if (removed) {
-                 logcat(LogPriority.DEBUG) { "ImageEnhancer: Cancelled page $pageIndex/$pageVariant" }
-             }
+            if (isActivelyProcessing(mangaId, chapterId, pageIndex, pageVariant)) {
+                Waifu2x.cancelJobs(pageIndex, pageIndex)
+            }
+            val removed = queue.removeIf {
+                it.mangaId == mangaId && it.chapterId == chapterId && it.pageIndex == pageIndex && it.pageVariant == pageVariant
+            }
+            if (removed) {
+                logcat(LogPriority.DEBUG) { "ImageEnhancer: Cancelled page $pageIndex/$pageVariant" }
+            }
         }
     }
 
     fun cancelRequestsLessThan(context: Context, mangaId: Long, chapterId: Long, thresholdPageIndex: Int) {
+        if (activeMangaId == mangaId && activeChapterId == chapterId) {
+            Waifu2x.cancelJobs(0, thresholdPageIndex - 1)
+        }
         queue.removeIf { req ->
             if (req.mangaId == mangaId && req.chapterId == chapterId && req.pageIndex < thresholdPageIndex) {
                 pendingRequests.remove("${req.mangaId}_${req.chapterId}_${req.pageIndex}_${req.pageVariant}")
@@ -279,6 +287,9 @@ object ImageEnhancer {
     }
 
     fun cancelRequestsGreaterThan(context: Context, mangaId: Long, chapterId: Long, thresholdPageIndex: Int) {
+        if (activeMangaId == mangaId && activeChapterId == chapterId) {
+            Waifu2x.cancelJobs(thresholdPageIndex + 1, Int.MAX_VALUE)
+        }
         queue.removeIf { req ->
             if (req.mangaId == mangaId && req.chapterId == chapterId && req.pageIndex > thresholdPageIndex) {
                 pendingRequests.remove("${req.mangaId}_${req.chapterId}_${req.pageIndex}_${req.pageVariant}")
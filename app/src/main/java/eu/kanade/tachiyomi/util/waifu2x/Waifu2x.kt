@@ -1,7 +1,9 @@
 package eu.kanade.tachiyomi.util.waifu2x
 
 import android.content.Context
+import android.content.res.AssetManager
 import android.graphics.Bitmap
+import android.graphics.Rect
 import java.io.File
 
 /**
@@ -25,18 +27,18 @@ object Waifu2x {
         }
     }
 
-    fun init(context: Context, noiseLevel: Int = 2, scale: Int = 2): Boolean {
+    fun init(context: Context, noiseLevel: Int = 2, scale: Int = 2, async: Boolean = false): Boolean {
         if (isInitialized) return true
         
         return synchronized(this) {
             if (isInitialized) return true
     
-            val modelDir = extractModelsToCache(context, "waifu2x-models")
+            val modelDir = modelDir(context, "waifu2x-models")
             if (modelDir == null) {
                 return false
             }
     
-            isInitialized = nativeInit(modelDir, noiseLevel, scale)
+            isInitialized = nativeInit(modelDir, noiseLevel, scale, async)
             if (isInitialized) {
                 // Invalidate all other models
                 isRealCuganInitialized = false
@@ -49,13 +51,67 @@ object Waifu2x {
         }
     }
 
+    /**
+     * Loading state of the model selected last. The init functions take
+     * `async = true` to read the weights, build the pipelines and run a warm-up
+     * inference in the background; they then return as soon as the load is
+     * queued, and pages processed meanwhile wait for it natively.
+     */
+    enum class ModelState { NONE, LOADING, WARMING, READY, FAILED }
+
+    /**
+     * [weightsInPlace] is true when the weights are used from the mapped APK
+     * rather than a heap copy; [rssBefore] and [rssAfter] are the process's
+     * resident bytes around the load, warm-up excluded. [pipelinesRestored] is
+     * true when the Vulkan pipelines came from the cache of an earlier launch.
+     */
+    data class ModelReadiness(
+        val state: ModelState,
+        val loadMs: Double,
+        val warmUpMs: Double,
+        val weightBytes: Long = 0,
+        val weightsInPlace: Boolean = false,
+        val rssBefore: Long = 0,
+        val rssAfter: Long = 0,
+        val pipelinesCreated: Int = 0,
+        val pipelinesRestored: Boolean = false,
+    )
+
+    fun getModelReadiness(): ModelReadiness {
+        val v = nativeGetModelState()
+        return ModelReadiness(
+            ModelState.values()[v[0].toInt()],
+            v[1],
+            v[2],
+            v[3].toLong(),
+            v[4] != 0.0,
+            v[5].toLong(),
+            v[6].toLong(),
+            v[7].toInt(),
+            v[8] != 0.0,
+        )
+    }
+
+    /**
+     * Part of the input bitmap on screen, in input pixels. Its tiles are upscaled
+     * first, then the rest by distance from it, favouring the scroll direction
+     * (sign of [scrollDx] / [scrollDy]); see [getViewportProgressPercent].
+     */
+    data class Viewport(val rect: Rect, val scrollDx: Int = 0, val scrollDy: Int = 0) {
+        internal fun toIntArray() = intArrayOf(rect.left, rect.top, rect.right, rect.bottom, scrollDx, scrollDy)
+    }
+
     /**
      * Process a bitmap image with Waifu2x upscaling.
      * 
      * @param input Input bitmap (will not be modified)
+     * @param viewport Optional region to upscale first
+     * @param output Optional ARGB_8888 bitmap of the upscaled size, filled
+     *   progressively: a fast bilinear preview first, then each tile as it
+     *   finishes (see [pollDirtyRects]). It is also the returned bitmap.
      * @return Upscaled bitmap, or null if processing failed
      */
-    fun process(input: Bitmap, id: Int = -1): Bitmap? {
+    fun process(input: Bitmap, id: Int = -1, viewport: Viewport? = null, output: Bitmap? = null): Bitmap? {
         if (!isInitialized) return null
 
         // Ensure input is in ARGB_8888 format
@@ -65,14 +121,14 @@ object Waifu2x {
             input
         }
 
-        return nativeProcess(argbBitmap, id)
+        return nativeProcess(argbBitmap, id, viewport?.toIntArray(), output)
     }
 
     // Track current config to detect changes (excludes tileSleepMs since that doesn't require model reload)
     private data class RealCuganConfig(val noise: Int, val scale: Int, val isPro: Boolean)
     @Volatile private var lastRealCuganConfig: RealCuganConfig? = null
 
-    fun initRealCugan(context: Context, noiseLevel: Int, scale: Int, isPro: Boolean = false, tileSleepMs: Int = 0, tileSize: Int = 128): Boolean {
+    fun initRealCugan(context: Context, noiseLevel: Int, scale: Int, isPro: Boolean = false, tileSleepMs: Int = 0, tileSize: Int = 128, async: Boolean = false): Boolean {
         val newConfig = RealCuganConfig(noiseLevel, scale, isPro)
 
         // Fast path: if already initialized with same config, just update performance params and return
@@ -97,15 +153,16 @@ object Waifu2x {
             }
     
             val assetPath = if (isPro) "realcugan-pro-models" else "realcugan-models"
-            val modelDir = extractModelsToCache(context, assetPath)
+            val modelDir = modelDir(context, assetPath)
             if (modelDir == null) {
                 return false
             }
     
-            isRealCuganInitialized = nativeInitRealCugan(modelDir, noiseLevel, scale, tileSleepMs)
+            // Before the load, so the warm-up runs at the tile size pages will use
+            nativeUpdatePerformanceConfig(tileSleepMs, tileSize)
+            isRealCuganInitialized = nativeInitRealCugan(modelDir, noiseLevel, scale, tileSleepMs, async)
             if (isRealCuganInitialized) {
                 lastRealCuganConfig = currentConfig
-                nativeUpdatePerformanceConfig(tileSleepMs, tileSize)
                 
                 // Invalidate all other models
                 isInitialized = false
@@ -123,7 +180,7 @@ object Waifu2x {
     // Track Real-ESRGAN config
     private var lastRealEsrganScale: Int? = null
 
-    fun initRealESRGAN(context: Context, scale: Int, tileSleepMs: Int = 0, tileSize: Int = 128): Boolean = synchronized(this) {
+    fun initRealESRGAN(context: Context, scale: Int, tileSleepMs: Int = 0, tileSize: Int = 128, async: Boolean = false): Boolean = synchronized(this) {
         // Force reinit if config changed
         if (lastRealEsrganScale != scale) {
             android.util.Log.d("Waifu2x", "Real-ESRGAN scale changed from $lastRealEsrganScale to $scale, reinitializing...")
@@ -137,15 +194,15 @@ object Waifu2x {
         }
 
         // Asset path: realesrgan-models/v3-anime
-        val modelDir = extractModelsToCache(context, "realesrgan-models/v3-anime")
+        val modelDir = modelDir(context, "realesrgan-models/v3-anime")
         if (modelDir == null) {
             return false
         }
 
-        isRealEsrganInitialized = nativeInitRealESRGAN(modelDir, scale)
+        nativeUpdatePerformanceConfig(tileSleepMs, tileSize)
+        isRealEsrganInitialized = nativeInitRealESRGAN(modelDir, scale, async)
         if (isRealEsrganInitialized) {
             lastRealEsrganScale = scale
-            nativeUpdatePerformanceConfig(tileSleepMs, tileSize)
             
             // Invalidate all other models
             isInitialized = false
@@ -159,21 +216,20 @@ object Waifu2x {
         isRealEsrganInitialized
     }
 
-    fun initNose(context: Context, tileSleepMs: Int = 0, tileSize: Int = 128): Boolean = synchronized(this) {
+    fun initNose(context: Context, tileSleepMs: Int = 0, tileSize: Int = 128, async: Boolean = false): Boolean = synchronized(this) {
         if (isNoseInitialized) {
             nativeUpdatePerformanceConfig(tileSleepMs, tileSize)
             return true
         }
 
-        val modelDir = extractModelsToCache(context, "waifu2x-models-nose")
+        val modelDir = modelDir(context, "waifu2x-models-nose")
         if (modelDir == null) {
             return false
         }
 
-        isNoseInitialized = nativeInitNose(modelDir)
+        nativeUpdatePerformanceConfig(tileSleepMs, tileSize)
+        isNoseInitialized = nativeInitNose(modelDir, async)
         if (isNoseInitialized) {
-            nativeUpdatePerformanceConfig(tileSleepMs, tileSize)
-            
             // Invalidate all other models
             isInitialized = false
             isRealCuganInitialized = false
@@ -190,7 +246,7 @@ object Waifu2x {
     private data class Waifu2xConfig(val noise: Int, val scale: Int)
     private var lastWaifu2xConfig: Waifu2xConfig? = null
 
-    fun initWaifu2x(context: Context, noise: Int, scale: Int, tileSleepMs: Int = 0, tileSize: Int = 128): Boolean = synchronized(this) {
+    fun initWaifu2x(context: Context, noise: Int, scale: Int, tileSleepMs: Int = 0, tileSize: Int = 128, async: Boolean = false): Boolean = synchronized(this) {
         val newConfig = Waifu2xConfig(noise, scale)
         
         // Force reinit if config changed
@@ -204,13 +260,13 @@ object Waifu2x {
             return true
         }
         
-        val modelDir = extractModelsToCache(context, "waifu2x-models")
+        val modelDir = modelDir(context, "waifu2x-models")
         if (modelDir == null) return false
         
-        isWaifu2xInitialized = nativeInit(modelDir, noise, scale)
+        nativeUpdatePerformanceConfig(tileSleepMs, tileSize)
+        isWaifu2xInitialized = nativeInit(modelDir, noise, scale, async)
         if (isWaifu2xInitialized) {
             lastWaifu2xConfig = newConfig
-            nativeUpdatePerformanceConfig(tileSleepMs, tileSize)
             
             // Invalidate all other models
             isInitialized = false
@@ -224,7 +280,7 @@ object Waifu2x {
         isWaifu2xInitialized
     }
 
-    fun initWaifu2xUpconv7(context: Context, noise: Int, scale: Int, tileSleepMs: Int = 0, tileSize: Int = 128): Boolean = synchronized(this) {
+    fun initWaifu2xUpconv7(context: Context, noise: Int, scale: Int, tileSleepMs: Int = 0, tileSize: Int = 128, async: Boolean = false): Boolean = synchronized(this) {
         val newConfig = Waifu2xConfig(noise, scale)
 
         // Force reinit if config changed
@@ -238,13 +294,13 @@ object Waifu2x {
             return true
         }
 
-        val modelDir = extractModelsToCache(context, "waifu2x-models-upconv7")
+        val modelDir = modelDir(context, "waifu2x-models-upconv7")
         if (modelDir == null) return false
 
-        isWaifu2xInitialized = nativeInitWaifu2xUpconv7(modelDir, noise, scale)
+        nativeUpdatePerformanceConfig(tileSleepMs, tileSize)
+        isWaifu2xInitialized = nativeInitWaifu2xUpconv7(modelDir, noise, scale, async)
         if (isWaifu2xInitialized) {
             lastWaifu2xConfig = newConfig
-            nativeUpdatePerformanceConfig(tileSleepMs, tileSize)
             
             // Invalidate all other models
             isInitialized = false
@@ -262,24 +318,24 @@ object Waifu2x {
     // But check specific flags
     // Reuse processRealCugan for all generic ncnn models
     // But check specific flags
-    fun processRealESRGAN(input: Bitmap, id: Int = -1): Bitmap? {
+    fun processRealESRGAN(input: Bitmap, id: Int = -1, viewport: Viewport? = null, output: Bitmap? = null): Bitmap? {
         if (!isRealEsrganInitialized) return null
-        return processBitmapHelper(input, id)
+        return processBitmapHelper(input, id, viewport, output)
     }
     
-    fun processNose(input: Bitmap, id: Int = -1): Bitmap? {
+    fun processNose(input: Bitmap, id: Int = -1, viewport: Viewport? = null, output: Bitmap? = null): Bitmap? {
         if (!isNoseInitialized) return null
-        return processBitmapHelper(input, id)
+        return processBitmapHelper(input, id, viewport, output)
     }
 
-    fun processWaifu2x(input: Bitmap, id: Int = -1): Bitmap? {
+    fun processWaifu2x(input: Bitmap, id: Int = -1, viewport: Viewport? = null, output: Bitmap? = null): Bitmap? {
         if (!isWaifu2xInitialized) return null
-        return processBitmapHelper(input, id)
+        return processBitmapHelper(input, id, viewport, output)
     }
     
     @Volatile var processingId: Int = -1
 
-    private fun processBitmapHelper(input: Bitmap, id: Int): Bitmap? {
+    private fun processBitmapHelper(input: Bitmap, id: Int, viewport: Viewport?, output: Bitmap?): Bitmap? {
         if (input.isRecycled) return null
         
         val argbBitmap = if (input.config != Bitmap.Config.ARGB_8888) {
@@ -294,7 +350,7 @@ object Waifu2x {
         
         processingId = id
         try {
-            return nativeProcessRealCugan(argbBitmap, id)
+            return nativeProcessRealCugan(argbBitmap, id, viewport?.toIntArray(), output)
         } finally {
             processingId = -1
             if (argbBitmap !== input) {
@@ -317,6 +373,23 @@ object Waifu2x {
         return (packed and 0xFFFFFFFF).toInt()
     }
     
+    /**
+     * Percentage (0-100) of the current page's viewport tiles already written.
+     * At 100 the region on screen is final while the rest may still be running.
+     */
+    fun getViewportProgressPercent(): Int = nativeGetViewportProgress()
+
+    /**
+     * Regions of the progressive output bitmap of page [id] written since the last
+     * call, to invalidate on screen. Null once the page is no longer running; the
+     * bitmap returned by process is then final.
+     */
+    fun pollDirtyRects(id: Int): List<Rect>? {
+        val v = nativePollDirtyRects(id) ?: return null
+        // After an overflow the single rect is the whole bitmap
+        return (v.indices step 4).map { i -> Rect(v[i], v[i + 1], v[i] + v[i + 2], v[i + 1] + v[i + 3]) }
+    }
+
     /**
      * Get only the processing ID from the packed value.
      */
@@ -341,9 +414,9 @@ object Waifu2x {
     /**
      * Process bitmap with Real-CUGAN.
      */
-    fun processRealCugan(input: Bitmap, id: Int = -1): Bitmap? {
+    fun processRealCugan(input: Bitmap, id: Int = -1, viewport: Viewport? = null, output: Bitmap? = null): Bitmap? {
         if (!isRealCuganInitialized) return null
-        return processBitmapHelper(input, id)
+        return processBitmapHelper(input, id, viewport, output)
     }
 
     /**
@@ -430,28 +503,22 @@ object Waifu2x {
     }
 
 
-    private fun extractModelsToCache(context: Context, assetPath: String): String? {
+    /**
+     * Model directory for the native loader. Models are read straight from the
+     * APK, where they are stored uncompressed, so the weights are mapped in place
+     * rather than copied to the cache and then read into memory again. Vulkan
+     * pipelines are kept in the code cache, which Android clears on app and
+     * system updates, so later launches skip compiling them.
+     */
+    private fun modelDir(context: Context, assetPath: String): String? {
         return try {
-            val cacheDir = File(context.cacheDir, assetPath)
-            if (!cacheDir.exists()) {
-                cacheDir.mkdirs()
-            }
-
-            val assetManager = context.assets
-            val modelFiles = assetManager.list(assetPath) ?: return null
-
-            for (filename in modelFiles) {
-                val outFile = File(cacheDir, filename)
-                if (!outFile.exists()) {
-                    assetManager.open("$assetPath/$filename").use { input ->
-                        outFile.outputStream().use { output ->
-                            input.copyTo(output)
-                        }
-                    }
-                }
-            }
-
-            cacheDir.absolutePath
+            val assets = context.applicationContext.assets
+            if (assets.list(assetPath).isNullOrEmpty()) return null
+            nativeSetAssetManager(assets)
+            nativeSetPipelineCacheDir(File(context.codeCacheDir, "vk-pipelines").path)
+            // Copies made by earlier versions are no longer read
+            File(context.cacheDir, assetPath).deleteRecursively()
+            "asset:$assetPath"
         } catch (e: Exception) {
             null
         }
@@ -461,6 +528,99 @@ object Waifu2x {
         nativeSetUiBusy(busy)
     }
 
+    /**
+     * Stops native jobs whose id is in [minId, maxId] at their next tile, whether
+     * running or waiting for their turn; they return their input unchanged.
+     */
+    fun cancelJobs(minId: Int, maxId: Int): Int {
+        return try {
+            nativeCancelJobs(minId, maxId)
+        } catch (e: UnsatisfiedLinkError) {
+            0
+        }
+    }
+
+    /**
+     * Pages are upscaled natively in order of distance to [pageIndex]; a page
+     * already running yields to a closer one at its next tile and resumes later.
+     */
+    fun setFocusPage(pageIndex: Int) {
+        try {
+            nativeSetFocusPage(pageIndex)
+        } catch (e: UnsatisfiedLinkError) {
+            // Native library not available
+        }
+    }
+
+    /**
+     * Upscaled tiles are cached natively by input content, so repeated content
+     * across the pages of a chapter skips inference. 0 disables the cache.
+     */
+    fun setTileCacheSize(sizeMb: Int) {
+        nativeSetTileCacheSize(sizeMb)
+    }
+
+    data class TileCacheStats(
+        val entries: Long,
+        val bytes: Long,
+        val maxBytes: Long,
+        val hits: Long,
+        val misses: Long,
+    ) {
+        val hitRate: Double
+            get() = if (hits + misses > 0) hits.toDouble() / (hits + misses) else 0.0
+    }
+
+    fun getTileCacheStats(): TileCacheStats {
+        val v = nativeGetTileCacheStats()
+        return TileCacheStats(v[0], v[1], v[2], v[3], v[4])
+    }
+
+    /**
+     * Models loaded by the init functions stay resident natively, least recently
+     * used first out, so switching back to a model or noise level within
+     * [sizeMb] of weights and buffers skips the reload.
+     */
+    fun setModelMemoryBudget(sizeMb: Int) {
+        nativeSetModelMemoryBudget(sizeMb)
+    }
+
+    data class ModelRegistryStats(
+        val entries: Long,
+        val bytes: Long,
+        val maxBytes: Long,
+        val hits: Long,
+        val misses: Long,
+        val evictions: Long,
+    )
+
+    fun getModelRegistryStats(): ModelRegistryStats {
+        val v = nativeGetModelRegistryStats()
+        return ModelRegistryStats(v[0], v[1], v[2], v[3], v[4], v[5])
+    }
+
+    /**
+     * Pages cancelled part way (flipped away from, pruned) keep their finished
+     * tiles natively, so processing the same page again resumes instead of
+     * starting over. 0 disables it.
+     */
+    fun setPartialResultsSize(sizeMb: Int) {
+        nativeSetPartialResultsSize(sizeMb)
+    }
+
+    data class PartialResultsStats(
+        val entries: Long,
+        val bytes: Long,
+        val maxBytes: Long,
+        val stored: Long,
+        val resumed: Long,
+    )
+
+    fun getPartialResultsStats(): PartialResultsStats {
+        val v = nativeGetPartialResultsStats()
+        return PartialResultsStats(v[0], v[1], v[2], v[3], v[4])
+    }
+
     fun scaleBitmapNative(input: Bitmap, targetWidth: Int, targetHeight: Int): Bitmap? {
         if (input.isRecycled) return null
         if (input.width == targetWidth && input.height == targetHeight) return input
@@ -485,29 +645,72 @@ object Waifu2x {
     }
 
     // Native methods
-    private external fun nativeInit(modelDir: String, noiseLevel: Int, scale: Int): Boolean
-    private external fun nativeInitWaifu2xUpconv7(modelDir: String, noiseLevel: Int, scale: Int): Boolean
-    private external fun nativeProcess(input: Bitmap, id: Int): Bitmap?
+    private external fun nativeInit(modelDir: String, noiseLevel: Int, scale: Int, async: Boolean): Boolean
+    private external fun nativeInitWaifu2xUpconv7(modelDir: String, noiseLevel: Int, scale: Int, async: Boolean): Boolean
+    private external fun nativeProcess(input: Bitmap, id: Int, viewport: IntArray?, output: Bitmap?): Bitmap?
     private external fun nativeDestroy()
     private external fun nativeSetUiBusy(busy: Boolean)
+    private external fun nativeSetFocusPage(pageIndex: Int)
+    private external fun nativeCancelJobs(minId: Int, maxId: Int): Int
     
     // ... (Anime4K signatures unchanged)
 
     private external fun nativeInitAnime4K(shaders: Array<String>, names: Array<String>): Boolean
     private external fun nativeProcessAnime4K(input: Bitmap): Bitmap?
 
-    private external fun nativeInitRealCugan(modelDir: String, noiseLevel: Int, scale: Int, tileSleepMs: Int): Boolean
+    private external fun nativeInitRealCugan(modelDir: String, noiseLevel: Int, scale: Int, tileSleepMs: Int, async: Boolean): Boolean
     private external fun nativeUpdatePerformanceConfig(tileSleepMs: Int, tileSize: Int)
     
+    /**
+     * [tileSleepMs] is turned into a duty cycle (the share of time spent
+     * inferring) that the native governor holds, backing off further while
+     * the device is hot or [setUiBusy] is set; [tileSize] is the largest tile
+     * it may pick.
+     */
     fun updatePerformance(tileSleepMs: Int, tileSize: Int) {
         if (isRealCuganInitialized || isRealEsrganInitialized || isNoseInitialized || isWaifu2xInitialized) {
             nativeUpdatePerformanceConfig(tileSleepMs, tileSize)
         }
     }
+
+    /** Sets the governor's duty cycle directly, 1-100 percent. */
+    fun setDutyCycle(percent: Int) {
+        nativeSetDutyCycle(percent)
+    }
+
+    data class GovernorStats(
+        val dutyCycle: Int,
+        val waves: Long,
+        val busyMs: Double,
+        val gapMs: Double,
+        val throttleEvents: Int,
+        val thermalDrift: Double,
+        val hot: Boolean,
+    )
+
+    fun getGovernorStats(): GovernorStats? {
+        val v = nativeGetGovernorStats() ?: return null
+        return GovernorStats(
+            v[0].toInt(), v[1].toLong(), v[2], v[3], v[4].toInt(), v[5], v[6] != 0.0,
+        )
+    }
     
-    private external fun nativeInitRealESRGAN(modelDir: String, scale: Int): Boolean
-    private external fun nativeInitNose(modelDir: String): Boolean
-    private external fun nativeProcessRealCugan(input: Bitmap, id: Int): Bitmap?
+    private external fun nativeInitRealESRGAN(modelDir: String, scale: Int, async: Boolean): Boolean
+    private external fun nativeInitNose(modelDir: String, async: Boolean): Boolean
+    private external fun nativeProcessRealCugan(input: Bitmap, id: Int, viewport: IntArray?, output: Bitmap?): Bitmap?
     private external fun nativeScaleBitmap(input: Bitmap, targetWidth: Int, targetHeight: Int): Bitmap?
     private external fun nativeGetProgress(): Long
+    private external fun nativeGetViewportProgress(): Int
+    private external fun nativePollDirtyRects(id: Int): IntArray?
+    private external fun nativeSetTileCacheSize(sizeMb: Int)
+    private external fun nativeGetTileCacheStats(): LongArray
+    private external fun nativeSetModelMemoryBudget(sizeMb: Int)
+    private external fun nativeGetModelRegistryStats(): LongArray
+    private external fun nativeSetPartialResultsSize(sizeMb: Int)
+    private external fun nativeGetPartialResultsStats(): LongArray
+    private external fun nativeSetDutyCycle(percent: Int)
+    private external fun nativeGetGovernorStats(): DoubleArray?
+    private external fun nativeGetModelState(): DoubleArray
+    private external fun nativeSetAssetManager(assets: AssetManager)
+    private external fun nativeSetPipelineCacheDir(dir: String)
 }